@@ -29,7 +29,34 @@ typedef enum eieio_command_messages {
     SPINNAKER_REQUEST_READ_DATA,
 
     // Host confirming data being read form SpiNNaker memory
-    HOST_DATA_READ
+    HOST_DATA_READ,
+
+    // Host confirming data being read for several outstanding requests
+    HOST_DATA_READ_ACK,
+
+    // Several EIEIO packets in one message, each preceded by its length in
+    // bytes as a 16-bit value
+    EVENT_CONTAINER,
+
+    // Host publishing data already written into the buffer by memory writes
+    HOST_PUBLISH_WRITE_POINTER,
+
+    // Unused space in the buffer, given by a 16-bit zero and then the number
+    // of bytes of the space (including this command) as a 32-bit value
+    EVENT_SKIP,
+
+    // Spinnaker requesting new buffers for spike source population, giving
+    // the rate at which the buffer is being emptied as well as the space
+    SPINNAKER_REQUEST_REFILL,
+
+    // Live events of a timestep from a range of keys, as a bitfield of the
+    // atoms that fired, or as the lengths of alternating runs of atoms that
+    // did not and did fire
+    EVENT_SPIKE_FRAME,
+
+    // The non-zero numbers of live events from a range of keys over a window
+    // of timesteps
+    EVENT_RATE_COUNTS
 } eieio_command_messages;
 
 //! The different buffer operations
@@ -12,6 +12,71 @@
 #include <spin1_api.h>
 #include <buffered_eieio_defs.h>
 
+//! The number of DTCM staging buffers per channel when recording
+//! asynchronously
+#define N_STAGING_BUFFERS 2
+
+//! The DMA tag used by recording; the channel and staging buffer are held in
+//! the bits covered by RECORDING_DMA_CHANNEL_MASK
+#define RECORDING_DMA_TAG 0x1000
+
+//! The bits of a recording DMA tag which identify the channel and buffer
+#define RECORDING_DMA_CHANNEL_MASK 0x0FFF
+
+//! Flag for a region which, when full, overwrites its oldest records instead
+//! of dropping new ones.  Each record in the region is preceded by its length
+//! in bytes as a 32-bit word, and padded to a whole number of words.  The
+//! region is not read until recording is complete.
+#define RECORDING_REGION_FLAG_RING 0x1
+
+//! Flag for a region in which each record is preceded by a
+//! recording_frame_header_t, giving the time step in which it was recorded
+#define RECORDING_REGION_FLAG_FRAMED 0x2
+
+//! Flag for a region which records into chunks of the pool shared by all the
+//! regions of the core.  This is set by the host for every region when the
+//! pool is in use, so that the host knows how to read the region.
+#define RECORDING_REGION_FLAG_POOLED 0x4
+
+//! Flag for a region in which each record is compressed against the record
+//! before it that was made at the same level of callback nesting; the level
+//! is 0 for a callback that did not interrupt another recording into the
+//! region, and one more for each that it did.  Each record (including its
+//! frame header if framed) is written as its length shifted left by
+//! RECORDING_COMPRESSION_LEVEL_BITS and ored with its level, followed by
+//! runs of bytes that are the same as those of the previous record and runs
+//! of bytes that differ, given as the exclusive or with the previous
+//! record; all of the lengths are unsigned LEB128 varints.  Only the first
+//! RECORDING_COMPRESSION_HISTORY_SIZE bytes of the previous record are
+//! compared against.  A zero byte where a record would start is padding,
+//! and is skipped.  Compressed regions can only be recorded with
+//! recording_record, and cannot be ring regions.
+#define RECORDING_REGION_FLAG_COMPRESSED 0x8
+
+//! The number of bytes of the previous record that each record of a
+//! compressed region is compared against
+#define RECORDING_COMPRESSION_HISTORY_SIZE 256
+
+//! The number of bits of the length of a compressed record that hold the
+//! level of callback nesting at which it was made
+#define RECORDING_COMPRESSION_LEVEL_BITS 2
+
+//! The number of levels of callback nesting at which records can be made in
+//! a compressed region
+#define RECORDING_COMPRESSION_LEVELS (1 << RECORDING_COMPRESSION_LEVEL_BITS)
+
+//! \brief The header in front of each record in a framed region.  The time
+//!        is the one after that last passed to recording_do_timestep_update,
+//!        which is the current time step if recording_do_timestep_update is
+//!        called at the end of each timer tick.
+typedef struct recording_frame_header_t {
+    //! The time step in which the record was recorded
+    uint32_t time;
+
+    //! The length of the record in bytes, excluding this header
+    uint32_t length;
+} recording_frame_header_t;
+
 typedef struct {
     uint16_t eieio_header_command;
     uint16_t chip_id;
@@ -39,6 +104,38 @@ typedef struct {
     uint32_t space_read;
 } host_data_read_packet_data;
 
+//! \brief The acknowledgement of read requests sent by the host when more
+//!        than one read request can be outstanding
+typedef struct {
+    uint16_t eieio_header_command;
+
+    //! The sequence number up to which all requests have been read
+    uint8_t sequence;
+    uint8_t unused;
+
+    //! A bit for each of the 32 requests after sequence, set if the request
+    //! has been read out of order
+    uint32_t selective;
+} host_data_read_ack_packet;
+
+//! \brief An area of a recording channel that has been reserved for writing.
+//!        The area is split in two when it wraps around the end of the
+//!        channel, in which case the first part runs to the end of the
+//!        channel and the second starts at the beginning of the channel.
+typedef struct recording_span_t {
+    //! The start of the first part of the reserved area
+    uint8_t *first;
+
+    //! The number of bytes in the first part of the reserved area
+    uint32_t first_length;
+
+    //! The start of the second part of the reserved area
+    uint8_t *second;
+
+    //! The number of bytes in the second part (0 if the area doesn't wrap)
+    uint32_t second_length;
+} recording_span_t;
+
 //! \brief Determines if the given channel has space assigned for recording.
 //! \param[in] recording_flags The flags as returned by recording_initialize
 //! \param[in] channel The channel to check
@@ -57,6 +154,32 @@ inline bool recording_is_channel_enabled(
 bool recording_record(
     uint8_t channel, void *data, uint32_t size_bytes);
 
+//! \brief reserves space in a recording channel so that a record can be
+//!        written directly into the channel without an intermediate copy.
+//!        Space cannot be reserved in a compressed channel.
+//!        Records can be made from callbacks at any priority without
+//!        disabling interrupts; the space is taken as soon as it is
+//!        reserved, and every reservation must be committed with
+//!        recording_commit before the callback that made it returns.  The
+//!        data is not read until all the reservations outstanding on the
+//!        channel have been committed.  In a ring channel, the oldest
+//!        records are discarded as soon as the space is reserved.
+//! \param[in] channel the channel to reserve space in.
+//! \param[in] size_bytes the number of bytes to reserve.
+//! \param[out] span the area reserved, which is only valid if the function
+//!             returns True.
+//! \return boolean which is True if the space has been reserved, False if
+//!         there is not enough space in the channel.
+bool recording_reserve(
+    uint8_t channel, uint32_t size_bytes, recording_span_t *span);
+
+//! \brief commits a reservation made by recording_reserve, once all of the
+//!        reserved area has been written, making the data visible for
+//!        reading once no other reservation on the channel is outstanding.
+//! \param[in] channel the channel that the reservation was made in.
+//! \param[in] span the span returned by recording_reserve.
+void recording_commit(uint8_t channel, recording_span_t *span);
+
 //! \brief Finishes recording - should only be called if recording_flags is
 //!        not 0
 void recording_finalise();
@@ -76,17 +199,61 @@ void recording_finalise();
 //!                // minimum time between sending read requests
 //!                uint32_t time_between_triggers;
 //!
-//!                // space that will hold the last sequence number once
-//!                // recording is complete
-//!                uint32_t last_sequence_number
+//!                // size of each DTCM staging buffer of each channel, or 0
+//!                // to write records directly to SDRAM
+//!                uint32_t staging_buffer_size;
+//!
+//!                // estimated time in timer ticks for the host to respond
+//!                // to a read request; if non-zero, reads are requested
+//!                // when a channel would otherwise fill at its average
+//!                // fill rate, instead of at buffer_size_before_request
+//!                uint32_t round_trip_time;
 //!
-//!                // pointer to each region to be filled in (can be read
-//!                // after recording is complete)
+//!                // size of an SDRAM pool to be shared by all the regions,
+//!                // or 0 to give each region its own block of SDRAM; pooled
+//!                // regions are written directly, and never as rings
+//!                uint32_t pool_size;
+//!
+//!                // size of each chunk of the pool, including the word at
+//!                // the start which links to the next chunk of the region;
+//!                // no record can be bigger than a chunk
+//!                uint32_t pool_chunk_size;
+//!
+//!                // number of read request messages that can be waiting for
+//!                // the host at once; 0 or 1 waits for each to be read
+//!                // before sending the next
+//!                uint32_t read_window_size;
+//!
+//!                // the state block, which is filled in whenever the
+//!                // channels are reset and once recording is complete, so
+//!                // that the host can read it in one go: the version of the
+//!                // layout of the block (only written once recording is
+//!                // complete, and 0 after a reset), the last sequence
+//!                // number sent, and the state of each channel (5 words
+//!                // each)
+//!                uint32_t state_version;
+//!                uint32_t last_sequence_number;
+//!                recording_channel_t channel_state[n_regions];
+//!
+//!                // pointer to each region to be filled in; all of the
+//!                // regions (or the pool) are in one block of SDRAM
 //!                uint32_t* pointer_to_address_of_region[n_regions]
 //!
-//!                // size of each region to be recorded
+//!                // size of each region to be recorded; when pooled, the
+//!                // most of the pool that the region can use
 //!                uint32_t size_of_region[n_regions];
 //!
+//!                // flags of each region to be recorded; see
+//!                // RECORDING_REGION_FLAG_RING,
+//!                // RECORDING_REGION_FLAG_FRAMED,
+//!                // RECORDING_REGION_FLAG_POOLED and
+//!                // RECORDING_REGION_FLAG_COMPRESSED
+//!                uint32_t flags_of_region[n_regions];
+//!
+//!                // when pooled, the part of the pool that each region is
+//!                // guaranteed to be able to use
+//!                uint32_t min_size_of_region[n_regions];
+//!
 //!            }
 //! \param[out] recording_flags Output of flags which can be used to check if
 //!            a channel is enabled for recording
@@ -101,4 +268,25 @@ void recording_reset();
 //!        be called if recording flags is not 0
 void recording_do_timestep_update(uint32_t time);
 
+//! \brief Registers a callback for the completion of DMA transfers that
+//!        were not started by recording.  recording_initialize registers
+//!        recording_dma_transfer_done as the DMA_TRANSFER_DONE callback when
+//!        staging buffers are in use, which replaces any callback that the
+//!        application registered before; an application that does its own
+//!        DMA should therefore call this rather than spin1_callback_on.  It
+//!        can be called before or after recording_initialize.
+//! \param[in] callback The callback to pass the other transfers to
+void recording_chain_dma_transfer_done(callback_t callback);
+
+//! \brief Handles the completion of a DMA transfer started when recording
+//!        asynchronously, and passes any other transfer on to the callback
+//!        given to recording_chain_dma_transfer_done.  This is registered as
+//!        the DMA_TRANSFER_DONE callback when staging buffers are in use or
+//!        a callback has been chained; an application that registers its
+//!        own callback instead must pass on any transfer with a tag matching
+//!        RECORDING_DMA_TAG.
+//! \param[in] unused The id of the transfer (unused)
+//! \param[in] tag The tag of the transfer
+void recording_dma_transfer_done(uint unused, uint tag);
+
 #endif // _RECORDING_H_
@@ -20,14 +20,34 @@ enum recording_data_e {
     SDP_PORT,
     BUFFER_SIZE_BEFORE_REQUEST,
     TIME_BETWEEN_TRIGGERS,
+    STAGING_BUFFER_SIZE,
+    ROUND_TRIP_TIME,
+    POOL_SIZE,
+    POOL_CHUNK_SIZE,
+    READ_WINDOW_SIZE,
+    STATE_VERSION,
     LAST_SEQUENCE_NUMBER,
-    REGION_POINTERS_START
+    CHANNEL_STATES_START
 };
 
+//! The version of the layout of the state block, which is written into the
+//! header once recording is finalised so that the host knows that the state
+//! is complete and how to read it
+#define RECORDING_STATE_VERSION 1
+
+//! The most read requests that fit in a buffering out trigger message
+#define MAX_READ_REQUESTS 7
+
+//! The most read request messages that can be outstanding at once; this
+//! must divide the number of sequence numbers
+#define MAX_READ_WINDOW 8
+
 //---------------------------------------
 // Structures
 //---------------------------------------
-//! structure that defines a channel in memory.
+//! structure that defines a channel in memory.  This is the state that is
+//! copied to the state block for the host; last_buffer_operation is only
+//! filled in there, as the channel itself uses recording_counters_t.
 typedef struct recording_channel_t {
     uint8_t *start;
     uint8_t *current_write;
@@ -38,13 +58,148 @@ typedef struct recording_channel_t {
     buffered_operations last_buffer_operation;
 } recording_channel_t;
 
+//! structure that holds the DTCM staging state of a channel that is
+//! recording asynchronously.  Records are reserved in the active buffer;
+//! whole words of a buffer are then written to SDRAM by DMA while the other
+//! buffer is filled.
+typedef struct recording_staging_t {
+    //! The DTCM buffers that records are staged in
+    uint8_t *buffers[N_STAGING_BUFFERS];
+
+    //! The buffer currently being filled
+    uint32_t active;
+
+    //! The number of bytes in the active buffer
+    uint32_t fill;
+
+    //! Where the next flushed buffer will be written to in SDRAM
+    uint8_t *dma_write;
+
+    //! The number of DMA transfers outstanding for each buffer
+    volatile uint32_t in_flight[N_STAGING_BUFFERS];
+
+    //! The number of bytes being transferred from each buffer
+    uint32_t flushed[N_STAGING_BUFFERS];
+
+    //! The committed write pointer once the transfers of a buffer are done
+    uint8_t *commit_to[N_STAGING_BUFFERS];
+} recording_staging_t;
+
+//! structure that holds the state of a channel that records into chunks of
+//! the shared pool.  The chunks of a channel form a list in SDRAM, linked by
+//! the address of the next chunk in the first word of each chunk; data is
+//! written at the tail of the list and read from the head.
+typedef struct recording_pool_channel_t {
+    //! The chunk being read from
+    uint8_t *head;
+
+    //! The chunk being reserved in
+    uint8_t *tail;
+
+    //! The number of chunks owned by the channel
+    uint32_t n_chunks;
+
+    //! The number of chunks that the channel is guaranteed to get
+    uint32_t min_chunks;
+
+    //! The most chunks that the channel can own
+    uint32_t max_chunks;
+} recording_pool_channel_t;
+
+//! structure that holds the progress of the writers and the reader of a
+//! channel as byte counts that only ever increase (wrapping at 2^32), so
+//! that a full channel can be told apart from an empty one without a flag.
+//! Each count has a single writer: reserved is only changed by reservations,
+//! written by commits (or by DMA completion when staging), and read by the
+//! handling of the host reads (or by reservations in a ring channel, which
+//! the host does not read until recording is complete).
+//!
+//! Records can be made at any callback priority; a reservation takes its
+//! space with interrupts disabled for only a few instructions.  As a
+//! callback that preempts another always returns before the one that it
+//! preempted carries on, reservations are committed in the reverse order to
+//! that in which they were made, so the reserved space is published to the
+//! reader once the outermost reservation is committed.  A record made at a
+//! higher priority is therefore only held back until the record that it
+//! interrupted has been written, and not for the rest of that callback.
+typedef struct recording_counters_t {
+    //! The number of bytes reserved, committed or not
+    uint32_t reserved;
+
+    //! The number of bytes committed and available to be read
+    volatile uint32_t written;
+
+    //! The number of bytes read by the host (or discarded from a ring)
+    volatile uint32_t read;
+
+    //! The number of reservations that have not yet been committed
+    uint32_t n_reserving;
+
+    //! Where the next reservation will start
+    uint8_t *reserve_pointer;
+} recording_counters_t;
+
+//! structure that holds a read request that has been sent to the host but
+//! not yet applied, when more than one request can be outstanding
+typedef struct recording_read_slot_t {
+    //! True if the host has acknowledged the request
+    bool acked;
+
+    //! The time at which the request was last sent
+    uint32_t time_sent;
+
+    //! The number of reads in the request
+    uint32_t n_requests;
+
+    //! The reads in the request, as sent
+    read_request_packet_data requests[MAX_READ_REQUESTS];
+} recording_read_slot_t;
+
+//! structure that holds the start of the last record made at a level of
+//! callback nesting in a compressed channel, which the next record made at
+//! that level is compared against
+typedef struct recording_history_t {
+    //! The number of bytes held
+    uint32_t length;
+
+    //! The first bytes of the last record
+    uint8_t bytes[RECORDING_COMPRESSION_HISTORY_SIZE];
+} recording_history_t;
+
+//! structure that holds the state of a compressed channel.  Records made at
+//! the same level of nesting can't interrupt each other, so each level can
+//! use its history without disabling interrupts.
+typedef struct recording_compression_t {
+    //! The number of records being made, which is the level of the next
+    uint32_t n_recording;
+
+    //! The history of each level
+    recording_history_t history[RECORDING_COMPRESSION_LEVELS];
+} recording_compression_t;
+
+//! structure that tracks the rate at which a channel is being filled, used
+//! to decide when to request a read when the trigger is adaptive
+typedef struct recording_rate_t {
+    //! The number of bytes committed since the last timestep update
+    uint32_t bytes_this_tick;
+
+    //! The moving average of bytes committed per tick, with
+    //! RATE_FRACTIONAL_BITS fractional bits
+    uint32_t average;
+} recording_rate_t;
+
 //---------------------------------------
 // Globals
 //---------------------------------------
 //! array containing all possible channels.
 static recording_channel_t *g_recording_channels = NULL;
+
+//! array containing the byte counters of all possible channels
+static recording_counters_t *g_recording_counters = NULL;
 static address_t *region_addresses = NULL;
 static uint32_t *region_sizes = NULL;
+static uint32_t *region_flags = NULL;
+static uint32_t *region_min_sizes = NULL;
 static uint32_t n_recording_regions = 0;
 static uint32_t sdp_port = 0;
 static uint32_t sequence_number = 0;
@@ -52,8 +207,70 @@ static uint32_t last_time_buffering_trigger = 0;
 static uint32_t buffer_size_before_trigger = 0;
 static uint32_t time_between_triggers = 0;
 
-// A pointer to the last sequence number to write once recording is complete
-static uint32_t *last_sequence_number;
+//! The size of each DTCM staging buffer, or 0 if recording synchronously
+static uint32_t staging_buffer_size = 0;
+
+//! array containing the staging state of all possible channels, if staging
+static recording_staging_t *g_recording_staging = NULL;
+
+//! The estimated time in ticks for the host to respond to a read request, or
+//! 0 if reads are requested at a fixed fill level
+static uint32_t round_trip_time = 0;
+
+//! array containing the fill rate of all possible channels, if adaptive
+static recording_rate_t *g_recording_rates = NULL;
+
+//! array containing the compression state of all possible channels, if
+//! any channel is compressed
+static recording_compression_t *g_recording_compression = NULL;
+
+//! The size of the SDRAM pool shared by the channels, or 0 if each channel
+//! has its own region
+static uint32_t pool_size = 0;
+
+//! The size of each chunk of the pool, including the link to the next chunk
+static uint32_t pool_chunk_size = 0;
+
+//! The first chunk of the pool
+static uint8_t *pool_chunks = NULL;
+
+//! The number of chunks in the pool
+static uint32_t pool_n_chunks = 0;
+
+//! The indices of the chunks of the pool that are not in use
+static uint16_t *pool_free_chunks = NULL;
+
+//! The number of chunks of the pool that are not in use
+static uint32_t pool_n_free = 0;
+
+//! The number of free chunks held back to meet the minimums of the channels
+static uint32_t pool_n_reserved = 0;
+
+//! array containing the pool state of all possible channels, if pooled
+static recording_pool_channel_t *g_recording_pool = NULL;
+
+//! The number of read request messages that can be outstanding at once
+static uint32_t read_window_size = 1;
+
+//! The sequence number of the next read request message, when more than one
+//! can be outstanding; sequence_number is then that of the oldest one
+static uint32_t next_sequence_number = 0;
+
+//! The read request messages that are outstanding, by sequence number
+static recording_read_slot_t *g_read_slots = NULL;
+
+//! The number of bytes of each channel in outstanding read requests
+static uint32_t *requested_bytes = NULL;
+
+//! The time last passed to recording_do_timestep_update; records in framed
+//! channels are stamped with the time after this.  This is kept between
+//! runs, so that time carries on after a resume.
+static uint32_t recording_time = UINT32_MAX;
+
+//! The block of the header that holds the version of the state, the last
+//! sequence number and the state of each channel, which is written once
+//! recording is complete so that the host can read it all in one go
+static address_t recording_state = NULL;
 
 //! An SDP Message and parts
 static sdp_msg_t msg;
@@ -63,6 +280,34 @@ static read_request_packet_data *data_ptr;
 //! The time between buffer read messages
 #define MIN_TIME_BETWEEN_TRIGGERS 50
 
+//! The priority of the DMA completion callback used by asynchronous recording
+#define DMA_TRANSFER_DONE_PRIORITY 0
+
+//! The callback to which the completion of DMA transfers not started by
+//! recording is passed, or NULL if there is none
+static callback_t chained_dma_transfer_done = NULL;
+
+//! The most DMA transfers needed to flush a staging buffer (two if it wraps)
+#define MAX_TRANSFERS_PER_FLUSH 2
+
+//! The size of the length word that precedes each record in a ring channel
+#define RING_RECORD_HEADER_SIZE sizeof(uint32_t)
+
+//! The size of the link to the next chunk at the start of each pool chunk
+#define POOL_CHUNK_HEADER_SIZE sizeof(uint32_t)
+
+//! The most chunks that a pool can have, as the free chunks are kept as
+//! uint16_t indices
+#define POOL_MAX_CHUNKS 65536
+
+
+//! The number of fractional bits in the average fill rate
+#define RATE_FRACTIONAL_BITS 8
+
+//! The weight of a new sample in the average fill rate, as a shift; a new
+//! sample contributes 1 / (1 << RATE_SAMPLE_SHIFT) of the average
+#define RATE_SAMPLE_SHIFT 3
+
 //---------------------------------------
 // Private method
 //---------------------------------------
@@ -73,6 +318,51 @@ static inline bool _has_been_initialsed(uint8_t channel) {
     return g_recording_channels[channel].start != NULL;
 }
 
+//! \brief checks if a channel is recorded via DTCM staging buffers and DMA
+//! \param[in] channel the channel to check
+//! \return True if the channel is recorded asynchronously
+static inline bool _is_staged(uint8_t channel) {
+    return g_recording_staging != NULL &&
+        g_recording_staging[channel].buffers[0] != NULL;
+}
+
+//! \brief checks if a channel records into chunks of the shared pool
+//! \param[in] channel the channel to check
+//! \return True if the channel is a pooled channel
+static inline bool _is_pooled(uint8_t channel) {
+    return (region_flags[channel] & RECORDING_REGION_FLAG_POOLED) != 0;
+}
+
+//! \brief checks if a channel overwrites its oldest records when full
+//! \param[in] channel the channel to check
+//! \return True if the channel is a ring channel
+static inline bool _is_ring(uint8_t channel) {
+    return !_is_pooled(channel) &&
+        (region_flags[channel] & RECORDING_REGION_FLAG_RING) != 0;
+}
+
+//! \brief checks if a channel stamps each record with the time
+//! \param[in] channel the channel to check
+//! \return True if the channel is a framed channel
+static inline bool _is_framed(uint8_t channel) {
+    return (region_flags[channel] & RECORDING_REGION_FLAG_FRAMED) != 0;
+}
+
+//! \brief checks if a channel compresses each record against the last
+//! \param[in] channel the channel to check
+//! \return True if the channel is a compressed channel
+static inline bool _is_compressed(uint8_t channel) {
+    return (region_flags[channel] & RECORDING_REGION_FLAG_COMPRESSED) != 0;
+}
+
+//! \brief works out the space taken up by a record in a ring channel,
+//!        including the length word and the padding to a word boundary
+//! \param[in] size_bytes the size of the record
+//! \return the space taken up by the record
+static inline uint32_t _ring_record_space(uint32_t size_bytes) {
+    return RING_RECORD_HEADER_SIZE + ((size_bytes + 3) & ~0x3);
+}
+
 //----------------------------------------
 //  Private method
 //----------------------------------------
@@ -85,6 +375,110 @@ static inline bool _close_channel(uint8_t channel) {
     return true;
 }
 
+//! \brief takes a chunk from the pool for a channel, as long as the channel is
+//!        within its maximum, and the chunk is not needed to meet the
+//!        minimum of another channel
+//! \param[in] channel the channel to take the chunk for
+//! \return the chunk, or NULL if no chunk can be taken
+static uint8_t *_recording_pool_acquire(uint8_t channel) {
+    recording_pool_channel_t *pool_channel = &g_recording_pool[channel];
+    uint8_t *chunk = NULL;
+
+    uint cpsr = spin1_int_disable();
+    bool in_minimum = pool_channel->n_chunks < pool_channel->min_chunks;
+    if ((pool_channel->n_chunks < pool_channel->max_chunks) &&
+            (in_minimum || (pool_n_free > pool_n_reserved))) {
+        if (in_minimum) {
+            pool_n_reserved -= 1;
+        }
+        pool_n_free -= 1;
+        chunk = &pool_chunks[pool_free_chunks[pool_n_free] * pool_chunk_size];
+        pool_channel->n_chunks += 1;
+        *((uint32_t *) chunk) = 0;
+    }
+    spin1_mode_restore(cpsr);
+    return chunk;
+}
+
+//! \brief gives a chunk of a channel back to the pool
+//! \param[in] channel the channel that owns the chunk
+//! \param[in] chunk the chunk to give back
+static void _recording_pool_release(uint8_t channel, uint8_t *chunk) {
+    recording_pool_channel_t *pool_channel = &g_recording_pool[channel];
+
+    uint cpsr = spin1_int_disable();
+    pool_channel->n_chunks -= 1;
+    if (pool_channel->n_chunks < pool_channel->min_chunks) {
+        pool_n_reserved += 1;
+    }
+    pool_free_chunks[pool_n_free] = (chunk - pool_chunks) / pool_chunk_size;
+    pool_n_free += 1;
+    spin1_mode_restore(cpsr);
+}
+
+//! \brief moves the read pointer of a pooled channel on, giving back to the
+//!        pool each chunk that has been completely read
+//! \param[in] channel the channel that has been read
+//! \param[in] space_read the number of bytes that have been read
+static void _recording_pool_read(uint8_t channel, uint32_t space_read) {
+    recording_channel_t *recording_channel = &g_recording_channels[channel];
+    recording_pool_channel_t *pool_channel = &g_recording_pool[channel];
+
+    while (true) {
+        uint8_t *chunk_end = pool_channel->head + pool_chunk_size;
+
+        // Move on to the next chunk once the end of this one is read; the
+        // link is always written before the tail moves on
+        if (recording_channel->current_read == chunk_end &&
+                pool_channel->head != pool_channel->tail) {
+            uint8_t *next = (uint8_t *) *((uint32_t *) pool_channel->head);
+            _recording_pool_release(channel, pool_channel->head);
+            pool_channel->head = next;
+            recording_channel->current_read = next + POOL_CHUNK_HEADER_SIZE;
+            continue;
+        }
+        uint32_t n_bytes = chunk_end - recording_channel->current_read;
+        if (n_bytes > space_read) {
+            n_bytes = space_read;
+        }
+        if (n_bytes == 0) {
+            break;
+        }
+        recording_channel->current_read += n_bytes;
+        g_recording_counters[channel].read += n_bytes;
+        space_read -= n_bytes;
+    }
+}
+
+//! \brief moves the read pointer of a channel on once the host has read data
+//! \param[in] channel the channel that has been read
+//! \param[in] space_read the number of bytes that have been read
+static void _recording_read_done(uint8_t channel, uint32_t space_read) {
+    if (_is_pooled(channel)) {
+        _recording_pool_read(channel, space_read);
+        return;
+    }
+
+    uint32_t temp_value = (uint32_t) (
+        g_recording_channels[channel].current_read + space_read);
+
+    log_debug(
+        "channel %d, updating read pointer by %d bytes, from 0x%08x",
+        channel, space_read, g_recording_channels[channel].current_read);
+    if (temp_value >= (uint32_t) g_recording_channels[channel].end) {
+        uint32_t channel_space_total = (uint32_t) (
+            g_recording_channels[channel].end -
+            g_recording_channels[channel].start);
+        temp_value = temp_value - channel_space_total;
+        log_debug("channel %d, read wrap around", channel);
+    }
+
+    // The pointer is moved before the count, so that a writer never sees
+    // space that has not yet been given up
+    g_recording_channels[channel].current_read = (uint8_t *) temp_value;
+    g_recording_counters[channel].read += space_read;
+}
+
 static inline void _recording_host_data_read(eieio_msg_t msg, uint length) {
     host_data_read_packet_header *ptr_hdr =
         (host_data_read_packet_header *) msg;
@@ -103,26 +497,45 @@ static inline void _recording_host_data_read(eieio_msg_t msg, uint length) {
     sequence_number = (sequence_number + 1) & MAX_SEQUENCE_NO;
 
     for (i = 0; i < n_requests; i++) {
-        uint8_t channel = ptr_data[i].channel;
-        uint32_t space_read = ptr_data[i].space_read;
-
-        uint32_t temp_value = (uint32_t) (
-            g_recording_channels[channel].current_read + space_read);
+        _recording_read_done(ptr_data[i].channel, ptr_data[i].space_read);
+    }
+}
 
-        log_debug(
-            "channel %d, updating read pointer by %d bytes, from 0x%08x",
-            channel, space_read, g_recording_channels[channel].current_read);
-        if (temp_value >= (uint32_t) g_recording_channels[channel].end) {
-            uint32_t channel_space_total = (uint32_t) (
-                g_recording_channels[channel].end -
-                g_recording_channels[channel].start);
-            temp_value = temp_value - channel_space_total;
-            log_debug("channel %d, read wrap around", channel);
+//! \brief handles the acknowledgement of read requests when more than one
+//!        can be outstanding.  The acknowledgement holds the sequence number
+//!        up to which all requests have been read, and a bit for each of the
+//!        following requests which have been read out of order.  Requests
+//!        are applied in order, as each frees the space after the last.
+//! \param[in] msg the acknowledgement message
+static inline void _recording_host_data_read_ack(eieio_msg_t msg) {
+    host_data_read_ack_packet *ack = (host_data_read_ack_packet *) msg;
+    uint32_t n_outstanding =
+        (next_sequence_number - sequence_number) & MAX_SEQUENCE_NO;
+    uint32_t n_cumulative =
+        ((ack->sequence - sequence_number) & MAX_SEQUENCE_NO) + 1;
+
+    for (uint32_t i = 0; i < n_outstanding; i++) {
+        uint32_t sequence = (sequence_number + i) & MAX_SEQUENCE_NO;
+        uint32_t bit = (sequence - ack->sequence - 1) & MAX_SEQUENCE_NO;
+        if ((n_cumulative <= n_outstanding && i < n_cumulative) ||
+                (bit < 32 && (ack->selective & (1 << bit)) != 0)) {
+            g_read_slots[sequence & (MAX_READ_WINDOW - 1)].acked = true;
         }
+    }
 
-        g_recording_channels[channel].current_read = (uint8_t *) temp_value;
-        g_recording_channels[channel].last_buffer_operation =
-            BUFFER_OPERATION_READ;
+    while (sequence_number != next_sequence_number) {
+        recording_read_slot_t *slot =
+            &g_read_slots[sequence_number & (MAX_READ_WINDOW - 1)];
+        if (!slot->acked) {
+            break;
+        }
+        for (uint32_t i = 0; i < slot->n_requests; i++) {
+            uint8_t channel = slot->requests[i].channel;
+            uint32_t space_read = slot->requests[i].space_to_be_read;
+            requested_bytes[channel] -= space_read;
+            _recording_read_done(channel, space_read);
+        }
+        sequence_number = (sequence_number + 1) & MAX_SEQUENCE_NO;
     }
 }
 
@@ -142,6 +555,11 @@ static inline void _recording_eieio_packet_handler(
             _recording_host_data_read(msg, length);
             break;
 
+        case HOST_DATA_READ_ACK:
+            log_debug("command: HOST_DATA_READ_ACK");
+            _recording_host_data_read_ack(msg);
+            break;
+
         default:
             log_debug("unhandled command id %d", pkt_command);
             break;
@@ -151,124 +569,285 @@ static inline void _recording_eieio_packet_handler(
     log_debug("leaving packet handler");
 }
 
+//! \brief works out the number of bytes that a channel can hold
+//! \param[in] channel the channel to check
+//! \return the capacity of the channel
+static inline uint32_t _recording_channel_size(uint8_t channel) {
+    if (_is_pooled(channel)) {
+        return g_recording_pool[channel].max_chunks *
+            (pool_chunk_size - POOL_CHUNK_HEADER_SIZE);
+    }
+    return g_recording_channels[channel].end -
+        g_recording_channels[channel].start;
+}
+
 // Work out the space available in the given channel for recording
 static uint32_t compute_available_space_in_channel(uint8_t channel) {
-    uint8_t *buffer_region = g_recording_channels[channel].start;
-    uint8_t *end_of_buffer_region = g_recording_channels[channel].end;
-    uint8_t *write_pointer = g_recording_channels[channel].current_write;
-    uint8_t *read_pointer = g_recording_channels[channel].current_read;
-    buffered_operations last_buffer_operation =
-        g_recording_channels[channel].last_buffer_operation;
-
-    if (read_pointer < write_pointer) {
-        uint32_t final_space =
-            (uint32_t) end_of_buffer_region - (uint32_t) write_pointer;
-        uint32_t initial_space =
-            (uint32_t) read_pointer - (uint32_t) buffer_region;
-        return final_space + initial_space;
-    } else if (write_pointer < read_pointer) {
-        return (uint32_t) read_pointer - (uint32_t) write_pointer;
-    } else if (last_buffer_operation == BUFFER_OPERATION_WRITE) {
-
-        // If pointers are equal, buffer is full if last operation is write
-        return 0;
-    } else {
+    recording_counters_t *counters = &g_recording_counters[channel];
+    return _recording_channel_size(channel) -
+        (counters->reserved - counters->read);
+}
+
+//! \brief works out where a record of the given size would be placed in a
+//!        channel, without moving any of the channel pointers
+//! \param[in] channel the channel to reserve space in
+//! \param[in] write_pointer where the record would start
+//! \param[in] space_used the number of bytes in the channel that have not
+//!            been read, including any that are reserved
+//! \param[in] size_bytes the number of bytes to reserve
+//! \param[out] span the area reserved, split in two if it wraps
+//! \return True if there was enough space for the reservation
+static inline bool _recording_reserve_memory(
+        uint8_t channel, uint8_t *write_pointer, uint32_t space_used,
+        uint32_t size_bytes, recording_span_t *span) {
+    recording_channel_t *recording_channel = &g_recording_channels[channel];
+    uint8_t *buffer_region = recording_channel->start;
+    uint8_t *end_of_buffer_region = recording_channel->end;
+    uint32_t space_free =
+        (end_of_buffer_region - buffer_region) - space_used;
+
+    log_debug("t = %u, channel = %u, start = 0x%08x, write = 0x%08x,"
+              "end = 0x%08x, used = %u, len = %u",
+              spin1_get_simulation_time(), channel, buffer_region,
+              write_pointer, end_of_buffer_region, space_used, size_bytes);
 
-        // If pointers are equal, buffer is empty if last operation is read
-        return (end_of_buffer_region - buffer_region);
+    if (space_free < size_bytes) {
+        log_debug("Not enough space in channel (%u bytes)", space_free);
+        return false;
     }
+
+    span->first = write_pointer;
+    span->second = buffer_region;
+    span->second_length = 0;
+
+    uint32_t final_space =
+        (uint32_t) end_of_buffer_region - (uint32_t) write_pointer;
+    if (final_space >= size_bytes) {
+        log_debug("Record fits in final space of %u", final_space);
+        span->first_length = size_bytes;
+        return true;
+    }
+
+    log_debug("Record split with %u bytes in final space", final_space);
+    span->first_length = final_space;
+    span->second_length = size_bytes - final_space;
+    return true;
 }
 
-// Add a packet to the SDRAM
-static inline bool _recording_write_memory(
-        uint8_t channel, void *data, uint32_t length) {
-    uint8_t *buffer_region = g_recording_channels[channel].start;
-    uint8_t *end_of_buffer_region = g_recording_channels[channel].end;
-    uint8_t *write_pointer = g_recording_channels[channel].current_write;
-    uint8_t *read_pointer = g_recording_channels[channel].current_read;
-    buffered_operations last_buffer_operation =
-        g_recording_channels[channel].last_buffer_operation;
+//! \brief moves a pointer on within a channel, wrapping at the end
+//! \param[in] channel the channel that the pointer is in
+//! \param[in] pointer the pointer to move
+//! \param[in] n_bytes the number of bytes to move the pointer by
+//! \return the moved pointer
+static inline uint8_t *_recording_advance(
+        uint8_t channel, uint8_t *pointer, uint32_t n_bytes) {
+    recording_channel_t *recording_channel = &g_recording_channels[channel];
+    pointer += n_bytes;
+    if (pointer >= recording_channel->end) {
+        pointer -= recording_channel->end - recording_channel->start;
+    }
+    return pointer;
+}
 
-    log_debug("t = %u, channel = %u, start = 0x%08x, read = 0x%08x,"
-              "write = 0x%08x, end = 0x%08x, operation == read = %u, len = %u",
-              spin1_get_simulation_time(), channel, buffer_region,
-              read_pointer, write_pointer, end_of_buffer_region,
-              last_buffer_operation == BUFFER_OPERATION_READ, length);
-
-    if ((read_pointer < write_pointer) ||
-           (read_pointer == write_pointer &&
-               last_buffer_operation == BUFFER_OPERATION_READ)) {
-        uint32_t final_space =
-            (uint32_t) end_of_buffer_region - (uint32_t) write_pointer;
-
-        if (final_space >= length) {
-            log_debug("Packet fits in final space of %u", final_space);
-            spin1_memcpy(write_pointer, data, length);
-            write_pointer += length;
-            if (write_pointer >= end_of_buffer_region) {
-                write_pointer = buffer_region;
-                log_debug("channel %u, write wrap around", channel);
-            }
-            g_recording_channels[channel].current_write = write_pointer;
-            g_recording_channels[channel].last_buffer_operation =
-                BUFFER_OPERATION_WRITE;
-            return true;
+//! \brief copies bytes from DTCM into SDRAM at the given point of a channel,
+//!        either with DMA or synchronously, splitting the copy where it
+//!        wraps
+//! \param[in] channel the channel being written to
+//! \param[in] buffer the index of the staging buffer being written from
+//! \param[in] write_pointer where to start writing in SDRAM
+//! \param[in] data the data to write
+//! \param[in] n_bytes the number of bytes to write
+//! \param[in] use_dma True if DMA should be used, False to copy directly
+//! \return the number of DMA transfers started
+static uint32_t _recording_staging_write(
+        uint8_t channel, uint32_t buffer, uint8_t *write_pointer,
+        uint8_t *data, uint32_t n_bytes, bool use_dma) {
+    uint32_t final_space =
+        (uint32_t) g_recording_channels[channel].end - (uint32_t) write_pointer;
+    uint8_t *addresses[2] = {write_pointer, g_recording_channels[channel].start};
+    uint32_t lengths[2] = {n_bytes, 0};
+    uint32_t n_transfers = 0;
+
+    if (n_bytes > final_space) {
+        lengths[0] = final_space;
+        lengths[1] = n_bytes - final_space;
+    }
+
+    for (uint32_t i = 0; i < 2; i++) {
+        if (lengths[i] == 0) {
+            continue;
+        }
+
+        // Fall back to a direct copy if the DMA queue is full
+        if (use_dma && spin1_dma_transfer(
+                RECORDING_DMA_TAG | (channel << 1) | buffer,
+                addresses[i], data, DMA_WRITE, lengths[i])) {
+            n_transfers++;
         } else {
+            spin1_memcpy(addresses[i], data, lengths[i]);
+        }
+        data += lengths[i];
+    }
+    return n_transfers;
+}
 
-            uint32_t total_space =
-                final_space +
-                ((uint32_t) read_pointer - (uint32_t) buffer_region);
-            if (total_space < length) {
-                log_debug(
-                    "Not enough space in final area (%u bytes)", total_space);
-                return false;
-            }
+//! \brief commits the data of a staging buffer once it is in SDRAM
+//! \param[in] channel the channel of the staging buffer
+//! \param[in] buffer the index of the staging buffer
+static inline void _recording_staging_committed(
+        uint8_t channel, uint32_t buffer) {
+    recording_staging_t *staging = &g_recording_staging[channel];
+    g_recording_channels[channel].current_write = staging->commit_to[buffer];
+    g_recording_counters[channel].written += staging->flushed[buffer];
+    staging->flushed[buffer] = 0;
+}
 
-            log_debug(
-                "Copying first %d bytes to final space of %u", final_space);
-            spin1_memcpy(write_pointer, data, final_space);
-            write_pointer = buffer_region;
-            data += final_space;
-
-            uint32_t final_len = length - final_space;
-            log_debug("Copying remaining %u bytes", final_len);
-            spin1_memcpy(write_pointer, data, final_len);
-            write_pointer += final_len;
-            if (write_pointer == end_of_buffer_region) {
-                write_pointer = buffer_region;
-                log_debug("channel %u, write wrap around", channel);
-            }
-            g_recording_channels[channel].current_write = write_pointer;
-            g_recording_channels[channel].last_buffer_operation =
-                BUFFER_OPERATION_WRITE;
-            return true;
+//! \brief sends the whole words of the active staging buffer of a channel
+//!        to SDRAM using DMA, and makes the other buffer active.  Any
+//!        trailing bytes are moved to the start of the other buffer, so that
+//!        SDRAM is always written from a word boundary.  Must be called
+//!        with interrupts disabled if records can be made at a higher
+//!        priority.
+//! \param[in] channel the channel to flush
+//! \return True if the buffer was flushed, False if there is no free buffer
+//!         to switch to, or a record is still being written into the buffer
+static bool _recording_flush_staging(uint8_t channel) {
+    recording_staging_t *staging = &g_recording_staging[channel];
+    uint32_t active = staging->active;
+    uint32_t other = (active + 1) % N_STAGING_BUFFERS;
+    uint32_t n_bytes = staging->fill & ~0x3;
+
+    if (n_bytes == 0) {
+        return true;
+    }
+    if (g_recording_counters[channel].n_reserving > 0) {
+        log_debug("channel %u, record in progress in staging buffer", channel);
+        return false;
+    }
+    if (staging->in_flight[other] > 0) {
+        log_debug("channel %u, no staging buffer free to flush to", channel);
+        return false;
+    }
+
+    uint8_t *buffer = staging->buffers[active];
+    uint8_t *write_pointer = staging->dma_write;
+    staging->dma_write = _recording_advance(channel, write_pointer, n_bytes);
+    staging->commit_to[active] = staging->dma_write;
+    staging->flushed[active] = n_bytes;
+
+    // Mark the transfers as in flight before starting them, as they can
+    // complete before the count is updated otherwise
+    uint cpsr = spin1_int_disable();
+    staging->in_flight[active] = MAX_TRANSFERS_PER_FLUSH;
+    spin1_mode_restore(cpsr);
+    uint32_t n_transfers = _recording_staging_write(
+        channel, active, write_pointer, buffer, n_bytes, true);
+    cpsr = spin1_int_disable();
+    staging->in_flight[active] -= MAX_TRANSFERS_PER_FLUSH - n_transfers;
+    if (staging->in_flight[active] == 0) {
+        _recording_staging_committed(channel, active);
+    }
+    spin1_mode_restore(cpsr);
+
+    // Move the trailing bytes to the other buffer and switch to it
+    uint32_t tail = staging->fill - n_bytes;
+    if (tail > 0) {
+        spin1_memcpy(staging->buffers[other], &buffer[n_bytes], tail);
+    }
+    staging->fill = tail;
+    staging->active = other;
+    return true;
+}
+
+//! \brief waits for any outstanding transfers of a channel, and then copies
+//!        any remaining staged data directly to SDRAM.  Must not be called
+//!        from a callback at the priority of the DMA completion callback, as
+//!        the transfers would never complete.
+//! \param[in] channel the channel to drain
+static void _recording_drain_staging(uint8_t channel) {
+    recording_staging_t *staging = &g_recording_staging[channel];
+
+    for (uint32_t i = 0; i < N_STAGING_BUFFERS; i++) {
+        while (staging->in_flight[i] > 0) {
+            spin1_delay_us(1);
         }
-    } else if (write_pointer < read_pointer) {
-        uint32_t middle_space =
-            (uint32_t) read_pointer - (uint32_t) write_pointer;
+    }
 
-        if (middle_space < length) {
-            log_debug("Not enough space in middle (%u bytes)", middle_space);
+    if (staging->fill > 0) {
+        _recording_staging_write(
+            channel, staging->active, staging->dma_write,
+            staging->buffers[staging->active], staging->fill, false);
+        recording_counters_t *counters = &g_recording_counters[channel];
+        staging->dma_write = counters->reserve_pointer;
+        g_recording_channels[channel].current_write =
+            counters->reserve_pointer;
+        counters->written = counters->reserved;
+        staging->fill = 0;
+    }
+}
+
+//! \brief reserves space for a record in the active staging buffer of a
+//!        channel, flushing the buffer first if the record would not fit.
+//!        Space is also accounted for in SDRAM, so that staged data is
+//!        always guaranteed to have somewhere to go.  Must be called with
+//!        interrupts disabled.
+//! \param[in] channel the channel to reserve space in
+//! \param[in] size_bytes the number of bytes to reserve
+//! \param[out] span the area reserved in DTCM
+//! \return True if there was enough space for the reservation
+static inline bool _recording_reserve_staging(
+        uint8_t channel, uint32_t size_bytes, recording_span_t *span) {
+    recording_staging_t *staging = &g_recording_staging[channel];
+    recording_counters_t *counters = &g_recording_counters[channel];
+
+    if ((staging->fill + size_bytes) > staging_buffer_size) {
+        if (!_recording_flush_staging(channel) ||
+                ((staging->fill + size_bytes) > staging_buffer_size)) {
             return false;
-        } else {
-            log_debug("Packet fits in middle space of %u", middle_space);
-            spin1_memcpy(write_pointer, data, length);
-            write_pointer += length;
-            if (write_pointer == end_of_buffer_region) {
-                write_pointer = buffer_region;
-                log_debug("channel %u, write wrap around", channel);
-            }
-            g_recording_channels[channel].current_write = write_pointer;
-            g_recording_channels[channel].last_buffer_operation =
-                BUFFER_OPERATION_WRITE;
-            return true;
         }
     }
-    log_debug("reached end");
 
-    log_debug("Buffer already full");
-    return false;
+    // Data that is staged or in flight still takes up space in SDRAM
+    recording_span_t sdram_span;
+    if (!_recording_reserve_memory(
+            channel, counters->reserve_pointer,
+            counters->reserved - counters->read, size_bytes, &sdram_span)) {
+        return false;
+    }
+
+    span->first = &(staging->buffers[staging->active][staging->fill]);
+    span->first_length = size_bytes;
+    span->second = NULL;
+    span->second_length = 0;
+    staging->fill += size_bytes;
+    counters->reserve_pointer = _recording_advance(
+        channel, counters->reserve_pointer, size_bytes);
+    counters->reserved += size_bytes;
+    return true;
+}
+
+void recording_chain_dma_transfer_done(callback_t callback) {
+    chained_dma_transfer_done = callback;
+    spin1_callback_on(
+        DMA_TRANSFER_DONE, recording_dma_transfer_done,
+        DMA_TRANSFER_DONE_PRIORITY);
+}
 
+void recording_dma_transfer_done(uint unused, uint tag) {
+    if ((tag & ~RECORDING_DMA_CHANNEL_MASK) != RECORDING_DMA_TAG) {
+        if (chained_dma_transfer_done != NULL) {
+            chained_dma_transfer_done(unused, tag);
+        }
+        return;
+    }
+    uint8_t channel = (tag & RECORDING_DMA_CHANNEL_MASK) >> 1;
+    uint32_t buffer = tag & 0x1;
+    recording_staging_t *staging = &g_recording_staging[channel];
+
+    staging->in_flight[buffer] -= 1;
+    if (staging->in_flight[buffer] == 0) {
+        _recording_staging_committed(channel, buffer);
+    }
 }
 
 static void _create_buffer_message(
@@ -283,73 +862,257 @@ static void _create_buffer_message(
     data_ptr[n_requests].space_to_be_read = space_to_be_read;
 }
 
-static inline void _recording_send_buffering_out_trigger_message(
-        bool flush_all) {
+//! \brief updates the moving average of the rate at which each channel is
+//!        being filled, using the bytes committed since the last update
+static inline void _recording_update_rates() {
+    for (uint32_t channel = 0; channel < n_recording_regions; channel++) {
+        recording_rate_t *rate = &g_recording_rates[channel];
+        uint cpsr = spin1_int_disable();
+        uint32_t sample = rate->bytes_this_tick << RATE_FRACTIONAL_BITS;
+        rate->bytes_this_tick = 0;
+        spin1_mode_restore(cpsr);
+        rate->average = rate->average - (rate->average >> RATE_SAMPLE_SHIFT)
+            + (sample >> RATE_SAMPLE_SHIFT);
+    }
+}
+
+//! \brief decides if a read of a channel should be requested
+//! \param[in] channel the channel to check
+//! \param[in] flush_all True if all the data in the channel is to be read
+//! \return True if a read of the channel should be requested
+static inline bool _recording_channel_needs_read(
+        uint8_t channel, bool flush_all) {
+    if (!_has_been_initialsed(channel)) {
+        return false;
+    }
+    recording_counters_t *counters = &g_recording_counters[channel];
+    uint32_t channel_space_used = counters->written - counters->read;
+    uint32_t channel_space_available =
+        compute_available_space_in_channel(channel);
+
+    // Data already in an outstanding request does not need reading again
+    if (requested_bytes != NULL) {
+        channel_space_used -= requested_bytes[channel];
+    }
+
+    if (flush_all) {
+        return true;
+    }
+
+    // Ring channels are only read once the run is complete
+    if (_is_ring(channel)) {
+        return false;
+    }
+    if (g_recording_rates == NULL) {
+        return channel_space_used >= buffer_size_before_trigger;
+    }
 
+    // An idle channel never needs a read until the end of the run
+    if (channel_space_used == 0) {
+        return false;
+    }
+
+    // Request a read if the channel would fill at the current rate before
+    // the host could empty it.  A read requested now might only be
+    // answered after the previous one, so allow for two round trips.
+    uint64_t bytes_before_read =
+        ((uint64_t) g_recording_rates[channel].average *
+         (round_trip_time << 1)) >> RATE_FRACTIONAL_BITS;
+    return channel_space_available <= bytes_before_read;
+}
+
+//! \brief adds a read request for each chunk of a pooled channel that holds
+//!        data, oldest first, for as many chunks as will fit in the message
+//! \param[in] channel the channel to request reads of
+//! \param[in] n_requests the number of requests already in the message
+//! \param[in] read_pointer where the data to be read starts
+//! \param[in] length the number of bytes to be read
+//! \param[in] skip the number of bytes at the start of the channel that have
+//!            already been requested
+//! \return the number of requests in the message after adding these
+static uint _recording_pool_read_requests(
+        uint8_t channel, uint n_requests, uint8_t *read_pointer,
+        uint32_t length, uint32_t skip) {
+
+    // The chunk of the read pointer; the pointer can be at the very end
+    uint8_t *chunk = pool_chunks + ((
+        (read_pointer - pool_chunks - POOL_CHUNK_HEADER_SIZE) /
+        pool_chunk_size) * pool_chunk_size);
+
+    while (length > 0 && n_requests < MAX_READ_REQUESTS) {
+        uint8_t *chunk_end = chunk + pool_chunk_size;
+
+        // Every chunk before the last with data in is linked to the next
+        if (read_pointer == chunk_end) {
+            chunk = (uint8_t *) *((uint32_t *) chunk);
+            read_pointer = chunk + POOL_CHUNK_HEADER_SIZE;
+            continue;
+        }
+        uint32_t n_bytes = chunk_end - read_pointer;
+        if (n_bytes > length) {
+            n_bytes = length;
+        }
+        if (skip >= n_bytes) {
+            skip -= n_bytes;
+        } else {
+            _create_buffer_message(
+                data_ptr, n_requests, channel, read_pointer + skip,
+                n_bytes - skip);
+            n_requests++;
+            skip = 0;
+        }
+        read_pointer += n_bytes;
+        length -= n_bytes;
+    }
+    return n_requests;
+}
+
+//! \brief sends the read requests that have been put in the message
+//! \param[in] n_requests the number of read requests in the message
+//! \param[in] sequence the sequence number of the message
+static void _recording_send_read_request(uint n_requests, uint32_t sequence) {
     uint msg_size = 16 + sizeof(read_request_packet_header);
-    uint n_requests = 0;
 
+    // eieio command packet with command ID 8
+    req_hdr->eieio_header_command = 0x4008;
+    req_hdr->chip_id = spin1_get_chip_id();
+    data_ptr[0].processor_and_request =
+        (spin1_get_core_id() << 3) | n_requests;
+    data_ptr[0].sequence = sequence;
+    msg_size += (n_requests * sizeof(read_request_packet_data));
+    msg.length = msg_size;
+
+    spin1_send_sdp_msg(&msg, 1);
+}
+
+//! \brief adds read requests for the data of a channel that is not already
+//!        in an outstanding request, for as many reads as will fit
+//! \param[in] channel the channel to request reads of
+//! \param[in] n_requests the number of requests already in the message
+//! \return the number of requests in the message after adding these
+static uint _recording_channel_read_requests(uint8_t channel, uint n_requests) {
+    recording_channel_t *recording_channel = &g_recording_channels[channel];
+    recording_counters_t *counters = &g_recording_counters[channel];
+    uint32_t skip = 0;
+    if (requested_bytes != NULL) {
+        skip = requested_bytes[channel];
+    }
+
+    // Take the read pointer and the data after it together, as the host can
+    // move them on at any time
+    uint cpsr = spin1_int_disable();
+    uint8_t *read_pointer = recording_channel->current_read;
+    uint32_t channel_space_used = counters->written - counters->read;
+    spin1_mode_restore(cpsr);
+
+    if (_is_pooled(channel)) {
+        return _recording_pool_read_requests(
+            channel, n_requests, read_pointer, channel_space_used, skip);
+    }
+    if (channel_space_used <= skip) {
+        return n_requests;
+    }
+    read_pointer = _recording_advance(channel, read_pointer, skip);
+    uint32_t length = channel_space_used - skip;
+    uint32_t final_space =
+        (uint32_t) recording_channel->end - (uint32_t) read_pointer;
+    if (length > final_space) {
+        _create_buffer_message(
+            data_ptr, n_requests, channel, read_pointer, final_space);
+        n_requests++;
+        read_pointer = recording_channel->start;
+        length -= final_space;
+    }
+    if (n_requests < MAX_READ_REQUESTS) {
+        _create_buffer_message(
+            data_ptr, n_requests, channel, read_pointer, length);
+        n_requests++;
+    }
+    return n_requests;
+}
+
+//! \brief sends a new read request message while others are still
+//!        outstanding, for the data that is not in any of them, and keeps
+//!        the message in case it has to be sent again
+//! \param[in] flush_all True if all the data in the channels is to be read
+//! \return True if a message was sent
+static bool _recording_send_windowed_read_request(bool flush_all) {
+    uint32_t n_outstanding =
+        (next_sequence_number - sequence_number) & MAX_SEQUENCE_NO;
+    if (n_outstanding >= read_window_size) {
+        return false;
+    }
+
+    uint n_requests = 0;
     for (uint channel = 0; channel < n_recording_regions; channel++) {
-        uint32_t channel_space_total =
-            (uint32_t) (g_recording_channels[channel].end -
-                        g_recording_channels[channel].start);
-        uint32_t channel_space_available = compute_available_space_in_channel(
-                channel);
-
-        if (_has_been_initialsed(channel) && (flush_all ||
-                (channel_space_total - channel_space_available) >=
-                     buffer_size_before_trigger)) {
-            uint8_t *buffer_region = g_recording_channels[channel].start;
-            uint8_t *end_of_buffer_region = g_recording_channels[channel].end;
-            uint8_t *write_pointer = g_recording_channels[channel].current_write;
-            uint8_t *read_pointer = g_recording_channels[channel].current_read;
-            buffered_operations last_buffer_operation =
-                g_recording_channels[channel].last_buffer_operation;
-
-            if (read_pointer < write_pointer) {
-                _create_buffer_message(
-                    data_ptr, n_requests, channel, read_pointer,
-                    write_pointer - read_pointer);
-                n_requests++;
-            } else if ((write_pointer < read_pointer) ||
-                    (write_pointer == read_pointer &&
-                     last_buffer_operation == BUFFER_OPERATION_WRITE)) {
-                _create_buffer_message(
-                    data_ptr, n_requests, channel, read_pointer,
-                    end_of_buffer_region - read_pointer);
-                n_requests++;
-
-                _create_buffer_message(
-                    data_ptr, n_requests, channel, buffer_region,
-                    write_pointer - buffer_region);
-                n_requests++;
-            } else {
+        if (n_requests < MAX_READ_REQUESTS &&
+                _recording_channel_needs_read(channel, flush_all)) {
+            n_requests = _recording_channel_read_requests(channel, n_requests);
+        }
+    }
+    if (n_requests == 0) {
+        return false;
+    }
 
-                // something somewhere went terribly wrong this should never
-                // happen
-                log_error(
-                    "Unknown channel state - channel: %d, start pointer: %d,"
-                    " end pointer: %d, read_pointer: %d, write_pointer: %d,"
-                    " last operation==READ: %d", channel, buffer_region,
-                    end_of_buffer_region, read_pointer, write_pointer,
-                    last_buffer_operation == BUFFER_OPERATION_READ);
+    // The acknowledgement of the host updates the same state
+    uint cpsr = spin1_int_disable();
+    recording_read_slot_t *slot =
+        &g_read_slots[next_sequence_number & (MAX_READ_WINDOW - 1)];
+    slot->acked = false;
+    slot->time_sent = recording_time;
+    slot->n_requests = n_requests;
+    for (uint i = 0; i < n_requests; i++) {
+        slot->requests[i] = data_ptr[i];
+        requested_bytes[data_ptr[i].channel] += data_ptr[i].space_to_be_read;
+    }
+    spin1_mode_restore(cpsr);
+    _recording_send_read_request(n_requests, next_sequence_number);
+    next_sequence_number = (next_sequence_number + 1) & MAX_SEQUENCE_NO;
+    return true;
+}
+
+//! \brief sends again any outstanding read request messages that have not
+//!        been acknowledged within the time between triggers
+//! \param[in] time the current time
+static void _recording_resend_read_requests(uint32_t time) {
+    uint32_t n_outstanding =
+        (next_sequence_number - sequence_number) & MAX_SEQUENCE_NO;
+    for (uint32_t i = 0; i < n_outstanding; i++) {
+        uint32_t sequence = (sequence_number + i) & MAX_SEQUENCE_NO;
+        recording_read_slot_t *slot =
+            &g_read_slots[sequence & (MAX_READ_WINDOW - 1)];
+        if (!slot->acked &&
+                (time - slot->time_sent) > time_between_triggers) {
+            for (uint j = 0; j < slot->n_requests; j++) {
+                data_ptr[j] = slot->requests[j];
             }
+            _recording_send_read_request(slot->n_requests, sequence);
+            slot->time_sent = time;
         }
     }
+}
+
+static inline bool _recording_send_buffering_out_trigger_message(
+        bool flush_all) {
+
+    if (read_window_size > 1) {
+        return _recording_send_windowed_read_request(flush_all);
+    }
 
-    if (n_requests > 0) {
+    uint n_requests = 0;
 
-        // eieio command packet with command ID 8
-        req_hdr->eieio_header_command = 0x4008;
-        req_hdr->chip_id = spin1_get_chip_id();
-        data_ptr[0].processor_and_request =
-            (spin1_get_core_id() << 3) | n_requests;
-        data_ptr[0].sequence = sequence_number;
-        msg_size += (n_requests * sizeof(read_request_packet_data));
-        msg.length = msg_size;
+    for (uint channel = 0; channel < n_recording_regions; channel++) {
+        if (n_requests < MAX_READ_REQUESTS &&
+                _recording_channel_needs_read(channel, flush_all)) {
+            n_requests = _recording_channel_read_requests(channel, n_requests);
+        }
+    }
 
-        spin1_send_sdp_msg(&msg, 1);
+    if (n_requests > 0) {
+        _recording_send_read_request(n_requests, sequence_number);
+        return true;
     }
+    return false;
 }
 
 static void _buffering_in_handler(uint mailbox, uint port) {
@@ -365,51 +1128,519 @@ static void _buffering_in_handler(uint mailbox, uint port) {
     log_debug("Done freeing message");
 }
 
-bool recording_record(uint8_t channel, void *data, uint32_t size_bytes) {
+//! \brief reserves space for a record in a ring channel, discarding the
+//!        oldest records until there is enough space.  The length of the
+//!        record is written in front of the reserved area, which always
+//!        starts on a word boundary.  Only records that have been committed
+//!        are discarded.  Must be called with interrupts disabled.
+//! \param[in] channel the channel to reserve space in
+//! \param[in] size_bytes the number of bytes to reserve
+//! \param[out] span the area reserved for the record itself
+//! \return True if the record can fit in the channel
+static inline bool _recording_reserve_ring(
+        uint8_t channel, uint32_t size_bytes, recording_span_t *span) {
+    recording_channel_t *recording_channel = &g_recording_channels[channel];
+    recording_counters_t *counters = &g_recording_counters[channel];
+    uint32_t space_needed = _ring_record_space(size_bytes);
+
+    if (space_needed >
+            (uint32_t) (recording_channel->end - recording_channel->start)) {
+        return false;
+    }
+
+    // Discard whole records from the oldest end until the record fits
+    while (compute_available_space_in_channel(channel) < space_needed) {
+        if (counters->read == counters->written) {
+            return false;
+        }
+        uint32_t old_space = _ring_record_space(
+            *((uint32_t *) recording_channel->current_read));
+        recording_channel->current_read = _recording_advance(
+            channel, recording_channel->current_read, old_space);
+        counters->read += old_space;
+    }
+
+    recording_span_t ring_span;
+    _recording_reserve_memory(
+        channel, counters->reserve_pointer,
+        counters->reserved - counters->read, space_needed, &ring_span);
+    *((uint32_t *) ring_span.first) = size_bytes;
+
+    uint8_t *record = _recording_advance(
+        channel, counters->reserve_pointer, RING_RECORD_HEADER_SIZE);
+    uint32_t final_space =
+        (uint32_t) recording_channel->end - (uint32_t) record;
+    span->first = record;
+    if (size_bytes > final_space) {
+        span->first_length = final_space;
+        span->second = recording_channel->start;
+        span->second_length = size_bytes - final_space;
+    } else {
+        span->first_length = size_bytes;
+        span->second = NULL;
+        span->second_length = 0;
+    }
+    counters->reserve_pointer = _recording_advance(
+        channel, counters->reserve_pointer, space_needed);
+    counters->reserved += space_needed;
+    return true;
+}
+
+//! \brief copies data to the start of a reserved area, and then removes the
+//!        space written from the area
+//! \param[in/out] span the reserved area
+//! \param[in] data the data to copy
+//! \param[in] n_bytes the number of bytes to copy; must be no more than the
+//!            size of the area
+static inline void _recording_span_consume(
+        recording_span_t *span, void *data, uint32_t n_bytes) {
+    uint8_t *data_bytes = (uint8_t *) data;
+    uint32_t first_bytes = n_bytes;
+    if (first_bytes > span->first_length) {
+        first_bytes = span->first_length;
+    }
+    spin1_memcpy(span->first, data_bytes, first_bytes);
+    span->first += first_bytes;
+    span->first_length -= first_bytes;
+
+    if (span->first_length == 0 && span->second != NULL) {
+        uint32_t second_bytes = n_bytes - first_bytes;
+        spin1_memcpy(span->second, &data_bytes[first_bytes], second_bytes);
+        span->first = span->second + second_bytes;
+        span->first_length = span->second_length - second_bytes;
+        span->second = NULL;
+        span->second_length = 0;
+    }
+}
 
-    if (_has_been_initialsed(channel)) {
-        recording_channel_t *recording_channel = &g_recording_channels[channel];
-        uint32_t space_available = compute_available_space_in_channel(channel);
+//! \brief reserves space for a record in a pooled channel, linking a new
+//!        chunk after the tail if the record does not fit in it.  Must be
+//!        called with interrupts disabled.
+//! \param[in] channel the channel to reserve space in
+//! \param[in] size_bytes the number of bytes to reserve; this can be no
+//!            more than the space for data in a chunk
+//! \param[out] span the area reserved
+//! \return True if there was enough space for the reservation
+static inline bool _recording_reserve_pool(
+        uint8_t channel, uint32_t size_bytes, recording_span_t *span) {
+    recording_pool_channel_t *pool_channel = &g_recording_pool[channel];
+    recording_counters_t *counters = &g_recording_counters[channel];
+
+    if (pool_channel->tail == NULL ||
+            size_bytes > (pool_chunk_size - POOL_CHUNK_HEADER_SIZE)) {
+        return false;
+    }
+
+    uint8_t *write_pointer = counters->reserve_pointer;
+    uint32_t final_space =
+        (pool_channel->tail + pool_chunk_size) - write_pointer;
+    span->first = write_pointer;
+    if (size_bytes <= final_space) {
+        span->first_length = size_bytes;
+        span->second = NULL;
+        span->second_length = 0;
+        counters->reserve_pointer += size_bytes;
+        counters->reserved += size_bytes;
+        return true;
+    }
+
+    uint8_t *chunk = _recording_pool_acquire(channel);
+    if (chunk == NULL) {
+        return false;
+    }
+    *((uint32_t *) pool_channel->tail) = (uint32_t) chunk;
+    pool_channel->tail = chunk;
+    span->first_length = final_space;
+    span->second = chunk + POOL_CHUNK_HEADER_SIZE;
+    span->second_length = size_bytes - final_space;
+    counters->reserve_pointer = span->second + span->second_length;
+    counters->reserved += size_bytes;
+    return true;
+}
+
+//! \brief reserves space in a channel in the way that the channel is
+//!        configured to record.  The space is taken straight away, with
+//!        interrupts disabled only while the channel state is updated.
+//! \param[in] channel the channel to reserve space in
+//! \param[in] size_bytes the number of bytes to reserve
+//! \param[out] span the area reserved
+//! \return True if there was enough space for the reservation
+static inline bool _recording_reserve_channel(
+        uint8_t channel, uint32_t size_bytes, recording_span_t *span) {
+    recording_counters_t *counters = &g_recording_counters[channel];
+    bool reserved;
+
+    uint cpsr = spin1_int_disable();
+    if (_is_pooled(channel)) {
+        reserved = _recording_reserve_pool(channel, size_bytes, span);
+    } else if (_is_ring(channel)) {
+        reserved = _recording_reserve_ring(channel, size_bytes, span);
+    } else if (_is_staged(channel)) {
+        reserved = _recording_reserve_staging(channel, size_bytes, span);
+    } else {
+        reserved = _recording_reserve_memory(
+            channel, counters->reserve_pointer,
+            counters->reserved - counters->read, size_bytes, span);
+        if (reserved) {
+            counters->reserve_pointer = _recording_advance(
+                channel, counters->reserve_pointer, size_bytes);
+            counters->reserved += size_bytes;
+        }
+    }
+    if (reserved) {
+        counters->n_reserving += 1;
+    }
+    spin1_mode_restore(cpsr);
+    return reserved;
+}
 
-        // If there's space to record
-        if (space_available >= size_bytes) {
+//! \brief notes that a record has been lost because a channel is full
+//! \param[in] channel the channel that is full
+static inline void _recording_out_of_space(uint8_t channel) {
+    if (!g_recording_channels[channel].missing_info) {
+        log_info("WARNING: recording channel %u out of space", channel);
+        g_recording_channels[channel].missing_info = 1;
+    }
+}
 
-            // Copy data into recording channel
-            _recording_write_memory(channel, data, size_bytes);
+bool recording_reserve(
+        uint8_t channel, uint32_t size_bytes, recording_span_t *span) {
+    if (!_has_been_initialsed(channel)) {
+        return false;
+    }
+    if (_is_compressed(channel)) {
+        log_error("cannot reserve space in compressed channel %u", channel);
+        return false;
+    }
 
+    if (!_is_framed(channel)) {
+        if (_recording_reserve_channel(channel, size_bytes, span)) {
             return true;
-        } else {
-            if (!g_recording_channels[channel].missing_info) {
-                log_info("WARNING: recording channel %u out of space", channel);
-                g_recording_channels[channel].missing_info = 1;
+        }
+    } else if (_recording_reserve_channel(
+            channel, size_bytes + sizeof(recording_frame_header_t), span)) {
+
+        // Write the frame header in front of the record
+        recording_frame_header_t header;
+        header.time = recording_time + 1;
+        header.length = size_bytes;
+        _recording_span_consume(span, &header, sizeof(header));
+        return true;
+    }
+
+    _recording_out_of_space(channel);
+    return false;
+}
+
+void recording_commit(uint8_t channel, recording_span_t *span) {
+    recording_channel_t *recording_channel = &g_recording_channels[channel];
+    recording_counters_t *counters = &g_recording_counters[channel];
+
+    uint cpsr = spin1_int_disable();
+    if (g_recording_rates != NULL) {
+        g_recording_rates[channel].bytes_this_tick +=
+            span->first_length + span->second_length;
+    }
+
+    // Any reservation made at a higher priority while this one was being
+    // written has already been committed, so once the outermost reservation
+    // is committed, everything reserved can be read.  Staged data is only
+    // available to be read once it is in SDRAM.
+    counters->n_reserving -= 1;
+    if (counters->n_reserving == 0 && !_is_staged(channel)) {
+        recording_channel->current_write = counters->reserve_pointer;
+        counters->written = counters->reserved;
+    }
+    spin1_mode_restore(cpsr);
+}
+
+//! \brief writes a byte of encoded data to a reserved area, moving on to
+//!        the second part of the area when the first is full
+//! \param[in/out] span the reserved area, or NULL to write nothing
+//! \param[in] value the byte to write
+static inline void _recording_put_byte(recording_span_t *span, uint8_t value) {
+    if (span == NULL) {
+        return;
+    }
+    if (span->first_length == 0) {
+        span->first = span->second;
+        span->first_length = span->second_length;
+        span->second = NULL;
+        span->second_length = 0;
+    }
+    *(span->first++) = value;
+    span->first_length -= 1;
+}
+
+//! \brief writes an unsigned LEB128 varint to a reserved area
+//! \param[in/out] span the reserved area, or NULL to write nothing
+//! \param[in] value the value to write
+//! \return the number of bytes that the value takes up
+static inline uint32_t _recording_put_varint(
+        recording_span_t *span, uint32_t value) {
+    uint32_t n_bytes = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value != 0) {
+            byte |= 0x80;
+        }
+        _recording_put_byte(span, byte);
+        n_bytes++;
+    } while (value != 0);
+    return n_bytes;
+}
+
+//! \brief gets the difference between a byte of a record and the byte in
+//!        the same place of the last record of a channel.  The record is in
+//!        two parts, so that a frame header can be put in front of it.
+//! \param[in] history the last record of the channel
+//! \param[in] prefix the first part of the record
+//! \param[in] prefix_length the number of bytes in the first part
+//! \param[in] data the second part of the record
+//! \param[in] index the index of the byte in the record
+//! \return the exclusive or of the byte with that of the last record
+static inline uint8_t _recording_diff(
+        recording_history_t *history, uint8_t *prefix, uint32_t prefix_length,
+        uint8_t *data, uint32_t index) {
+    uint8_t value = (index < prefix_length) ?
+        prefix[index] : data[index - prefix_length];
+    if (index < history->length) {
+        value ^= history->bytes[index];
+    }
+    return value;
+}
+
+//! \brief works out the most space that a record of a compressed channel
+//!        can take up once encoded.  Every pair of runs after the first
+//!        covers at least two bytes that are the same, which is enough to
+//!        hold the length of the run of the same bytes, and so each pair
+//!        needs no more than the bytes of the record that it covers, and a
+//!        byte for every 128 bytes that differ.  The first pair, the one
+//!        byte that can be left at the end, and the length of the record
+//!        make up the rest.
+//! \param[in] length the number of bytes in the record
+//! \return the most bytes that the encoded record can take up
+static inline uint32_t _recording_encode_bound(uint32_t length) {
+    return length + (length >> 7) + 8;
+}
+
+//! \brief encodes a record of a compressed channel, as described for
+//!        RECORDING_REGION_FLAG_COMPRESSED.  A run of differing bytes is
+//!        ended by two bytes that are the same, as a single byte is no
+//!        cheaper to send as a run.
+//! \param[in] history the last record made at the level of the record
+//! \param[in] level the level of callback nesting of the record
+//! \param[in] prefix the first part of the record
+//! \param[in] prefix_length the number of bytes in the first part
+//! \param[in] data the second part of the record
+//! \param[in] data_length the number of bytes in the second part
+//! \param[in/out] span the area to write the encoded record to, which must
+//!                 be big enough for any encoding of the record
+//! \return the number of bytes in the encoded record
+static uint32_t _recording_encode(
+        recording_history_t *history, uint32_t level, uint8_t *prefix,
+        uint32_t prefix_length, uint8_t *data, uint32_t data_length,
+        recording_span_t *span) {
+    uint32_t length = prefix_length + data_length;
+    uint32_t n_bytes = _recording_put_varint(
+        span, (length << RECORDING_COMPRESSION_LEVEL_BITS) | level);
+
+    uint32_t i = 0;
+    while (i < length) {
+        uint32_t same_start = i;
+        while (i < length &&
+                _recording_diff(history, prefix, prefix_length, data, i) == 0) {
+            i++;
+        }
+        uint32_t diff_start = i;
+        while (i < length &&
+                (_recording_diff(
+                    history, prefix, prefix_length, data, i) != 0 ||
+                ((i + 1) < length && _recording_diff(
+                    history, prefix, prefix_length, data, i + 1) != 0))) {
+            i++;
+        }
+        n_bytes += _recording_put_varint(span, diff_start - same_start);
+        n_bytes += _recording_put_varint(span, i - diff_start);
+        n_bytes += i - diff_start;
+        for (uint32_t j = diff_start; j < i; j++) {
+            _recording_put_byte(span, _recording_diff(
+                history, prefix, prefix_length, data, j));
+        }
+    }
+    return n_bytes;
+}
+
+//! \brief gives back the end of a reservation that an encoded record did
+//!        not need.  The space can only be given back if nothing has been
+//!        reserved after it; otherwise, and where the space runs on past the
+//!        end of the channel or of a chunk, it is filled with padding.
+//! \param[in] channel the channel of the reservation
+//! \param[in/out] unused the part of the reservation that was not written
+//! \return the number of bytes given back
+static uint32_t _recording_release_unused(
+        uint8_t channel, recording_span_t *unused) {
+    if (unused->second_length > 0) {
+        memset(unused->first, 0, unused->first_length);
+        unused->first = unused->second;
+        unused->first_length = unused->second_length;
+        unused->second = NULL;
+        unused->second_length = 0;
+    }
+    uint32_t n_unused = unused->first_length;
+    if (n_unused == 0) {
+        return 0;
+    }
+
+    recording_counters_t *counters = &g_recording_counters[channel];
+    uint8_t *unused_end = unused->first + n_unused;
+    bool released = false;
+    uint cpsr = spin1_int_disable();
+    if (_is_staged(channel)) {
+
+        // No staging buffer can be flushed while the record is outstanding
+        recording_staging_t *staging = &g_recording_staging[channel];
+        if (&(staging->buffers[staging->active][staging->fill]) ==
+                unused_end) {
+            staging->fill -= n_unused;
+            counters->reserve_pointer -= n_unused;
+            if (counters->reserve_pointer <
+                    g_recording_channels[channel].start) {
+                counters->reserve_pointer += _recording_channel_size(channel);
             }
-            return false;
+            released = true;
         }
-    } else {
+    } else if (_is_pooled(channel) ?
+            counters->reserve_pointer == unused_end :
+            counters->reserve_pointer == _recording_advance(
+                channel, unused->first, n_unused)) {
+        counters->reserve_pointer = unused->first;
+        released = true;
+    }
+    if (released) {
+        counters->reserved -= n_unused;
+    }
+    spin1_mode_restore(cpsr);
+
+    if (!released) {
+        memset(unused->first, 0, n_unused);
+        return 0;
+    }
+    return n_unused;
+}
+
+//! \brief records a record into a compressed channel.  The record is
+//!        encoded straight into space reserved for the largest that it can
+//!        be, and the space that it does not need is given back.  The
+//!        record is compared against the last one made at the same level of
+//!        callback nesting, so that nothing needs interrupts to be disabled
+//!        except the reservation.
+//! \param[in] channel the channel to record into
+//! \param[in] data the record
+//! \param[in] size_bytes the number of bytes in the record
+//! \return True if the record was recorded
+static bool _recording_record_compressed(
+        uint8_t channel, uint8_t *data, uint32_t size_bytes) {
+    recording_compression_t *compression = &g_recording_compression[channel];
+    recording_frame_header_t header;
+    uint32_t header_length = 0;
+    if (_is_framed(channel)) {
+        header.time = recording_time + 1;
+        header.length = size_bytes;
+        header_length = sizeof(header);
+    }
+    uint8_t *prefix = (uint8_t *) &header;
+    uint32_t length = header_length + size_bytes;
+    if (length == 0) {
+        return true;
+    }
+
+    // A record made by a callback that interrupts this one has finished by
+    // the time that this one carries on, so the count is as it was read
+    uint32_t level = compression->n_recording++;
+    if (level >= RECORDING_COMPRESSION_LEVELS) {
+        compression->n_recording -= 1;
+        log_error("too many records being made in channel %u", channel);
         return false;
     }
+
+    recording_span_t span;
+    uint32_t max_bytes = _recording_encode_bound(length);
+    if (!_recording_reserve_channel(channel, max_bytes, &span)) {
+        compression->n_recording -= 1;
+        _recording_out_of_space(channel);
+        return false;
+    }
+    recording_history_t *history = &compression->history[level];
+    recording_span_t unused = span;
+    _recording_encode(
+        history, level, prefix, header_length, data, size_bytes, &unused);
+
+    // Keep the start of the record to compare the next one against
+    if (length > RECORDING_COMPRESSION_HISTORY_SIZE) {
+        length = RECORDING_COMPRESSION_HISTORY_SIZE;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        history->bytes[i] = (i < header_length) ?
+            prefix[i] : data[i - header_length];
+    }
+    history->length = length;
+
+    // Only the space kept counts towards the rate of the channel
+    span.first_length = max_bytes - _recording_release_unused(
+        channel, &unused);
+    span.second_length = 0;
+    recording_commit(channel, &span);
+    compression->n_recording -= 1;
+    return true;
 }
 
-//! brief this writes the state data to the regions
-void _recording_buffer_state_data_write(){
-    for (uint32_t recording_region_id = 0;
-             recording_region_id < n_recording_regions;
-             recording_region_id++) {
-        address_t recording_region_address =
-            region_addresses[recording_region_id];
+bool recording_record(uint8_t channel, void *data, uint32_t size_bytes) {
+    recording_span_t span;
+    uint8_t *data_bytes = (uint8_t *) data;
+
+    if (_has_been_initialsed(channel) && _is_compressed(channel)) {
+        return _recording_record_compressed(channel, data_bytes, size_bytes);
+    }
+    if (!recording_reserve(channel, size_bytes, &span)) {
+        return false;
+    }
+
+    // Copy data into recording channel
+    spin1_memcpy(span.first, data_bytes, span.first_length);
+    if (span.second_length > 0) {
         spin1_memcpy(
-             recording_region_address,
-             &g_recording_channels[recording_region_id],
-             sizeof(recording_channel_t));
-        log_debug(
-             "Storing channel state info starting at 0x%08x",
-             recording_region_address);
+            span.second, &data_bytes[span.first_length], span.second_length);
+    }
+    recording_commit(channel, &span);
+    return true;
+}
+
+//! brief this writes the state data of all the channels to the state block
+void _recording_buffer_state_data_write(){
+
+    // The host tells a full channel from an empty one by the last operation
+    for (uint32_t i = 0; i < n_recording_regions; i++) {
+        recording_counters_t *counters = &g_recording_counters[i];
+        if (counters->written != counters->read) {
+            g_recording_channels[i].last_buffer_operation =
+                BUFFER_OPERATION_WRITE;
+        } else {
+            g_recording_channels[i].last_buffer_operation =
+                BUFFER_OPERATION_READ;
+        }
     }
+    spin1_memcpy(
+        &recording_state[CHANNEL_STATES_START - STATE_VERSION],
+        g_recording_channels,
+        n_recording_regions * sizeof(recording_channel_t));
+    log_debug(
+        "Storing channel state info starting at 0x%08x", recording_state);
 
     // store info related to the state of the transmission to avoid possible
     // duplication of info on the host side
-    *last_sequence_number = sequence_number;
-
+    recording_state[LAST_SEQUENCE_NUMBER - STATE_VERSION] = sequence_number;
 }
 
 void recording_finalise() {
@@ -417,8 +1648,19 @@ void recording_finalise() {
 
     log_debug("Finalising recording channels");
 
+    // Make sure all staged data is in SDRAM before the state is stored
+    for (uint32_t channel = 0; channel < n_recording_regions; channel++) {
+        if (_has_been_initialsed(channel) && _is_staged(channel)) {
+            _recording_drain_staging(channel);
+        }
+    }
+
     _recording_buffer_state_data_write();
 
+    // The version is written last, so that the host only takes the state as
+    // valid once all of it has been stored
+    recording_state[0] = RECORDING_STATE_VERSION;
+
     // Loop through channels
     for (uint32_t channel = 0; channel < n_recording_regions; channel++) {
 
@@ -460,13 +1702,38 @@ bool recording_initialize(
     if (time_between_triggers < MIN_TIME_BETWEEN_TRIGGERS) {
         time_between_triggers = MIN_TIME_BETWEEN_TRIGGERS;
     }
-    last_sequence_number = &(recording_data_address[LAST_SEQUENCE_NUMBER]);
+    staging_buffer_size = recording_data_address[STAGING_BUFFER_SIZE] & ~0x3;
+    round_trip_time = recording_data_address[ROUND_TRIP_TIME];
+    pool_size = recording_data_address[POOL_SIZE];
+    pool_chunk_size = recording_data_address[POOL_CHUNK_SIZE] & ~0x3;
+    read_window_size = recording_data_address[READ_WINDOW_SIZE];
+    if (read_window_size > MAX_READ_WINDOW) {
+        read_window_size = MAX_READ_WINDOW;
+    }
+    recording_state = &(recording_data_address[STATE_VERSION]);
+
+    // The arrays of the regions follow the state of the channels
+    address_t region_pointers = &(recording_data_address[
+        CHANNEL_STATES_START + ((n_recording_regions *
+            sizeof(recording_channel_t)) / sizeof(uint32_t))]);
 
     log_info(
         "Recording %d regions, using output tag %d, size before trigger %d, "
-        "time between triggers %d",
+        "time between triggers %d, staging buffer size %d, "
+        "round trip time %d, pool size %d, pool chunk size %d, "
+        "read window size %d",
         n_recording_regions, buffering_output_tag, buffer_size_before_trigger,
-        time_between_triggers);
+        time_between_triggers, staging_buffer_size, round_trip_time,
+        pool_size, pool_chunk_size, read_window_size);
+    if (pool_size > 0 && pool_chunk_size <= POOL_CHUNK_HEADER_SIZE) {
+        log_error("Pool chunk size %d is too small", pool_chunk_size);
+        return false;
+    }
+    if (pool_size > 0 && (pool_size / pool_chunk_size) > POOL_MAX_CHUNKS) {
+        log_error("Pool of %d chunks has more than %d chunks",
+                  pool_size / pool_chunk_size, POOL_MAX_CHUNKS);
+        return false;
+    }
 
     // Set up the space for holding recording pointers and sizes
     region_addresses = (address_t*) spin1_malloc(
@@ -481,36 +1748,86 @@ bool recording_initialize(
         log_error("Not enough space to allocate region sizes");
         return false;
     }
+    region_flags = (uint32_t *) spin1_malloc(
+        n_recording_regions * sizeof(uint32_t));
+    if (region_flags == NULL) {
+        log_error("Not enough space to allocate region flags");
+        return false;
+    }
+    region_min_sizes = (uint32_t *) spin1_malloc(
+        n_recording_regions * sizeof(uint32_t));
+    if (region_min_sizes == NULL) {
+        log_error("Not enough space to allocate region minimum sizes");
+        return false;
+    }
+
+    // Work out the space of the regions, each starting on a word boundary
+    uint32_t data_size = 0;
+    for (uint32_t counter = 0; counter < n_recording_regions; counter++) {
+        region_sizes[counter] = region_pointers[n_recording_regions + counter];
+        region_flags[counter] =
+            region_pointers[(2 * n_recording_regions) + counter];
+        region_min_sizes[counter] =
+            region_pointers[(3 * n_recording_regions) + counter];
+        data_size += (region_sizes[counter] + 3) & ~0x3;
+
+        // The pool holds the data of every region, so all of them must be
+        // pooled when there is a pool, and none of them otherwise
+        if (((region_flags[counter] & RECORDING_REGION_FLAG_POOLED) != 0) !=
+                (pool_size > 0)) {
+            log_error("Region %u has flags 0x%x but the pool size is %u",
+                      counter, region_flags[counter], pool_size);
+            return false;
+        }
+    }
+    if (pool_size > 0) {
+        data_size = pool_size;
+    }
+
+    // All of the regions, or the pool, are in one block of SDRAM
+    uint8_t *data_block = NULL;
+    if (data_size > 0) {
+        data_block = sark_xalloc(
+            sv->sdram_heap, data_size, 0,
+            ALLOC_LOCK + ALLOC_ID + (sark_vec->app_id << 8));
+        if (data_block == NULL) {
+            log_error(
+                "Could not allocate recording data of %u bytes", data_size);
+            return false;
+        }
+    }
+    if (pool_size > 0) {
+        pool_chunks = data_block;
+        pool_n_chunks = pool_size / pool_chunk_size;
+        pool_free_chunks = (uint16_t *) spin1_malloc(
+            pool_n_chunks * sizeof(uint16_t));
+        g_recording_pool = (recording_pool_channel_t *) spin1_malloc(
+            n_recording_regions * sizeof(recording_pool_channel_t));
+        if (pool_free_chunks == NULL || g_recording_pool == NULL) {
+            log_error("Not enough space to create recording pool state");
+            return false;
+        }
+    }
 
     // Set up the recording flags
     if (recording_flags != NULL) {
         *recording_flags = 0;
     }
 
-    // Reserve the actual recording regions.
-    // An extra sizeof(recording_channel_t) bytes are reserved per channel
-    // to store the data after recording
+    // Share out the block between the regions
+    uint8_t *region_address = data_block;
     for (uint32_t counter = 0; counter < n_recording_regions; counter++) {
-        uint32_t size = recording_data_address[
-            REGION_POINTERS_START + n_recording_regions + counter];
+        uint32_t size = region_sizes[counter];
         if (size > 0) {
-            region_sizes[counter] = size;
-            region_addresses[counter] = sark_xalloc(
-                sv->sdram_heap, size + sizeof(recording_channel_t), 0,
-                ALLOC_LOCK + ALLOC_ID + (sark_vec->app_id << 8));
-            if (region_addresses[counter] == NULL) {
-                log_error(
-                    "Could not allocate recording region %u of %u bytes",
-                    counter, size);
-                return false;
+            region_addresses[counter] = (address_t) region_address;
+            if (pool_size == 0) {
+                region_address += (size + 3) & ~0x3;
             }
-            recording_data_address[REGION_POINTERS_START + counter] =
-                (uint32_t) region_addresses[counter];
+            region_pointers[counter] = (uint32_t) region_addresses[counter];
             *recording_flags = (*recording_flags | (1 << counter));
         } else {
-            recording_data_address[REGION_POINTERS_START + counter] = 0;
+            region_pointers[counter] = 0;
             region_addresses[counter] = 0;
-            region_sizes[counter] = 0;
         }
     }
     g_recording_channels = (recording_channel_t*) sark_alloc(
@@ -520,6 +1837,81 @@ bool recording_initialize(
         return false;
     }
     log_debug("Allocated recording channels to 0x%08x", g_recording_channels);
+    g_recording_counters = (recording_counters_t *) spin1_malloc(
+        n_recording_regions * sizeof(recording_counters_t));
+    if (g_recording_counters == NULL) {
+        log_error("Not enough space to create recording counters");
+        return false;
+    }
+
+    // Set up the staging buffers if recording asynchronously; these are kept
+    // between runs, as DTCM is not freed on resume
+    if (staging_buffer_size > 0 && g_recording_staging == NULL) {
+        g_recording_staging = (recording_staging_t *) spin1_malloc(
+            n_recording_regions * sizeof(recording_staging_t));
+        if (g_recording_staging == NULL) {
+            log_error("Not enough space to create recording staging state");
+            return false;
+        }
+        for (uint32_t counter = 0; counter < n_recording_regions; counter++) {
+            g_recording_staging[counter].buffers[0] = NULL;
+            if (region_sizes[counter] == 0 || _is_ring(counter) ||
+                    _is_pooled(counter)) {
+                continue;
+            }
+            uint8_t *buffers = (uint8_t *) spin1_malloc(
+                N_STAGING_BUFFERS * staging_buffer_size);
+            if (buffers == NULL) {
+                log_error(
+                    "Not enough space to allocate staging buffers for"
+                    " recording region %u", counter);
+                return false;
+            }
+            for (uint32_t i = 0; i < N_STAGING_BUFFERS; i++) {
+                g_recording_staging[counter].buffers[i] =
+                    &buffers[i * staging_buffer_size];
+            }
+        }
+        spin1_callback_on(
+            DMA_TRANSFER_DONE, recording_dma_transfer_done,
+            DMA_TRANSFER_DONE_PRIORITY);
+    }
+
+    // Set up the outstanding read requests if there can be more than one
+    if (read_window_size > 1 && g_read_slots == NULL) {
+        g_read_slots = (recording_read_slot_t *) spin1_malloc(
+            MAX_READ_WINDOW * sizeof(recording_read_slot_t));
+        requested_bytes = (uint32_t *) spin1_malloc(
+            n_recording_regions * sizeof(uint32_t));
+        if (g_read_slots == NULL || requested_bytes == NULL) {
+            log_error("Not enough space to create read request window");
+            return false;
+        }
+    }
+
+    // Set up the fill rate tracking if the trigger is adaptive
+    if (round_trip_time > 0 && g_recording_rates == NULL) {
+        g_recording_rates = (recording_rate_t *) spin1_malloc(
+            n_recording_regions * sizeof(recording_rate_t));
+        if (g_recording_rates == NULL) {
+            log_error("Not enough space to create recording rate state");
+            return false;
+        }
+    }
+
+    // Set up the history of the compressed channels
+    bool any_compressed = false;
+    for (uint32_t counter = 0; counter < n_recording_regions; counter++) {
+        any_compressed |= _is_compressed(counter);
+    }
+    if (any_compressed && g_recording_compression == NULL) {
+        g_recording_compression = (recording_compression_t *) spin1_malloc(
+            n_recording_regions * sizeof(recording_compression_t));
+        if (g_recording_compression == NULL) {
+            log_error("Not enough space to create recording history");
+            return false;
+        }
+    }
 
     // Set up the channels and write the initial state data
     recording_reset();
@@ -537,35 +1929,130 @@ bool recording_initialize(
     return true;
 }
 
+//! \brief resets the staging state of a channel, making sure that the channel
+//!        ends on a word boundary so that all DMA transfers are whole words
+//! \param[in] channel the channel to reset
+static void _recording_reset_staging(uint8_t channel) {
+    recording_channel_t *recording_channel = &g_recording_channels[channel];
+    recording_staging_t *staging = &g_recording_staging[channel];
+
+    recording_channel->end = recording_channel->start +
+        ((recording_channel->end - recording_channel->start) & ~0x3);
+    staging->active = 0;
+    staging->fill = 0;
+    staging->dma_write = recording_channel->start;
+    for (uint32_t i = 0; i < N_STAGING_BUFFERS; i++) {
+        staging->in_flight[i] = 0;
+        staging->flushed[i] = 0;
+        staging->commit_to[i] = recording_channel->start;
+    }
+}
+
+//! \brief gives all of the chunks of the pool back, and then gives each
+//!        channel a first chunk to write to
+static void _recording_reset_pool() {
+    uint32_t payload_size = pool_chunk_size - POOL_CHUNK_HEADER_SIZE;
+
+    pool_n_free = pool_n_chunks;
+    for (uint32_t i = 0; i < pool_n_chunks; i++) {
+        pool_free_chunks[i] = (pool_n_chunks - 1) - i;
+    }
+
+    // Work out the chunks that each channel needs and can have
+    pool_n_reserved = 0;
+    for (uint32_t i = 0; i < n_recording_regions; i++) {
+        recording_pool_channel_t *pool_channel = &g_recording_pool[i];
+        pool_channel->n_chunks = 0;
+        pool_channel->min_chunks =
+            (region_min_sizes[i] + payload_size - 1) / payload_size;
+        pool_channel->max_chunks =
+            (region_sizes[i] + payload_size - 1) / payload_size;
+        if (pool_channel->min_chunks > pool_channel->max_chunks) {
+            pool_channel->min_chunks = pool_channel->max_chunks;
+        }
+        pool_n_reserved += pool_channel->min_chunks;
+    }
+    if (pool_n_reserved > pool_n_chunks) {
+        log_info(
+            "WARNING: recording pool of %u chunks cannot meet minimums of"
+            " %u chunks", pool_n_chunks, pool_n_reserved);
+        pool_n_reserved = pool_n_chunks;
+    }
+
+    for (uint32_t i = 0; i < n_recording_regions; i++) {
+        recording_pool_channel_t *pool_channel = &g_recording_pool[i];
+        recording_channel_t *recording_channel = &g_recording_channels[i];
+        pool_channel->head = NULL;
+        pool_channel->tail = NULL;
+        if (region_sizes[i] == 0) {
+            continue;
+        }
+
+        // The host sees the whole pool as the region of the channel
+        recording_channel->start = pool_chunks;
+        recording_channel->end = &pool_chunks[pool_n_chunks * pool_chunk_size];
+        uint8_t *chunk = _recording_pool_acquire(i);
+        if (chunk == NULL) {
+            log_info("WARNING: no recording pool chunk for channel %u", i);
+            recording_channel->current_read = NULL;
+            recording_channel->current_write = NULL;
+            continue;
+        }
+        pool_channel->head = chunk;
+        pool_channel->tail = chunk;
+        recording_channel->current_read = chunk + POOL_CHUNK_HEADER_SIZE;
+        recording_channel->current_write = chunk + POOL_CHUNK_HEADER_SIZE;
+        g_recording_counters[i].reserve_pointer =
+            chunk + POOL_CHUNK_HEADER_SIZE;
+    }
+}
+
 void recording_reset() {
 
     // Go through the regions and set up the data
     for (uint32_t i = 0; i < n_recording_regions; i++) {
         uint32_t region_size = region_sizes[i];
         log_debug("region size %d", region_size);
-        if (region_size > 0) {
-            address_t region_address = region_addresses[i];
-
-            log_debug("%d is size of buffer state in words",
-                sizeof(recording_channel_t) / sizeof(address_t));
 
-            address_t region_address_offset = &region_address[
-                sizeof(recording_channel_t) / sizeof(address_t)];
+        // The channel starts empty, with nothing being written
+        recording_counters_t *counters = &g_recording_counters[i];
+        counters->reserved = 0;
+        counters->written = 0;
+        counters->read = 0;
+        counters->n_reserving = 0;
+        counters->reserve_pointer = (uint8_t *) region_addresses[i];
+        if (region_size > 0) {
+            uint8_t *region_address = (uint8_t *) region_addresses[i];
 
             // store pointers to the start, current position and end of this
-            g_recording_channels[i].start =
-                (uint8_t*) region_address_offset;
-            g_recording_channels[i].current_write =
-                (uint8_t*) region_address_offset;
-            g_recording_channels[i].current_read =
-                (uint8_t*) region_address_offset;
+            g_recording_channels[i].start = region_address;
+            g_recording_channels[i].current_write = region_address;
+            g_recording_channels[i].current_read = region_address;
             g_recording_channels[i].end =
                 g_recording_channels[i].start + region_size;
-            g_recording_channels[i].last_buffer_operation =
-                BUFFER_OPERATION_READ;
             g_recording_channels[i].region_id = i;
             g_recording_channels[i].missing_info = 0;
 
+            if (_is_staged(i)) {
+                _recording_reset_staging(i);
+            }
+            if (_is_ring(i)) {
+
+                // Records in a ring channel are whole words
+                g_recording_channels[i].end = g_recording_channels[i].start +
+                    (region_size & ~0x3);
+            }
+            if (g_recording_rates != NULL) {
+                g_recording_rates[i].bytes_this_tick = 0;
+                g_recording_rates[i].average = 0;
+            }
+            if (g_recording_compression != NULL) {
+                g_recording_compression[i].n_recording = 0;
+                for (uint32_t j = 0; j < RECORDING_COMPRESSION_LEVELS; j++) {
+                    g_recording_compression[i].history[j].length = 0;
+                }
+            }
+
             log_info(
                 "Recording channel %u configured to use %u byte memory block"
                 " starting at 0x%08x", i, region_size,
@@ -577,19 +2064,56 @@ void recording_reset() {
             g_recording_channels[i].current_write = NULL;
             g_recording_channels[i].current_read = NULL;
             g_recording_channels[i].end = NULL;
-            g_recording_channels[i].last_buffer_operation =
-                BUFFER_OPERATION_READ;
             g_recording_channels[i].region_id = i;
             g_recording_channels[i].missing_info = 0;
 
             log_info("Recording channel %u left uninitialised", i);
         }
     }
+    if (pool_size > 0) {
+        _recording_reset_pool();
+    }
+
+    // Forget any outstanding read requests, as the channels are now empty
+    if (requested_bytes != NULL) {
+        next_sequence_number = sequence_number;
+        for (uint32_t i = 0; i < n_recording_regions; i++) {
+            requested_bytes[i] = 0;
+        }
+    }
     _recording_buffer_state_data_write();
+
+    // The state is not final until recording is finalised again
+    recording_state[0] = 0;
 }
 
 void recording_do_timestep_update(uint32_t time) {
-    if (time - last_time_buffering_trigger > time_between_triggers) {
+    recording_time = time;
+
+    if (g_read_slots != NULL) {
+        _recording_resend_read_requests(time);
+    }
+
+    // Send any staged data on its way, so that it is committed promptly
+    for (uint32_t channel = 0; channel < n_recording_regions; channel++) {
+        if (_has_been_initialsed(channel) && _is_staged(channel)) {
+            uint cpsr = spin1_int_disable();
+            _recording_flush_staging(channel);
+            spin1_mode_restore(cpsr);
+        }
+    }
+
+    if (g_recording_rates != NULL) {
+
+        // Check every tick, but leave at least a round trip between requests
+        // so that the host has a chance to respond to each one
+        _recording_update_rates();
+        if (time - last_time_buffering_trigger >= round_trip_time) {
+            if (_recording_send_buffering_out_trigger_message(0)) {
+                last_time_buffering_trigger = time;
+            }
+        }
+    } else if (time - last_time_buffering_trigger > time_between_triggers) {
         _recording_send_buffering_out_trigger_message(0);
         last_time_buffering_trigger = time;
     }
@@ -4,12 +4,133 @@
 #include <debug.h>
 #include <simulation.h>
 #include <spin1_api.h>
+#include <buffered_eieio_defs.h>
+
+//! \brief The SDP message that events are packed into, with its headers
+//!        filled in in advance
+typedef struct {
+    sdp_msg_t message;
+    uint16_t *aer_header;
+    void *aer_payload_prefix;
+    void *aer_data;
+} event_message_t;
+
+//! The most bitfield words that fit in a spike frame after its header
+#define SPIKE_FRAME_MAX_WORDS 63
+
+//! The formats of the data of a spike frame
+typedef enum spike_frame_formats_e {
+    //! The words of the bitfield of the atoms that fired
+    FRAME_FORMAT_BITFIELD,
+    //! 16-bit lengths of alternating runs of atoms that did not and did fire
+    FRAME_FORMAT_RUN_LENGTH
+} spike_frame_formats_e;
+
+//! \brief A spike frame, which is written over an SDP message from its
+//!        command field onwards, so is all that is sent if the tag strips
+//!        the SDP header
+typedef struct {
+    uint16_t command;
+    uint16_t format;
+    uint32_t time;
+    uint32_t base_key;
+    uint16_t first_word;
+    uint16_t n_values;
+    uint32_t data[];
+} spike_frame_t;
+
+//! \brief A range of keys whose events are sent as spike frames
+typedef struct {
+    uint32_t base_key;
+    uint32_t mask;
+    uint32_t n_atoms;
+    uint32_t n_words;
+    //! The bitfield being filled in and the one being sent, by the index of
+    //! the filling bitfield
+    uint32_t *bitfields[2];
+} spike_frame_range_t;
+
+//! The most counts that fit in a rate message after its header
+#define RATE_MAX_COUNTS 63
+
+//! \brief The number of events counted by a counter over a window
+typedef struct {
+    uint16_t counter;
+    uint16_t count;
+} rate_count_t;
+
+//! \brief The non-zero counts of a range over a window, which are written
+//!        over an SDP message from its command field onwards
+typedef struct {
+    uint16_t command;
+    uint16_t n_counts;
+    uint32_t time;
+    uint32_t base_key;
+    uint16_t window;
+    uint16_t counter_shift;
+    rate_count_t counts[];
+} rate_counts_t;
+
+//! \brief A range of keys whose events are counted over a window, with a
+//!        counter for each block of 2^counter_shift atoms
+typedef struct {
+    uint32_t base_key;
+    uint32_t mask;
+    uint32_t n_atoms;
+    uint32_t counter_shift;
+    uint32_t n_counters;
+    //! The counters being counted into and the ones being sent, by the index
+    //! of the counting counters
+    uint16_t *counters[2];
+} aggregation_range_t;
+
+//! \brief A message that could not be sent when it was ready, queued in the
+//!        overflow ring in SDRAM
+typedef struct {
+    //! The timestep at which the message was queued
+    uint32_t time;
+    //! The number of events in the message
+    uint32_t n_events;
+    sdp_msg_t message;
+} overflow_slot_t;
+
+//! \brief An event with a payload received, in a slot of the payload ring
+typedef struct {
+    uint32_t key;
+    uint32_t payload;
+} payload_event_t;
 
 // Globals
-static sdp_msg_t g_event_message;
-static uint16_t *sdp_msg_aer_header;
-static uint16_t *sdp_msg_aer_key_prefix;
-static void *sdp_msg_aer_payload_prefix;
+static event_message_t event_message;
+static sdp_msg_t spike_frame_message;
+static spike_frame_range_t *spike_frame_ranges;
+static uint32_t n_spike_frame_ranges;
+static uint32_t spike_frame_compress;
+
+//! The index of the bitfields that events are being added to
+static uint32_t spike_frame_filling;
+
+static sdp_msg_t rate_message;
+static aggregation_range_t *aggregation_ranges;
+static uint32_t n_aggregation_ranges;
+static uint32_t aggregation_window;
+
+//! The number of ticks of the current window that have finished
+static uint32_t aggregation_ticks;
+
+//! The index of the counters that events are being counted into
+static uint32_t aggregation_counting;
+
+static overflow_slot_t *overflow_slots;
+static uint32_t n_overflow_slots;
+static uint32_t overflow_max_delay;
+
+//! The index of the oldest message in the overflow ring
+static uint32_t overflow_read;
+
+//! The number of messages in the overflow ring
+static uint32_t overflow_count;
+
 static void *sdp_msg_aer_data;
 static uint32_t time;
 static uint32_t packets_sent;
@@ -20,13 +141,24 @@ static uint8_t header_len;
 static uint32_t simulation_ticks = 0;
 static uint32_t infinite_run = 0;
 static circular_buffer without_payload_buffer;
-static circular_buffer with_payload_buffer;
-static bool processing_events = false;
+static volatile bool processing_events = false;
+
+//! The events with payloads received and not yet processed, which are added
+//! only by incoming_event_payload_callback and removed only by
+//! incoming_event_process_callback, so that the key and payload of an event
+//! are always kept together
+static payload_event_t *payload_ring;
+static uint32_t payload_ring_size;
+static volatile uint32_t payload_ring_read;
+static volatile uint32_t payload_ring_write;
 
 //! Provenance data store
 typedef struct provenance_data_struct {
     uint32_t number_of_over_flows_none_payload;
     uint32_t number_of_over_flows_payload;
+    uint32_t number_of_deferred_events;
+    uint32_t number_of_dropped_events;
+    uint32_t max_deferral_ticks;
 } provenance_data_struct;
 
 //! values for the priority for each callback
@@ -70,7 +202,8 @@ static uint32_t packets_per_timestamp;
 typedef enum regions_e {
     SYSTEM_REGION,
     CONFIGURATION_REGION,
-    PROVENANCE_REGION
+    PROVENANCE_REGION,
+    OVERFLOW_REGION
 } regions_e;
 
 //! Human readable definitions of each element in the configuration region in
@@ -86,75 +219,383 @@ typedef enum configuration_region_components_e {
     PAYLOAD_PREFIX,
     PAYLOAD_RIGHT_SHIFT,
     SDP_TAG,
-    PACKETS_PER_TIMESTEP
+    PACKETS_PER_TIMESTEP,
+    SPIKE_FRAME_COMPRESS,
+    AGGREGATION_WINDOW,
+    N_AGGREGATION_RANGES,
+    OVERFLOW_SIZE,
+    OVERFLOW_MAX_DELAY,
+    WITHOUT_PAYLOAD_BUFFER_SIZE,
+    PAYLOAD_RING_SIZE,
+    N_SPIKE_FRAME_RANGES,
+    SPIKE_FRAME_RANGES
 } configuration_region_components_e;
 
-void flush_events(void) {
+//! Human readable definitions of each element of a spike frame range in the
+//! configuration region
+typedef enum spike_frame_range_components_e {
+    RANGE_BASE_KEY,
+    RANGE_MASK,
+    RANGE_N_ATOMS,
+    N_RANGE_COMPONENTS
+} spike_frame_range_components_e;
+
+//! Human readable definitions of each element of an aggregation range in the
+//! configuration region, which follow the spike frame ranges
+typedef enum aggregation_range_components_e {
+    AGGREGATION_BASE_KEY,
+    AGGREGATION_MASK,
+    AGGREGATION_N_ATOMS,
+    AGGREGATION_COUNTER_SHIFT,
+    N_AGGREGATION_COMPONENTS
+} aggregation_range_components_e;
+
+//! \brief Determines if another packet can be sent this timestep
+//! \return True if the limit on packets has not been reached
+static inline bool can_send_packet(void) {
+    return (packets_per_timestamp == 0)
+        || (packets_sent < packets_per_timestamp);
+}
+
+//! \brief Sends the messages in the overflow ring, oldest first, while the
+//!        limit on packets allows it and SDP buffers are free to send them.
+//!        Messages that have waited for longer than the latency bound are
+//!        dropped instead.  This is called at the start of each timestep,
+//!        before each message is sent, and whenever the user callback has
+//!        run out of events, so that messages go as soon as they can.  It
+//!        is only called from the user and timer callbacks, which never
+//!        interrupt each other, so the ring is not shared.
+void drain_overflow(void) {
+    while ((overflow_count > 0) && can_send_packet()) {
+        overflow_slot_t *slot = &overflow_slots[overflow_read];
+        uint32_t delay = time - slot->time;
+        if (delay <= overflow_max_delay) {
+
+            // If there is no buffer to send the message with, it is kept
+            // until there is
+            if (!spin1_send_sdp_msg(&slot->message, 1)) {
+                return;
+            }
+            packets_sent++;
+            if (delay > provenance_data.max_deferral_ticks) {
+                provenance_data.max_deferral_ticks = delay;
+            }
+        } else {
+            provenance_data.number_of_dropped_events += slot->n_events;
+        }
+        overflow_read++;
+        if (overflow_read == n_overflow_slots) {
+            overflow_read = 0;
+        }
+        overflow_count--;
+    }
+}
 
-    // Send the event message only if there is data
-    if (buffer_index > 0) {
-        uint8_t event_count;
-        uint16_t bytes_to_clear = 0;
+//! \brief Sends a message if the limit on packets allows it, no earlier
+//!        message is waiting and there is an SDP buffer to send it with.
+//!        Otherwise a copy of it is queued in the overflow ring, or it is
+//!        dropped if the ring is full.  This is only called from the user and
+//!        timer callbacks, which never interrupt each other.
+//! \param[in] message The message to send
+//! \param[in] n_events The number of events in the message
+static void send_or_defer(sdp_msg_t *message, uint32_t n_events) {
+    drain_overflow();
+    if ((overflow_count == 0) && can_send_packet() &&
+            spin1_send_sdp_msg(message, 1)) {
+        packets_sent++;
+        return;
+    }
 
-        if ((packets_per_timestamp == 0)
-                || (packets_sent < packets_per_timestamp)) {
+    if (overflow_count == n_overflow_slots) {
+        provenance_data.number_of_dropped_events += n_events;
+        return;
+    }
+    uint32_t index = overflow_read + overflow_count;
+    if (index >= n_overflow_slots) {
+        index -= n_overflow_slots;
+    }
+    overflow_slot_t *slot = &overflow_slots[index];
+    slot->time = time;
+    slot->n_events = n_events;
+
+    // Only the message up to the end of its data needs to be kept; the
+    // length counts from after the first 8 bytes of the message
+    spin1_memcpy(&slot->message, message, message->length + 8);
+    overflow_count++;
+    provenance_data.number_of_deferred_events += n_events;
+}
 
-            // Get the event count depending on if there is a payload or not
-            if (packet_type & 0x1) {
-                event_count = buffer_index >> 1;
-            } else {
-                event_count = buffer_index;
-            }
+//! \brief Sends the message that events have been packed into, if any.
+//!        Events are packed by the user callback and flushed by it or by the
+//!        timer callback, which are both queued and so never interrupt each
+//!        other.  The message is copied as it is sent or deferred, so events
+//!        can be packed into it again as soon as this returns.
+void flush_events(void) {
+    if (buffer_index == 0) {
+        return;
+    }
 
-            // insert appropriate header
-            sdp_msg_aer_header[0] = 0;
-            sdp_msg_aer_header[0] |= temp_header;
-            sdp_msg_aer_header[0] |= (event_count & 0xff);
+    // The data doesn't need to be cleared, as each event overwrites all of
+    // its space
 
-            g_event_message.length = sizeof(sdp_hdr_t) + header_len
+    // Get the event count depending on if there is a payload or not
+    uint8_t event_count;
+    if (packet_type & 0x1) {
+        event_count = buffer_index >> 1;
+    } else {
+        event_count = buffer_index;
+    }
+    buffer_index = 0;
+
+    // insert appropriate header
+    event_message.aer_header[0] = temp_header | (event_count & 0xff);
+
+    event_message.message.length = sizeof(sdp_hdr_t) + header_len
                                      + event_count * event_size;
 
+    if (payload_apply_prefix && payload_timestamp) {
+        uint16_t *temp = (uint16_t *) event_message.aer_payload_prefix;
+
+        if (!(packet_type && 0x2)) {
+            temp[0] = (time & 0xFFFF);
+        } else {
+            temp[0] = (time & 0xFFFF);
+            temp[1] = ((time >> 16) & 0xFFFF);
+        }
+    }
+
 #if LOG_LEVEL >= LOG_DEBUG
-            log_debug("===========Packet============\n");
-            uint8_t *print_ptr1 = (uint8_t *) &g_event_message;
-            for (uint8_t i = 0; i < g_event_message.length + 8; i++) {
-                log_debug("%02x ", print_ptr1[i]);
-            }
+    log_debug("===========Packet============\n");
+    uint8_t *print_ptr = (uint8_t *) &event_message.message;
+    for (uint8_t i = 0; i < event_message.message.length + 8; i++) {
+        log_debug("%02x ", print_ptr[i]);
+    }
 #endif // LOG_LEVEL >= LOG_DEBUG
 
-            if (payload_apply_prefix && payload_timestamp) {
-                uint16_t *temp = (uint16_t *) sdp_msg_aer_payload_prefix;
+    // Send the event message, or keep it for later if the limit has been
+    // reached
+    send_or_defer(&event_message.message, event_count);
+}
 
-                if (!(packet_type && 0x2)) {
-                    temp[0] = (time & 0xFFFF);
-                } else {
-                    temp[0] = (time & 0xFFFF);
-                    temp[1] = ((time >> 16) & 0xFFFF);
+//! \brief Encodes part of a bitfield as the lengths of alternating runs of
+//!        clear and set bits, starting with a run of clear bits.  A trailing
+//!        run of clear bits is left out.
+//! \param[in] words The part of the bitfield
+//! \param[in] n_words The number of words in the part
+//! \param[out] runs Where the lengths of the runs are written
+//! \param[in] max_runs The most runs that can be written
+//! \param[out] n_runs The number of runs written
+//! \return False if there would be more than max_runs runs, true otherwise
+static bool encode_runs(
+        const uint32_t *words, uint32_t n_words, uint16_t *runs,
+        uint32_t max_runs, uint32_t *n_runs) {
+    uint32_t n = 0;
+    uint32_t run = 0;
+    uint32_t set = 0;
+    for (uint32_t w = 0; w < n_words; w++) {
+        uint32_t word = words[w];
+
+        // Whole words that continue the run are counted at once
+        if (word == (set ? 0xFFFFFFFF : 0)) {
+            run += 32;
+            continue;
+        }
+        for (uint32_t bit = 0; bit < 32; bit++) {
+            uint32_t bit_set = (word >> bit) & 0x1;
+            if (bit_set != set) {
+                if (n == max_runs) {
+                    return false;
                 }
+                runs[n++] = run;
+                run = 0;
+                set = bit_set;
             }
+            run++;
+        }
+    }
+    if (set) {
+        if (n == max_runs) {
+            return false;
+        }
+        runs[n++] = run;
+    }
+    *n_runs = n;
+    return true;
+}
 
-#if LOG_LEVEL >= LOG_DEBUG
-            log_debug("===========Packet============\n");
-            uint8_t *print_ptr2 = (uint8_t *) &sdp_msg_aer_data;
-            for (uint8_t i = 0; i < buffer_index * event_size; i++) {
-                log_debug("%02x ", print_ptr2[i]);
+//! \brief Sends part of the bitfield of a range as a spike frame, as run
+//!        lengths if compression is on and they are smaller, and then clears
+//!        that part of the bitfield.  Nothing is sent if no atom fired, and
+//!        the frame is deferred if the limit on packets has been reached.
+//! \param[in] range The range that the bitfield is of
+//! \param[in] words The part of the bitfield
+//! \param[in] first_word The index of the first word of the part
+//! \param[in] n_words The number of words in the part
+static void send_spike_frame(
+        const spike_frame_range_t *range, uint32_t *words,
+        uint32_t first_word, uint32_t n_words) {
+    uint32_t n_fired = 0;
+    for (uint32_t i = 0; i < n_words; i++) {
+        for (uint32_t word = words[i]; word != 0; word &= word - 1) {
+            n_fired++;
+        }
+    }
+    if (n_fired == 0) {
+        return;
+    }
+
+    spike_frame_t *frame = (spike_frame_t *) &spike_frame_message.cmd_rc;
+    frame->time = time;
+    frame->base_key = range->base_key;
+    frame->first_word = first_word;
+
+    // The runs are only used if they take fewer bytes than the words
+    uint32_t n_runs;
+    uint32_t data_size;
+    if (spike_frame_compress && encode_runs(
+            words, n_words, (uint16_t *) frame->data,
+            (n_words << 1) - 1, &n_runs)) {
+        frame->format = FRAME_FORMAT_RUN_LENGTH;
+        frame->n_values = n_runs;
+        data_size = n_runs * sizeof(uint16_t);
+    } else {
+        frame->format = FRAME_FORMAT_BITFIELD;
+        frame->n_values = n_words;
+        data_size = n_words * sizeof(uint32_t);
+        for (uint32_t i = 0; i < n_words; i++) {
+            frame->data[i] = words[i];
+        }
+    }
+    spike_frame_message.length =
+        sizeof(sdp_hdr_t) + sizeof(spike_frame_t) + data_size;
+    send_or_defer(&spike_frame_message, n_fired);
+
+    for (uint32_t i = 0; i < n_words; i++) {
+        words[i] = 0;
+    }
+}
+
+//! \brief Sends the spike frames of the timestep that has just finished.
+//!        Events are added to the other bitfields from now on; this can't
+//!        interrupt the adding of an event, so the swap is safe.
+void send_spike_frames(void) {
+    uint32_t sending = spike_frame_filling;
+    spike_frame_filling = sending ^ 1;
+
+    for (uint32_t r = 0; r < n_spike_frame_ranges; r++) {
+        spike_frame_range_t *range = &spike_frame_ranges[r];
+        uint32_t *bitfield = range->bitfields[sending];
+        for (uint32_t first_word = 0; first_word < range->n_words;
+                first_word += SPIKE_FRAME_MAX_WORDS) {
+            uint32_t n_words = range->n_words - first_word;
+            if (n_words > SPIKE_FRAME_MAX_WORDS) {
+                n_words = SPIKE_FRAME_MAX_WORDS;
             }
-#endif // LOG_LEVEL >= LOG_DEBUG
+            send_spike_frame(
+                range, &bitfield[first_word], first_word, n_words);
+        }
+    }
+}
 
-            spin1_send_sdp_msg(&g_event_message, 1);
-            packets_sent++;
+//! \brief Adds an event to the bitfield of its range, if its key is in one
+//!        of the ranges that are sent as spike frames
+//! \param[in] key The key of the event
+//! \return True if the event was added, false if it is to be sent as a key
+static inline bool spike_frame_add(uint32_t key) {
+    for (uint32_t r = 0; r < n_spike_frame_ranges; r++) {
+        spike_frame_range_t *range = &spike_frame_ranges[r];
+        if ((key & range->mask) == range->base_key) {
+            uint32_t atom = key & ~range->mask;
+            if (atom < range->n_atoms) {
+                range->bitfields[spike_frame_filling][atom >> 5] |=
+                    1 << (atom & 0x1F);
+                return true;
+            }
         }
+    }
+    return false;
+}
+
+//! \brief Sends the counts in the rate message, or defers them if the limit
+//!        on packets has been reached
+//! \param[in] n_counts The number of counts in the message
+//! \param[in] n_events The number of events counted by the counts
+static void send_rate_message(uint32_t n_counts, uint32_t n_events) {
+    rate_counts_t *rates = (rate_counts_t *) &rate_message.cmd_rc;
+    rates->n_counts = n_counts;
+    rate_message.length = sizeof(sdp_hdr_t) + sizeof(rate_counts_t)
+                          + n_counts * sizeof(rate_count_t);
+    send_or_defer(&rate_message, n_events);
+}
 
-        // reset packet content
-        bytes_to_clear = buffer_index * event_size;
-        uint16_t *temp = (uint16_t *) sdp_msg_aer_data;
-        for (uint8_t i = 0; i < (bytes_to_clear >> 2); i++) {
-            temp[i] = 0;
+//! \brief Sends the non-zero counts of each aggregation range at the end of
+//!        a window.  Events are counted into the other counters from now on;
+//!        this can't interrupt the counting of an event, so the swap is
+//!        safe.
+void send_rate_counts(void) {
+    if (n_aggregation_ranges == 0) {
+        return;
+    }
+    aggregation_ticks++;
+    if (aggregation_ticks < aggregation_window) {
+        return;
+    }
+    aggregation_ticks = 0;
+
+    uint32_t sending = aggregation_counting;
+    aggregation_counting = sending ^ 1;
+
+    rate_counts_t *rates = (rate_counts_t *) &rate_message.cmd_rc;
+    for (uint32_t r = 0; r < n_aggregation_ranges; r++) {
+        aggregation_range_t *range = &aggregation_ranges[r];
+        uint16_t *counters = range->counters[sending];
+        rates->time = time;
+        rates->base_key = range->base_key;
+        rates->window = aggregation_window;
+        rates->counter_shift = range->counter_shift;
+
+        uint32_t n_counts = 0;
+        uint32_t n_events = 0;
+        for (uint32_t i = 0; i < range->n_counters; i++) {
+            if (counters[i] != 0) {
+                rates->counts[n_counts].counter = i;
+                rates->counts[n_counts].count = counters[i];
+                n_events += counters[i];
+                counters[i] = 0;
+                n_counts++;
+                if (n_counts == RATE_MAX_COUNTS) {
+                    send_rate_message(n_counts, n_events);
+                    n_counts = 0;
+                    n_events = 0;
+                }
+            }
+        }
+        if (n_counts > 0) {
+            send_rate_message(n_counts, n_events);
         }
     }
+}
 
-    // reset counter
-    buffer_index = 0;
+//! \brief Counts an event, if its key is in one of the ranges that are
+//!        aggregated.  Counts stop at the largest value of a counter.
+//! \param[in] key The key of the event
+//! \return True if the event was counted, false if it is to be sent
+static inline bool aggregation_add(uint32_t key) {
+    for (uint32_t r = 0; r < n_aggregation_ranges; r++) {
+        aggregation_range_t *range = &aggregation_ranges[r];
+        if ((key & range->mask) == range->base_key) {
+            uint32_t atom = key & ~range->mask;
+            if (atom < range->n_atoms) {
+                uint16_t *counter = &range->counters[aggregation_counting][
+                    atom >> range->counter_shift];
+                if (*counter != 0xFFFF) {
+                    *counter += 1;
+                }
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
 //! \brief function to store provenance data elements into SDRAM
@@ -170,8 +611,15 @@ void timer_callback(uint unused0, uint unused1) {
     use(unused0);
     use(unused1);
 
+    // Start the limit on packets afresh, giving the messages deferred
+    // earlier the first chance to go
+    packets_sent = 0;
+    drain_overflow();
+
     // flush the spike message and sent it over the Ethernet
     flush_events();
+    send_spike_frames();
+    send_rate_counts();
 
     // increase time variable to keep track of current timestep
     time++;
@@ -205,6 +653,12 @@ void flush_events_if_full(void) {
 void process_incoming_event(uint key) {
     log_debug("Processing key %x", key);
 
+    // events in the spike frame ranges are sent at the end of the timestep,
+    // and events in the aggregation ranges are only counted
+    if (spike_frame_add(key) || aggregation_add(key)) {
+        return;
+    }
+
     // process the received spike
     uint16_t *buf_pointer = (uint16_t *) sdp_msg_aer_data;
     if (!(packet_type & 0x2)) {
@@ -252,6 +706,11 @@ void process_incoming_event(uint key) {
 void process_incoming_event_payload(uint key, uint payload) {
     log_debug("Processing key %x, payload %x", key, payload);
 
+    // events in the aggregation ranges are only counted
+    if (aggregation_add(key)) {
+        return;
+    }
+
     // process the received spike
     uint16_t *buf_pointer = (uint16_t *) sdp_msg_aer_data;
     if (!(packet_type & 0x2)) {
@@ -296,23 +755,79 @@ void process_incoming_event_payload(uint key, uint payload) {
     flush_events_if_full();
 }
 
+//! \brief Adds an event with a payload to the payload ring; one slot is
+//!        always left empty so that a full ring can be told from an empty one
+//! \param[in] key The key of the event
+//! \param[in] payload The payload of the event
+//! \return True if the event was added, false if the ring is full
+static inline bool payload_ring_add(uint32_t key, uint32_t payload) {
+    uint32_t next_write = payload_ring_write + 1;
+    if (next_write == payload_ring_size) {
+        next_write = 0;
+    }
+    if (next_write == payload_ring_read) {
+        return false;
+    }
+
+    // The event is only made visible once both of its words are written
+    payload_event_t *event = &payload_ring[payload_ring_write];
+    event->key = key;
+    event->payload = payload;
+    payload_ring_write = next_write;
+    return true;
+}
+
+//! \brief Removes the oldest event from the payload ring
+//! \param[out] key The key of the event
+//! \param[out] payload The payload of the event
+//! \return True if there was an event, false if the ring is empty
+static inline bool payload_ring_get_next(uint32_t *key, uint32_t *payload) {
+    uint32_t read = payload_ring_read;
+    if (read == payload_ring_write) {
+        return false;
+    }
+    payload_event_t *event = &payload_ring[read];
+    *key = event->key;
+    *payload = event->payload;
+    read++;
+    if (read == payload_ring_size) {
+        read = 0;
+    }
+    payload_ring_read = read;
+    return true;
+}
+
 void incoming_event_process_callback(uint unused0, uint unused1) {
     use(unused0);
     use(unused1);
 
     uint32_t key;
-    do {
-       if (circular_buffer_get_next(without_payload_buffer, &key)) {
-           process_incoming_event(key);
-       } else if (circular_buffer_get_next(with_payload_buffer, &key)) {
-           uint32_t payload;
-           circular_buffer_get_next(with_payload_buffer, &payload);
-           process_incoming_event_payload(key, payload);
-       } else {
-           processing_events = false;
-       }
-    }
-    while (processing_events);
+    uint32_t payload;
+    while (true) {
+        if (circular_buffer_get_next(without_payload_buffer, &key)) {
+            process_incoming_event(key);
+        } else if (payload_ring_get_next(&key, &payload)) {
+            process_incoming_event_payload(key, payload);
+        } else {
+
+            // An event received after the queues were found to be empty
+            // sees that events are being processed, and so doesn't trigger
+            // this callback; the queues are checked again with interrupts
+            // disabled, so that processing only stops when they are empty
+            drain_overflow();
+            uint cpsr = spin1_int_disable();
+            bool empty =
+                (circular_buffer_size(without_payload_buffer) == 0) &&
+                (payload_ring_read == payload_ring_write);
+            if (empty) {
+                processing_events = false;
+            }
+            spin1_mode_restore(cpsr);
+            if (empty) {
+                return;
+            }
+        }
+    }
 }
 
 void incoming_event_callback(uint key, uint unused) {
@@ -330,8 +845,7 @@ void incoming_event_callback(uint key, uint unused) {
 
 void incoming_event_payload_callback(uint key, uint payload) {
     log_debug("Received key %x, payload %x", key, payload);
-    if (circular_buffer_add(with_payload_buffer, key)) {
-        circular_buffer_add(with_payload_buffer, payload);
+    if (payload_ring_add(key, payload)) {
         if (!processing_events) {
             processing_events = true;
             spin1_trigger_user_event(0, 0);
@@ -386,6 +900,118 @@ void read_parameters(address_t region_address) {
     log_info("packets_per_timestamp: %d\n", packets_per_timestamp);
 }
 
+//! \brief Reads the ranges of keys whose events are sent as spike frames,
+//!        and allocates their bitfields
+//! \param[in] region_address The address of the configuration region
+//! \return True if the bitfields were allocated, false otherwise
+bool read_spike_frame_ranges(address_t region_address) {
+    spike_frame_compress = region_address[SPIKE_FRAME_COMPRESS];
+    n_spike_frame_ranges = region_address[N_SPIKE_FRAME_RANGES];
+    spike_frame_filling = 0;
+    log_info("spike_frame_compress: %d\n", spike_frame_compress);
+    log_info("n_spike_frame_ranges: %d\n", n_spike_frame_ranges);
+    if (n_spike_frame_ranges == 0) {
+        return true;
+    }
+
+    spike_frame_ranges = (spike_frame_range_t *) spin1_malloc(
+        n_spike_frame_ranges * sizeof(spike_frame_range_t));
+    if (spike_frame_ranges == NULL) {
+        log_error("Could not allocate %u spike frame ranges",
+                  n_spike_frame_ranges);
+        return false;
+    }
+
+    address_t range_address = &region_address[SPIKE_FRAME_RANGES];
+    for (uint32_t r = 0; r < n_spike_frame_ranges; r++) {
+        spike_frame_range_t *range = &spike_frame_ranges[r];
+        range->base_key = range_address[RANGE_BASE_KEY];
+        range->mask = range_address[RANGE_MASK];
+        range->n_atoms = range_address[RANGE_N_ATOMS];
+        range->n_words = (range->n_atoms + 31) >> 5;
+        range_address += N_RANGE_COMPONENTS;
+        log_info("spike frame range %u: key %08x, mask %08x, %u atoms\n",
+                 r, range->base_key, range->mask, range->n_atoms);
+        if (range->n_atoms == 0) {
+            log_error("Spike frame range %u has no atoms", r);
+            return false;
+        }
+
+        for (uint32_t b = 0; b < 2; b++) {
+            range->bitfields[b] = (uint32_t *) spin1_malloc(
+                range->n_words * sizeof(uint32_t));
+            if (range->bitfields[b] == NULL) {
+                log_error("Could not allocate the bitfield of spike frame"
+                          " range %u", r);
+                return false;
+            }
+            for (uint32_t i = 0; i < range->n_words; i++) {
+                range->bitfields[b][i] = 0;
+            }
+        }
+    }
+    return true;
+}
+
+//! \brief Reads the ranges of keys whose events are counted over a window,
+//!        and allocates their counters
+//! \param[in] region_address The address of the configuration region
+//! \return True if the counters were allocated, false otherwise
+bool read_aggregation_ranges(address_t region_address) {
+    aggregation_window = region_address[AGGREGATION_WINDOW];
+    n_aggregation_ranges = region_address[N_AGGREGATION_RANGES];
+    aggregation_ticks = 0;
+    aggregation_counting = 0;
+    log_info("aggregation_window: %d\n", aggregation_window);
+    log_info("n_aggregation_ranges: %d\n", n_aggregation_ranges);
+    if (n_aggregation_ranges == 0) {
+        return true;
+    }
+
+    aggregation_ranges = (aggregation_range_t *) spin1_malloc(
+        n_aggregation_ranges * sizeof(aggregation_range_t));
+    if (aggregation_ranges == NULL) {
+        log_error("Could not allocate %u aggregation ranges",
+                  n_aggregation_ranges);
+        return false;
+    }
+
+    // The aggregation ranges follow the spike frame ranges
+    address_t range_address = &region_address[SPIKE_FRAME_RANGES]
+        + (n_spike_frame_ranges * N_RANGE_COMPONENTS);
+    for (uint32_t r = 0; r < n_aggregation_ranges; r++) {
+        aggregation_range_t *range = &aggregation_ranges[r];
+        range->base_key = range_address[AGGREGATION_BASE_KEY];
+        range->mask = range_address[AGGREGATION_MASK];
+        range->n_atoms = range_address[AGGREGATION_N_ATOMS];
+        range->counter_shift = range_address[AGGREGATION_COUNTER_SHIFT];
+        if (range->n_atoms == 0) {
+            log_error("Aggregation range %u has no atoms", r);
+            return false;
+        }
+        range->n_counters =
+            ((range->n_atoms - 1) >> range->counter_shift) + 1;
+        range_address += N_AGGREGATION_COMPONENTS;
+        log_info("aggregation range %u: key %08x, mask %08x, %u atoms,"
+                 " %u counters\n", r, range->base_key, range->mask,
+                 range->n_atoms, range->n_counters);
+
+        for (uint32_t c = 0; c < 2; c++) {
+            range->counters[c] = (uint16_t *) spin1_malloc(
+                range->n_counters * sizeof(uint16_t));
+            if (range->counters[c] == NULL) {
+                log_error("Could not allocate the counters of aggregation"
+                          " range %u", r);
+                return false;
+            }
+            for (uint32_t i = 0; i < range->n_counters; i++) {
+                range->counters[c][i] = 0;
+            }
+        }
+    }
+    return true;
+}
+
 bool initialize(uint32_t *timer_period) {
 
     // Get the address this core's DTCM data starts at from SRAM
@@ -411,116 +1037,176 @@ bool initialize(uint32_t *timer_period) {
     }
 
     // Read the parameters
-    read_parameters(
-        data_specification_get_region(CONFIGURATION_REGION, address));
+    address_t region_address =
+        data_specification_get_region(CONFIGURATION_REGION, address);
+    read_parameters(region_address);
+    if (!read_spike_frame_ranges(region_address)) {
+        return false;
+    }
+    if (!read_aggregation_ranges(region_address)) {
+        return false;
+    }
+
+    // The overflow ring is only reserved if it has some space
+    overflow_max_delay = region_address[OVERFLOW_MAX_DELAY];
+    n_overflow_slots = region_address[OVERFLOW_SIZE] / sizeof(overflow_slot_t);
+    overflow_read = 0;
+    overflow_count = 0;
+    if ((region_address[OVERFLOW_SIZE] > 0) && (n_overflow_slots == 0)) {
+        log_error("An overflow ring of %u bytes can't hold a message of %u "
+                  "bytes", region_address[OVERFLOW_SIZE],
+                  sizeof(overflow_slot_t));
+        return false;
+    }
+    if (n_overflow_slots > 0) {
+        overflow_slots = (overflow_slot_t *) data_specification_get_region(
+            OVERFLOW_REGION, address);
+    }
+    log_info("n_overflow_slots: %d\n", n_overflow_slots);
+    log_info("overflow_max_delay: %d\n", overflow_max_delay);
+
+    // Set up the buffers for multicast message reception, with the sizes
+    // that the host expects the incoming events to need
+    uint32_t without_payload_buffer_size =
+        region_address[WITHOUT_PAYLOAD_BUFFER_SIZE];
+    without_payload_buffer =
+        circular_buffer_initialize(without_payload_buffer_size);
+    payload_ring_size = region_address[PAYLOAD_RING_SIZE];
+    if (payload_ring_size < 2) {
+        payload_ring_size = 2;
+    }
+    payload_ring = (payload_event_t *) spin1_malloc(
+        payload_ring_size * sizeof(payload_event_t));
+    if ((without_payload_buffer == NULL) || (payload_ring == NULL)) {
+        log_error("Could not allocate buffers for %u events and %u events"
+                  " with payloads", without_payload_buffer_size,
+                  payload_ring_size);
+        return false;
+    }
+    payload_ring_read = 0;
+    payload_ring_write = 0;
+    log_info("without_payload_buffer_size: %d\n",
+             without_payload_buffer_size);
+    log_info("payload_ring_size: %d\n", payload_ring_size);
 
     return true;
 }
 
-bool configure_sdp_msg(void) {
-    log_info("configure_sdp_msg\n");
-
-    void *temp_ptr;
-
-    temp_header = 0;
-    event_size = 0;
+//! \brief Fills in the SDP header of a message to be sent to the host
+//! \param[in] message The message to fill in
+static void configure_sdp_header(sdp_msg_t *message) {
 
     // initialise SDP header
-    g_event_message.tag = sdp_tag;
+    message->tag = sdp_tag;
 
     // No reply required
-    g_event_message.flags = 0x07;
+    message->flags = 0x07;
 
     // Chip 0,0
-    g_event_message.dest_addr = 0;
+    message->dest_addr = 0;
 
     // Dump through Ethernet
-    g_event_message.dest_port = PORT_ETH;
+    message->dest_port = PORT_ETH;
 
     // Set up monitoring address and port
-    g_event_message.srce_addr = spin1_get_chip_id();
-    g_event_message.srce_port = (3 << PORT_SHIFT) | spin1_get_core_id();
+    message->srce_addr = spin1_get_chip_id();
+    message->srce_port = (3 << PORT_SHIFT) | spin1_get_core_id();
+}
 
-    // check incompatible options
-    if (payload_timestamp && payload_apply_prefix && (packet_type & 0x1)) {
-        log_error("Timestamp can either be included as payload prefix or as"
-                  "payload to each key, not both\n");
-        return false;
-    }
-    if (payload_timestamp && !payload_apply_prefix && !(packet_type & 0x1)) {
-        log_error("Timestamp can either be included as payload prefix or as"
-                  "payload to each key, but current configuration does not"
-                  "specify either of these\n");
-        return false;
-    }
+//! \brief Fills in the headers of the event message, which stay the same
+//!        for every message sent from it
+//! \param[in] event_message The message to fill in
+static void configure_event_message(event_message_t *event_message) {
+    sdp_msg_t *message = &event_message->message;
+    configure_sdp_header(message);
 
     // initialise AER header
     // pointer to data space
-    sdp_msg_aer_header = &g_event_message.cmd_rc;
-
-    temp_header |= (apply_prefix << 15);
-    temp_header |= (prefix_type << 14);
-    temp_header |= (payload_apply_prefix << 13);
-    temp_header |= (payload_timestamp << 12);
-    temp_header |= (packet_type << 10);
-
-    header_len = 2;
-    temp_ptr = (void *) sdp_msg_aer_header[1];
+    event_message->aer_header = &message->cmd_rc;
+    uint16_t *temp_ptr = event_message->aer_header + 1;
 
     // pointers for AER packet header, prefix and data
     if (apply_prefix) {
 
-        // pointer to key prefix
-        sdp_msg_aer_key_prefix = (sdp_msg_aer_header + 1);
-        temp_ptr = (void *) (sdp_msg_aer_header + 2);
-        sdp_msg_aer_key_prefix[0] = (uint16_t) prefix;
-        header_len += 2;
-    } else {
-        sdp_msg_aer_key_prefix = NULL;
-        temp_ptr = (void *) (sdp_msg_aer_header + 1);
+        // key prefix
+        temp_ptr[0] = (uint16_t) prefix;
+        temp_ptr += 1;
     }
 
     if (payload_apply_prefix) {
-        sdp_msg_aer_payload_prefix = temp_ptr;
-        uint16_t *a = (uint16_t *) sdp_msg_aer_payload_prefix;
-
-        log_debug("temp_ptr: %08x\n", (uint32_t) temp_ptr);
-        log_debug("a: %08x\n", (uint32_t) a);
 
         // pointer to payload prefix
-        sdp_msg_aer_payload_prefix = temp_ptr;
+        event_message->aer_payload_prefix = temp_ptr;
 
         if (!(packet_type & 0x2)) {
 
             //16 bit payload prefix
-            temp_ptr = (void *) (a + 1);
-            header_len += 2;
             if (!payload_timestamp) {
 
                 // add payload prefix as required - not a timestamp
-                a[0] = payload_prefix;
+                temp_ptr[0] = payload_prefix;
             }
-            log_debug("16 bit - temp_ptr: %08x\n", (uint32_t) temp_ptr);
-
+            temp_ptr += 1;
         } else {
 
             //32 bit payload prefix
-            temp_ptr = (void *) (a + 2);
-            header_len += 4;
             if (!payload_timestamp) {
 
                 // add payload prefix as required - not a timestamp
-                a[0] = (payload_prefix & 0xFFFF);
-                a[1] = ((payload_prefix >> 16) & 0xFFFF);
+                temp_ptr[0] = (payload_prefix & 0xFFFF);
+                temp_ptr[1] = ((payload_prefix >> 16) & 0xFFFF);
             }
-            log_debug("32 bit - temp_ptr: %08x\n", (uint32_t) temp_ptr);
+            temp_ptr += 2;
         }
     } else {
-        sdp_msg_aer_payload_prefix = NULL;
+        event_message->aer_payload_prefix = NULL;
     }
 
     // pointer to write data
-    sdp_msg_aer_data = (void *) temp_ptr;
+    event_message->aer_data = (void *) temp_ptr;
+
+    log_debug("aer_header: %08x\n", (uint32_t) event_message->aer_header);
+    log_debug("aer_payload_prefix: %08x\n",
+              (uint32_t) event_message->aer_payload_prefix);
+    log_debug("aer_data: %08x\n", (uint32_t) event_message->aer_data);
+}
+
+bool configure_sdp_msg(void) {
+    log_info("configure_sdp_msg\n");
+
+    temp_header = 0;
+    event_size = 0;
+
+    // check incompatible options
+    if (payload_timestamp && payload_apply_prefix && (packet_type & 0x1)) {
+        log_error("Timestamp can either be included as payload prefix or as"
+                  "payload to each key, not both\n");
+        return false;
+    }
+    if (payload_timestamp && !payload_apply_prefix && !(packet_type & 0x1)) {
+        log_error("Timestamp can either be included as payload prefix or as"
+                  "payload to each key, but current configuration does not"
+                  "specify either of these\n");
+        return false;
+    }
+
+    temp_header |= (apply_prefix << 15);
+    temp_header |= (prefix_type << 14);
+    temp_header |= (payload_apply_prefix << 13);
+    temp_header |= (payload_timestamp << 12);
+    temp_header |= (packet_type << 10);
+
+    header_len = 2;
+    if (apply_prefix) {
+        header_len += 2;
+    }
+    if (payload_apply_prefix) {
+        if (!(packet_type & 0x2)) {
+            header_len += 2;
+        } else {
+            header_len += 4;
+        }
+    }
 
     switch (packet_type) {
     case 0:
@@ -544,12 +1230,19 @@ bool configure_sdp_msg(void) {
         return false;
     }
 
-    log_debug("sdp_msg_aer_header: %08x\n", (uint32_t) sdp_msg_aer_header);
-    log_debug("sdp_msg_aer_key_prefix: %08x\n",
-              (uint32_t) sdp_msg_aer_key_prefix);
-    log_debug("sdp_msg_aer_payload_prefix: %08x\n",
-              (uint32_t) sdp_msg_aer_payload_prefix);
-    log_debug("sdp_msg_aer_data: %08x\n", (uint32_t) sdp_msg_aer_data);
+    // Fill in the headers of the message in advance
+    configure_event_message(&event_message);
+    sdp_msg_aer_data = event_message.aer_data;
+
+    // The spike frame message only changes after its command
+    configure_sdp_header(&spike_frame_message);
+    spike_frame_t *frame = (spike_frame_t *) &spike_frame_message.cmd_rc;
+    frame->command = (1 << 14) | EVENT_SPIKE_FRAME;
+
+    // The rate message likewise
+    configure_sdp_header(&rate_message);
+    rate_counts_t *rates = (rate_counts_t *) &rate_message.cmd_rc;
+    rates->command = (1 << 14) | EVENT_RATE_COUNTS;
 
     packets_sent = 0;
     buffer_index = 0;
@@ -572,10 +1265,6 @@ void c_main(void) {
          rt_error(RTE_SWERR);
     }
 
-    // Set up circular buffers for multicast message reception
-    without_payload_buffer = circular_buffer_initialize(256);
-    with_payload_buffer = circular_buffer_initialize(512);
-
     // Set timer_callback
     spin1_set_timer_tick(timer_period);
 
@@ -16,7 +16,7 @@
 
 //! \brief human readable versions of the different priorities and usages.
 typedef enum callback_priorities {
-    SDP_CALLBACK = 0, TIMER = 2
+    SDP_CALLBACK = 0, DMA = 0, TIMER = 2, TRANSMIT = 3
 }callback_priorities;
 
 typedef enum eieio_data_message_types {
@@ -30,11 +30,24 @@ typedef enum eieio_prefix_types {
 
 //! The parameter positions
 typedef enum read_in_parameters{
-    APPLY_PREFIX, PREFIX, PREFIX_TYPE, CHECK_KEYS, HAS_KEY, KEY_SPACE, MASK,
-    BUFFER_REGION_SIZE, SPACE_BEFORE_DATA_REQUEST, RETURN_TAG_ID,
-    BUFFERED_IN_SDP_PORT
+    RETURN_TAG_ID, BUFFERED_IN_SDP_PORT, TRANSMIT_QUEUE_SIZE,
+    TRANSMIT_RATE, CALENDAR_SLOTS, CALENDAR_SLOT_SIZE, N_STREAMS,
+    HAS_PATTERN, STREAM_PARAMETERS
 } read_in_parameters;
 
+//! The positions of the parameters of each stream, which follow on from
+//! STREAM_PARAMETERS
+typedef enum stream_parameters {
+    STREAM_REGION, APPLY_PREFIX, PREFIX, PREFIX_TYPE, CHECK_KEYS, HAS_KEY,
+    KEY_SPACE, MASK, BUFFER_REGION_SIZE, SPACE_BEFORE_DATA_REQUEST,
+    REFILL_HYSTERESIS, DIRECT_WRITES, N_STREAM_PARAMETERS
+} stream_parameters;
+
+//! The positions of the additional provenance data items
+typedef enum provenance_items {
+    TRANSMIT_QUEUE_OVERFLOWS, FUTURE_PACKETS_DROPPED
+} provenance_items;
+
 //! The memory regions
 typedef enum memory_regions{
     SYSTEM,
@@ -42,6 +55,7 @@ typedef enum memory_regions{
     RECORDING_REGION,
     BUFFER_REGION,
     PROVENANCE_REGION,
+    PATTERN_REGION,
 } memory_regions;
 
 //! The number of regions that can be recorded
@@ -51,12 +65,44 @@ typedef enum memory_regions{
 //! the minimum space required for a buffer to work
 #define MIN_BUFFER_SPACE 10
 
-//! the amount of ticks to wait between requests
+//! the amount of ticks to wait before repeating a request that has not been
+//! answered
 #define TICKS_BETWEEN_REQUESTS 25
 
+//! The number of fractional bits of the drain rate estimate
+#define DRAIN_RATE_FRACTION_BITS 8
+
+//! The drain rate estimate moves 1 / (1 << DRAIN_RATE_SHIFT) of the way to
+//! the rate of each time step
+#define DRAIN_RATE_SHIFT 4
+
 //! the maximum size of a packet
 #define MAX_PACKET_SIZE 280
 
+//! The most bytes of the buffer region prefetched into each of the DTCM
+//! prefetch blocks by one DMA
+#define PREFETCH_BLOCK_SIZE 512
+
+//! The number of prefetch blocks; one is decoded while the other is filled
+#define N_PREFETCH_BLOCKS 2
+
+//! The most streams, as each has its own region; the first uses
+//! BUFFER_REGION and the rest use the regions after PATTERN_REGION
+#define MAX_STREAMS 11
+
+//! The number of fractional bits of the rate at which the transmit queue is
+//! sent, in packets per microsecond
+#define TRANSMIT_RATE_FRACTION_BITS 16
+
+//! The most microseconds of sending at the transmit rate that can be saved
+//! up while the transmit queue is empty or the router is busy, which limits
+//! the packets sent in a burst after a gap
+#define TRANSMIT_BURST_US 8
+
+//! Timer 2 control: enabled, 32-bit and free-running with no interrupt, so
+//! that it counts down at the CPU clock rate
+#define TRANSMIT_TIMER_CONTROL 0x82
+
 #pragma pack(1)
 
 typedef struct {
@@ -64,6 +110,55 @@ typedef struct {
     uint16_t payload;
 } event16_t;
 
+//! The states of a prefetch block
+typedef enum prefetch_states {
+    PREFETCH_EMPTY, PREFETCH_FILLING, PREFETCH_READY
+} prefetch_states;
+
+//! \brief A DTCM copy of part of the buffer region, which packets are
+//!        decoded from
+typedef struct {
+    //! The state of the block, which is changed by the DMA callback
+    volatile uint32_t state;
+
+    //! The first byte of the data, which is part way into the first word
+    //! when the data does not start on a word in SDRAM
+    uint8_t *data;
+
+    //! The number of bytes of data in the block
+    uint32_t length;
+
+    //! The number of bytes of the data that have been decoded
+    uint32_t consumed;
+
+    //! The words transferred by DMA, with room for the data to be rounded
+    //! out to whole words
+    uint32_t words[(PREFETCH_BLOCK_SIZE / sizeof(uint32_t)) + 1];
+} prefetch_block_t;
+
+//! \brief A pattern of keys that is replayed every period time steps from
+//!        start_time, so that periodic input only has to be loaded once.
+//!        The keys sent at each offset into the period are
+//!        keys[index[offset]] to keys[index[offset + 1] - 1], and key_offset
+//!        is added to each key once more in each repeat of the pattern.
+typedef struct {
+    uint32_t start_time;
+    uint32_t period;
+
+    //! The number of times the pattern is sent, or 0 to repeat it forever
+    uint32_t n_repeats;
+    uint32_t key_offset;
+    uint32_t n_keys;
+    uint32_t index[];
+} pattern_t;
+
+//! \brief A multicast packet waiting in the transmit queue
+typedef struct {
+    uint32_t key;
+    uint32_t payload;
+    uint32_t with_payload;
+} transmit_entry_t;
+
 typedef struct {
     uint16_t eieio_header_command;
     uint16_t chip_id;
@@ -72,50 +167,174 @@ typedef struct {
     uint8_t region;
     uint8_t sequence;
     uint32_t space_available;
+
+    //! The average number of bytes read from the buffer region per time
+    //! step, with DRAIN_RATE_FRACTION_BITS fractional bits
+    uint32_t drain_rate;
 } req_packet_sdp_t;
 
+//! \brief A buffered-in stream of packets, which has its own buffer region,
+//!        sequence numbers and key space
+typedef struct {
+    //! The index of the stream, which is sent with its calendar entries
+    uint32_t index;
+
+    //! The region holding the buffer of the stream
+    uint32_t region_id;
+
+    bool apply_prefix;
+    bool check;
+    uint32_t prefix;
+    eieio_prefix_types prefix_type;
+    bool has_key;
+    uint32_t key_space;
+    uint32_t mask;
+    uint32_t buffer_region_size;
+    uint32_t space_before_data_request;
+
+    //! True if the host refills the buffer region by writing into it
+    //! directly, so that only the host moves the write pointer
+    bool direct_writes;
+
+    uint8_t *buffer_region;
+    uint8_t *end_of_buffer_region;
+    uint8_t *write_pointer;
+    uint8_t *read_pointer;
+    bool last_buffer_operation;
+
+    eieio_msg_t msg_from_sdram;
+    bool msg_from_sdram_in_use;
+    int msg_from_sdram_length;
+    uint32_t next_buffer_time;
+    uint8_t pkt_last_sequence_seen;
+    uint32_t last_space;
+    uint32_t last_request_tick;
+
+    //! The amount by which the space in the buffer region must drop below
+    //! space_before_data_request (i.e. be refilled) before another request
+    //! is sent when the space rises to space_before_data_request
+    uint32_t refill_hysteresis;
+
+    //! True if a request is to be sent as soon as the space in the buffer
+    //! region rises to space_before_data_request
+    bool refill_armed;
+
+    //! The number of bytes read from the buffer region since the drain rate
+    //! estimate was last updated
+    uint32_t refill_bytes_read;
+
+    //! The average number of bytes read from the buffer region per time
+    //! step, with DRAIN_RATE_FRACTION_BITS fractional bits
+    uint32_t drain_rate;
+
+    //! True once the stream has read an EVENT_STOP command
+    bool stopped;
+
+    //! The blocks that the buffer region is prefetched into; the data of the
+    //! block after prefetch_current follows on from that of prefetch_current
+    prefetch_block_t prefetch_blocks[N_PREFETCH_BLOCKS];
+    uint32_t prefetch_current;
+
+    //! True while a DMA into a prefetch block is in progress
+    bool prefetch_in_progress;
+
+    //! The block that the DMA in progress is filling
+    uint32_t prefetch_dma_block;
+
+    //! True if the data of the DMA in progress is to be thrown away
+    bool prefetch_discard;
+
+    //! True if the data of the DMA in progress has already been copied, as
+    //! it was needed before the DMA was complete
+    bool prefetch_overtaken;
+
+    //! The number of bytes at the read pointer to be skipped without being
+    //! fetched, as they are the rest of an EVENT_SKIP record
+    uint32_t prefetch_skip_bytes;
+} stream_t;
+
 // Globals
 static uint32_t time;
 static uint32_t simulation_ticks;
 static uint32_t infinite_run;
-static bool apply_prefix;
-static bool check;
-static uint32_t prefix;
-static bool has_key;
-static uint32_t key_space;
-static uint32_t mask;
 static uint32_t incorrect_keys;
 static uint32_t incorrect_packets;
 static uint32_t late_packets;
 static uint32_t last_stop_notification_request;
-static eieio_prefix_types prefix_type;
-static uint32_t buffer_region_size;
-static uint32_t space_before_data_request;
 
 //! keeps track of which types of recording should be done to this model.
 static uint32_t recording_flags = 0;
 
-static uint8_t *buffer_region;
-static uint8_t *end_of_buffer_region;
-static uint8_t *write_pointer;
-static uint8_t *read_pointer;
-
 sdp_msg_t req;
 req_packet_sdp_t *req_ptr;
-static eieio_msg_t msg_from_sdram;
-static bool msg_from_sdram_in_use;
-static int msg_from_sdram_length;
-static uint32_t next_buffer_time;
-static uint8_t pkt_last_sequence_seen;
 static bool send_packet_reqs;
-static bool last_buffer_operation;
 static uint8_t return_tag_id;
 static uint32_t buffered_in_sdp_port;
-static uint32_t last_space;
-static uint32_t last_request_tick;
 
+//! True once all of the streams that are buffered have stopped
 static bool stopped = false;
 
+//! The buffered-in streams; packets received live are handled with the key
+//! space of the first stream
+static stream_t *streams;
+static uint32_t n_streams;
+
+//! The stream serviced first in the next time step, which moves round so
+//! that no stream is always left until last
+static uint32_t next_stream;
+
+//! The pattern of keys to replay, which stays in SDRAM, or NULL if none
+static pattern_t *pattern;
+
+//! The keys of the pattern, which follow its index
+static uint32_t *pattern_keys;
+
+//! The calendar of packets to be sent in the next calendar_slots time steps,
+//! which follows the ring in the buffer region of the first stream.  Each
+//! time step has a slot of calendar_slot_size bytes, which holds the packets
+//! of the time step in the order that they arrive, each after the index of
+//! the stream it came from as a uint16_t.
+static uint8_t *calendar;
+static uint32_t calendar_slots;
+static uint32_t calendar_slot_size;
+
+//! The number of bytes used in each slot of the calendar
+static uint32_t *calendar_fill;
+
+//! A packet of the calendar being processed
+static eieio_msg_t msg_from_calendar;
+
+//! The multicast packets waiting to be sent, which are sent by
+//! transmit_queue_callback so that callbacks that parse events never wait for
+//! the router
+static transmit_entry_t *transmit_queue;
+static uint32_t transmit_queue_size;
+static volatile uint32_t transmit_queue_read;
+static volatile uint32_t transmit_queue_write;
+
+//! True if transmit_queue_callback has been triggered or scheduled, and is
+//! going to send the packets in the queue
+static bool transmitting;
+
+//! The rate at which the transmit queue is sent, in packets per microsecond
+//! with TRANSMIT_RATE_FRACTION_BITS fractional bits, or 0 to send as fast as
+//! the router accepts the packets
+static uint32_t transmit_rate;
+
+//! The packets that can be sent now without exceeding transmit_rate, with
+//! TRANSMIT_RATE_FRACTION_BITS fractional bits
+static uint32_t transmit_credit;
+
+//! The value of timer 2 up to which transmit_credit has been added
+static uint32_t transmit_credit_time;
+
+//! The number of packets dropped because the transmit queue was full
+static uint32_t transmit_queue_overflows;
+
+//! The number of packets with future timestamps dropped because they did
+//! not fit in the calendar and could not be kept in the buffer region
+static uint32_t future_packets_dropped;
+
 static inline uint16_t calculate_eieio_packet_command_size(
         eieio_msg_t eieio_msg_ptr) {
     uint16_t data_hdr_value = eieio_msg_ptr[0];
@@ -130,6 +349,8 @@ static inline uint16_t calculate_eieio_packet_command_size(
         return 2;
     case SPINNAKER_REQUEST_BUFFERS:
         return 12;
+    case SPINNAKER_REQUEST_REFILL:
+        return 16;
     case HOST_SEND_SEQUENCED_DATA:
 
         // does not include the EIEIO packet payload
@@ -138,6 +359,12 @@ static inline uint16_t calculate_eieio_packet_command_size(
         return 16;
     case HOST_DATA_READ:
         return 8;
+    case HOST_PUBLISH_WRITE_POINTER:
+        return 12;
+    case EVENT_SKIP:
+
+        // does not include the space skipped
+        return 8;
     default:
         return 0;
     }
@@ -230,37 +457,349 @@ static inline void signal_software_error(
 #endif
 }
 
-static inline uint32_t get_sdram_buffer_space_available() {
-    if (read_pointer < write_pointer) {
+static inline uint32_t get_sdram_buffer_space_available(stream_t *stream) {
+    if (stream->read_pointer < stream->write_pointer) {
         uint32_t final_space =
-            (uint32_t) end_of_buffer_region - (uint32_t) write_pointer;
+            (uint32_t) stream->end_of_buffer_region -
+            (uint32_t) stream->write_pointer;
         uint32_t initial_space =
-            (uint32_t) read_pointer - (uint32_t) buffer_region;
+            (uint32_t) stream->read_pointer - (uint32_t) stream->buffer_region;
         return final_space + initial_space;
-    } else if (write_pointer < read_pointer) {
-        return (uint32_t) read_pointer - (uint32_t) write_pointer;
-    } else if (last_buffer_operation == BUFFER_OPERATION_WRITE) {
+    } else if (stream->write_pointer < stream->read_pointer) {
+        return (uint32_t) stream->read_pointer -
+            (uint32_t) stream->write_pointer;
+    } else if (stream->last_buffer_operation == BUFFER_OPERATION_WRITE) {
 
         // If pointers are equal, buffer is full if last operation is write
         return 0;
     } else {
 
         // If pointers are equal, buffer is empty if last operation is read
-        return buffer_region_size;
+        return stream->buffer_region_size;
     }
 }
 
-static inline bool is_eieio_packet_in_buffer(void) {
+//! \brief Marks the data of a prefetch block as read from the buffer region
+//!        once it has been transferred, and makes the block ready to decode
+//! \param[in] stream The stream of the block
+//! \param[in] block The block that has been filled
+static inline void prefetch_filled(stream_t *stream, prefetch_block_t *block) {
+    stream->read_pointer += block->length;
+    if (stream->read_pointer >= stream->end_of_buffer_region) {
+        stream->read_pointer = stream->buffer_region;
+    }
+    stream->last_buffer_operation = BUFFER_OPERATION_READ;
+    stream->refill_bytes_read += block->length;
+    block->state = PREFETCH_READY;
+}
 
-    // If there is no buffering being done, there are no packets
-    if (buffer_region_size == 0) {
+//! \brief Fills a prefetch block with the data at the read pointer of the
+//!        buffer region, up to the write pointer or the end of the region.
+//!        Must be called with interrupts disabled.
+//! \param[in] stream The stream of the block
+//! \param[in] block_index The index of the block, which must be empty
+//! \param[in] use_dma True to fill the block by DMA if the DMA can be
+//!            queued, False to copy the data now
+//! \return True if the block is being filled, False if there is no data
+static bool prefetch_fill(
+        stream_t *stream, uint32_t block_index, bool use_dma) {
+    uint8_t *read_pointer = stream->read_pointer;
+    uint8_t *write_pointer = stream->write_pointer;
+    uint32_t length = 0;
+    if (write_pointer > read_pointer) {
+        length = write_pointer - read_pointer;
+    } else if ((write_pointer < read_pointer) ||
+            (stream->last_buffer_operation == BUFFER_OPERATION_WRITE)) {
+        length = stream->end_of_buffer_region - read_pointer;
+    }
+    if (length == 0) {
         return false;
     }
+    if (length > PREFETCH_BLOCK_SIZE) {
+        length = PREFETCH_BLOCK_SIZE;
+    }
 
-    // There are packets as long as the buffer is not empty; the buffer is
-    // empty if the pointers are equal and the last operation was read
-    return !((write_pointer == read_pointer) &&
-            (last_buffer_operation == BUFFER_OPERATION_READ));
+    // The DMA is of whole words, so round the data out to words
+    uint32_t start = (uint32_t) read_pointer & ~0x3;
+    uint32_t end = ((uint32_t) read_pointer + length + 3) & ~0x3;
+    prefetch_block_t *block = &stream->prefetch_blocks[block_index];
+    block->data = ((uint8_t *) block->words) + ((uint32_t) read_pointer & 0x3);
+    block->length = length;
+    block->consumed = 0;
+    if (use_dma && spin1_dma_transfer(
+            (stream->index * N_PREFETCH_BLOCKS) + block_index, (void *) start,
+            block->words, DMA_READ, end - start)) {
+        block->state = PREFETCH_FILLING;
+        stream->prefetch_in_progress = true;
+        stream->prefetch_dma_block = block_index;
+    } else {
+        spin1_memcpy(block->words, (void *) start, end - start);
+        prefetch_filled(stream, block);
+    }
+    return true;
+}
+
+//! \brief Starts a DMA to fill the next empty prefetch block from the buffer
+//!        region, if no other is in progress and there is data to fetch.
+//!        The data is marked as read from the buffer region once the DMA is
+//!        complete.  Each block of each stream has its own DMA tag.  If the
+//!        DMA queue is full, the block is copied directly instead, as an
+//!        empty block would be taken to be the end of the data.
+//! \param[in] stream The stream to prefetch the buffer region of
+static void prefetch_start(stream_t *stream) {
+    uint sr = spin1_int_disable();
+    if (stream->stopped || stream->prefetch_in_progress ||
+            (stream->buffer_region_size == 0)) {
+        spin1_mode_restore(sr);
+        return;
+    }
+
+    // Move the read pointer over any data to be skipped, which is never
+    // more than the data in the buffer region
+    uint8_t *read_pointer = stream->read_pointer;
+    uint8_t *write_pointer = stream->write_pointer;
+    while (stream->prefetch_skip_bytes > 0) {
+        uint32_t n_bytes = 0;
+        if (write_pointer > read_pointer) {
+            n_bytes = write_pointer - read_pointer;
+        } else if ((write_pointer < read_pointer) ||
+                (stream->last_buffer_operation == BUFFER_OPERATION_WRITE)) {
+            n_bytes = stream->end_of_buffer_region - read_pointer;
+        }
+        if (n_bytes == 0) {
+            break;
+        }
+        if (n_bytes > stream->prefetch_skip_bytes) {
+            n_bytes = stream->prefetch_skip_bytes;
+        }
+        read_pointer += n_bytes;
+        if (read_pointer >= stream->end_of_buffer_region) {
+            read_pointer = stream->buffer_region;
+        }
+        stream->read_pointer = read_pointer;
+        stream->last_buffer_operation = BUFFER_OPERATION_READ;
+        stream->prefetch_skip_bytes -= n_bytes;
+        stream->refill_bytes_read += n_bytes;
+    }
+
+    // Only the block after the current one can be filled if the current one
+    // has data, so that the data stays in order
+    uint32_t block_index = stream->prefetch_current;
+    if (stream->prefetch_blocks[block_index].state != PREFETCH_EMPTY) {
+        block_index = (block_index + 1) % N_PREFETCH_BLOCKS;
+        if (stream->prefetch_blocks[block_index].state != PREFETCH_EMPTY) {
+            spin1_mode_restore(sr);
+            return;
+        }
+    }
+
+    prefetch_fill(stream, block_index, true);
+    spin1_mode_restore(sr);
+}
+
+//! \brief Handles the completion of a DMA into a prefetch block, and starts
+//!        the next one
+//! \param[in] tag The tag of the DMA, which identifies the stream and block
+static void prefetch_done(uint32_t tag) {
+    uint32_t stream_index = tag / N_PREFETCH_BLOCKS;
+    uint32_t block_index = tag % N_PREFETCH_BLOCKS;
+    if (stream_index >= n_streams) {
+        log_error("DMA completed with unknown tag %u", tag);
+        return;
+    }
+    stream_t *stream = &streams[stream_index];
+    if (!stream->prefetch_in_progress ||
+            (stream->prefetch_dma_block != block_index)) {
+        log_error("DMA completed with tag %u of no prefetch", tag);
+        return;
+    }
+
+    prefetch_block_t *block = &stream->prefetch_blocks[block_index];
+    stream->prefetch_in_progress = false;
+    if (stream->prefetch_discard) {
+        stream->prefetch_discard = false;
+        stream->prefetch_overtaken = false;
+        block->state = PREFETCH_EMPTY;
+    } else if (stream->prefetch_overtaken) {
+        stream->prefetch_overtaken = false;
+    } else {
+        prefetch_filled(stream, block);
+    }
+    prefetch_start(stream);
+}
+
+//! \brief Makes the data needed next available without waiting for the DMA
+//!        in progress, so that the timer callback never waits for a DMA.
+//!        If the DMA is fetching the data needed, its data is copied now and
+//!        the DMA goes on to write the same data.  Otherwise the data of the
+//!        DMA is not needed (it is to be thrown away, or has already been
+//!        copied), so the data needed is copied into the other block, and
+//!        the block of the DMA is left alone until the DMA is complete.
+//!        Must be called with interrupts disabled.
+//! \param[in] stream The stream to get the data of
+//! \return True if the current block now has data, False if there is no
+//!         more data in the buffer region
+static bool prefetch_overtake(stream_t *stream) {
+    uint32_t dma_block = stream->prefetch_dma_block;
+    if (!stream->prefetch_discard && !stream->prefetch_overtaken) {
+
+        // The DMA is fetching the data at the read pointer, which only moves
+        // once the data has been read
+        prefetch_block_t *block = &stream->prefetch_blocks[dma_block];
+        uint32_t start = (uint32_t) stream->read_pointer & ~0x3;
+        uint32_t end =
+            ((uint32_t) stream->read_pointer + block->length + 3) & ~0x3;
+        spin1_memcpy(block->words, (void *) start, end - start);
+        prefetch_filled(stream, block);
+        stream->prefetch_overtaken = true;
+        stream->prefetch_current = dma_block;
+        return true;
+    }
+
+    uint32_t current = stream->prefetch_current;
+    if (current == dma_block) {
+        current = (current + 1) % N_PREFETCH_BLOCKS;
+        stream->prefetch_current = current;
+    }
+    return prefetch_fill(stream, current, false);
+}
+
+//! \brief Throws away all prefetched data, including any being transferred
+//! \param[in] stream The stream to throw away the data of
+static void prefetch_reset(stream_t *stream) {
+    uint sr = spin1_int_disable();
+    for (uint32_t i = 0; i < N_PREFETCH_BLOCKS; i++) {
+        if (stream->prefetch_blocks[i].state == PREFETCH_READY) {
+            stream->prefetch_blocks[i].state = PREFETCH_EMPTY;
+        }
+    }
+    stream->prefetch_discard = stream->prefetch_in_progress;
+    stream->prefetch_current = 0;
+    stream->prefetch_skip_bytes = 0;
+    spin1_mode_restore(sr);
+}
+
+//! \brief Skips over data in the buffer region without decoding it.  Data
+//!        that has been prefetched (or is being prefetched) is marked as
+//!        consumed, and the read pointer is moved over the rest without it
+//!        being fetched.
+//! \param[in] stream The stream to skip the data of
+//! \param[in] n_bytes The number of bytes to skip
+static void prefetch_skip(stream_t *stream, uint32_t n_bytes) {
+    uint sr = spin1_int_disable();
+    for (uint32_t i = 0; (i < N_PREFETCH_BLOCKS) && (n_bytes > 0); i++) {
+        prefetch_block_t *block = &stream->prefetch_blocks[
+            (stream->prefetch_current + i) % N_PREFETCH_BLOCKS];
+        if (block->state == PREFETCH_EMPTY) {
+            break;
+        }
+        uint32_t block_bytes = block->length - block->consumed;
+        if (block_bytes > n_bytes) {
+            block_bytes = n_bytes;
+        }
+        block->consumed += block_bytes;
+        n_bytes -= block_bytes;
+    }
+    stream->prefetch_skip_bytes += n_bytes;
+    spin1_mode_restore(sr);
+
+    prefetch_start(stream);
+}
+
+//! \brief Gets the prefetch block holding the next data to be decoded,
+//!        copying the data now if it is still being transferred.  A block
+//!        that has been completely decoded is only released here, so that
+//!        the last packet returned from it can be used until the next packet
+//!        is requested.
+//! \param[in] stream The stream to get the block of
+//! \return The block, or NULL if there is no more data in the buffer region
+static prefetch_block_t *prefetch_get_block(stream_t *stream) {
+    uint sr = spin1_int_disable();
+    prefetch_block_t *block =
+        &stream->prefetch_blocks[stream->prefetch_current];
+    if ((block->state == PREFETCH_READY) &&
+            (block->consumed == block->length)) {
+        block->state = PREFETCH_EMPTY;
+        uint32_t next = (stream->prefetch_current + 1) % N_PREFETCH_BLOCKS;
+        if (stream->prefetch_blocks[next].state != PREFETCH_EMPTY) {
+            stream->prefetch_current = next;
+            block = &stream->prefetch_blocks[next];
+        }
+    }
+    spin1_mode_restore(sr);
+
+    // Refill the released block while this one is decoded
+    prefetch_start(stream);
+
+    // The block is only empty at the end of the data if no DMA is in
+    // progress; otherwise the data is taken without waiting for the DMA
+    sr = spin1_int_disable();
+    if (block->state != PREFETCH_READY) {
+        if (stream->prefetch_in_progress && prefetch_overtake(stream)) {
+            block = &stream->prefetch_blocks[stream->prefetch_current];
+        } else {
+            block = NULL;
+        }
+    }
+    spin1_mode_restore(sr);
+    return block;
+}
+
+//! \brief Gets the next packet from the buffer region.  The packet is
+//!        decoded where it is in the prefetch block if it can be, or is
+//!        copied to the msg_from_sdram of the stream if it is split between
+//!        blocks, such as when it is split by the end of the buffer region.
+//! \param[in] stream The stream to get the packet from
+//! \param[out] packet The packet
+//! \param[out] length The length of the packet in bytes
+//! \return True if there was a packet, False otherwise
+static bool prefetch_next_packet(
+        stream_t *stream, eieio_msg_t *packet, uint32_t *length) {
+    prefetch_block_t *block = prefetch_get_block(stream);
+    if (block == NULL) {
+        return false;
+    }
+
+    eieio_msg_t msg = (eieio_msg_t) &block->data[block->consumed];
+    uint32_t len = calculate_eieio_packet_size(msg);
+    if (len == 0) {
+        return false;
+    }
+    if (len > MAX_PACKET_SIZE) {
+        log_error("Packet from SDRAM of %u bytes is too big!", len);
+        rt_error(RTE_SWERR);
+    }
+    log_debug("packet with length %d, from address: %08x", len,
+              (uint32_t) msg);
+
+    if ((block->length - block->consumed) >= len) {
+        block->consumed += len;
+        *packet = msg;
+        *length = len;
+        return true;
+    }
+
+    log_debug("split packet");
+    uint8_t *dst_ptr = (uint8_t *) stream->msg_from_sdram;
+    uint32_t remaining_len = len;
+    while (remaining_len > 0) {
+        block = prefetch_get_block(stream);
+        if (block == NULL) {
+            log_debug("packet incomplete when the buffer was emptied");
+            return false;
+        }
+        uint32_t n_bytes = block->length - block->consumed;
+        if (n_bytes > remaining_len) {
+            n_bytes = remaining_len;
+        }
+        spin1_memcpy(dst_ptr, &block->data[block->consumed], n_bytes);
+        block->consumed += n_bytes;
+        dst_ptr += n_bytes;
+        remaining_len -= n_bytes;
+    }
+    *packet = stream->msg_from_sdram;
+    *length = len;
+    return true;
 }
 
 static inline uint32_t extract_time_from_eieio_msg(eieio_msg_t eieio_msg_ptr) {
@@ -330,16 +869,20 @@ static inline uint32_t extract_time_from_eieio_msg(eieio_msg_t eieio_msg_ptr) {
 }
 
 static inline bool add_eieio_packet_to_sdram(
-        eieio_msg_t eieio_msg_ptr, uint32_t length) {
+        stream_t *stream, eieio_msg_t eieio_msg_ptr, uint32_t length) {
     uint8_t *msg_ptr = (uint8_t *) eieio_msg_ptr;
+    uint8_t *buffer_region = stream->buffer_region;
+    uint8_t *end_of_buffer_region = stream->end_of_buffer_region;
+    uint8_t *read_pointer = stream->read_pointer;
+    uint8_t *write_pointer = stream->write_pointer;
 
     log_debug("read_pointer = 0x%.8x, write_pointer= = 0x%.8x,"
               "last_buffer_operation == read = %d, packet length = %d",
               read_pointer,  write_pointer,
-              last_buffer_operation == BUFFER_OPERATION_READ, length);
+              stream->last_buffer_operation == BUFFER_OPERATION_READ, length);
     if ((read_pointer < write_pointer) ||
             (read_pointer == write_pointer &&
-                last_buffer_operation == BUFFER_OPERATION_READ)) {
+                stream->last_buffer_operation == BUFFER_OPERATION_READ)) {
         uint32_t final_space =
             (uint32_t) end_of_buffer_region - (uint32_t) write_pointer;
 
@@ -348,11 +891,9 @@ static inline bool add_eieio_packet_to_sdram(
 
             spin1_memcpy(write_pointer, msg_ptr, length);
             write_pointer += length;
-            last_buffer_operation = BUFFER_OPERATION_WRITE;
             if (write_pointer >= end_of_buffer_region) {
                 write_pointer = buffer_region;
             }
-            return true;
         } else {
 
             uint32_t total_space =
@@ -373,11 +914,9 @@ static inline bool add_eieio_packet_to_sdram(
             log_debug("Copying remaining %d bytes", final_len);
             spin1_memcpy(write_pointer, msg_ptr, final_len);
             write_pointer += final_len;
-            last_buffer_operation = BUFFER_OPERATION_WRITE;
             if (write_pointer == end_of_buffer_region) {
                 write_pointer = buffer_region;
             }
-            return true;
         }
     } else if (write_pointer < read_pointer) {
         uint32_t middle_space =
@@ -386,132 +925,256 @@ static inline bool add_eieio_packet_to_sdram(
         if (middle_space < length) {
             log_debug("Not enough space in middle (%d bytes)", middle_space);
             return false;
-        } else {
-            log_debug("Packet fits in middle space of %d", middle_space);
-            spin1_memcpy(write_pointer, msg_ptr, length);
-            write_pointer += length;
-            last_buffer_operation = BUFFER_OPERATION_WRITE;
-            if (write_pointer == end_of_buffer_region) {
-                write_pointer = buffer_region;
-            }
-            return true;
         }
+        log_debug("Packet fits in middle space of %d", middle_space);
+        spin1_memcpy(write_pointer, msg_ptr, length);
+        write_pointer += length;
+        if (write_pointer == end_of_buffer_region) {
+            write_pointer = buffer_region;
+        }
+    } else {
+        log_debug("Buffer already full");
+        return false;
     }
 
-    log_debug("Buffer already full");
-    return false;
+    stream->write_pointer = write_pointer;
+    stream->last_buffer_operation = BUFFER_OPERATION_WRITE;
+    return true;
 }
 
-static inline void process_16_bit_packets(
-        void* event_pointer, bool pkt_prefix_upper, uint32_t pkt_count,
-        uint32_t pkt_key_prefix, uint32_t pkt_payload_prefix,
-        bool pkt_has_payload, bool pkt_payload_is_timestamp) {
+//! \brief Adds a multicast packet to the transmit queue, starting the sending
+//!        of the queue if needed.  This can be called at any priority.
+//! \param[in] key The key of the packet
+//! \param[in] payload The payload of the packet
+//! \param[in] with_payload WITH_PAYLOAD if the payload is to be sent,
+//!            NO_PAYLOAD otherwise
+static inline void transmit_queue_add(
+        uint32_t key, uint32_t payload, uint32_t with_payload) {
+    uint sr = spin1_int_disable();
+    uint32_t next_write = transmit_queue_write + 1;
+    if (next_write == transmit_queue_size) {
+        next_write = 0;
+    }
+    if (next_write == transmit_queue_read) {
+        transmit_queue_overflows++;
+        spin1_mode_restore(sr);
+        return;
+    }
 
-    log_debug("process_16_bit_packets");
-    log_debug("event_pointer: %08x", (uint32_t) event_pointer);
-    log_debug("count: %d", pkt_count);
-    log_debug("pkt_prefix: %08x", pkt_key_prefix);
-    log_debug("pkt_payload_prefix: %08x", pkt_payload_prefix);
-    log_debug("payload on: %d", pkt_has_payload);
-    log_debug("pkt_format: %d", pkt_prefix_upper);
+    transmit_entry_t *entry = &transmit_queue[transmit_queue_write];
+    entry->key = key;
+    entry->payload = payload;
+    entry->with_payload = with_payload;
+    transmit_queue_write = next_write;
 
-    uint16_t *next_event = (uint16_t *) event_pointer;
-    for (uint32_t i = 0; i < pkt_count; i++) {
-        uint32_t key = (uint32_t) next_event[0];
-        log_debug("Packet key = %d", key);
-        next_event += 1;
-        uint32_t payload = 0;
-        if (pkt_has_payload) {
-            payload = (uint32_t) next_event[0];
-            next_event += 1;
-        }
+    if (!transmitting) {
+        transmitting = true;
+        spin1_trigger_user_event(0, 0);
+    }
+    spin1_mode_restore(sr);
+}
 
-        if (!pkt_prefix_upper) {
-            key <<= 16;
-        }
-        key |= pkt_key_prefix;
-        payload |= pkt_payload_prefix;
-
-        log_debug(
-            "check before send packet: check=%d, key=0x%08x, mask=0x%08x,"
-            " key_space=%d: %d", check, key, mask, key_space,
-            (!check) || (check && ((key & mask) == key_space)));
-
-        if (has_key) {
-            if (!check || (check && ((key & mask) == key_space))) {
-                if (pkt_has_payload && !pkt_payload_is_timestamp) {
-                    log_debug(
-                        "mc packet 16-bit key=%d, payload=%d", key, payload);
-                    while (!spin1_send_mc_packet(key, payload, WITH_PAYLOAD)) {
-                        spin1_delay_us(1);
-                    }
-                } else {
-                    log_debug(
-                        "mc packet 16-bit key=%d", key);
-                    while (!spin1_send_mc_packet(key, 0, NO_PAYLOAD)) {
-                        spin1_delay_us(1);
-                    }
-                }
-            } else {
-                incorrect_keys++;
-            }
+//! \brief Adds the credit for the whole microseconds that have passed since
+//!        the credit was last added
+static inline void transmit_credit_add(void) {
+    uint32_t now = tc[T2_COUNT];
+
+    // Timer 2 counts down, and the difference is right when it wraps
+    uint32_t us = (transmit_credit_time - now) / sv->cpu_clk;
+    if (us >= TRANSMIT_BURST_US) {
+        transmit_credit = transmit_rate * TRANSMIT_BURST_US;
+        transmit_credit_time = now;
+    } else if (us > 0) {
+        transmit_credit += transmit_rate * us;
+        if (transmit_credit > transmit_rate * TRANSMIT_BURST_US) {
+            transmit_credit = transmit_rate * TRANSMIT_BURST_US;
         }
+        transmit_credit_time -= us * sv->cpu_clk;
     }
 }
 
-static inline void process_32_bit_packets(
-        void* event_pointer, uint32_t pkt_count,
-        uint32_t pkt_key_prefix, uint32_t pkt_payload_prefix,
-        bool pkt_has_payload, bool pkt_payload_is_timestamp) {
+//! \brief Sends the packets in the transmit queue at no more than
+//!        transmit_rate.  This runs at a lower priority than the timer, so
+//!        that it never holds up a time step.  When packets are left in the
+//!        queue, because the rate has been reached or the router is busy,
+//!        the callback schedules itself again to carry on once the callbacks
+//!        queued before it have run.
+void transmit_queue_callback(uint unused0, uint unused1) {
+    use(unused0);
+    use(unused1);
 
-    log_debug("process_32_bit_packets");
-    log_debug("event_pointer: %08x", (uint32_t) event_pointer);
-    log_debug("count: %d", pkt_count);
-    log_debug("pkt_prefix: %08x", pkt_key_prefix);
-    log_debug("pkt_payload_prefix: %08x", pkt_payload_prefix);
-    log_debug("payload on: %d", pkt_has_payload);
-
-    uint16_t *next_event = (uint16_t *) event_pointer;
-    for (uint32_t i = 0; i < pkt_count; i++) {
-        uint32_t key = (next_event[1] << 16) | next_event[0];
-        log_debug("Packet key = 0x%08x", key);
-        next_event += 2;
-        uint32_t payload = 0;
-        if (pkt_has_payload) {
-            payload = (next_event[1] << 16) | next_event[0];
-            next_event += 2;
+    if (transmit_rate != 0) {
+        transmit_credit_add();
+    }
+    while (transmit_queue_read != transmit_queue_write) {
+        if ((transmit_rate != 0) &&
+                (transmit_credit < (1 << TRANSMIT_RATE_FRACTION_BITS))) {
+            break;
+        }
+        transmit_entry_t *entry = &transmit_queue[transmit_queue_read];
+        if (!spin1_send_mc_packet(
+                entry->key, entry->payload, entry->with_payload)) {
+            break;
+        }
+        if (transmit_rate != 0) {
+            transmit_credit -= 1 << TRANSMIT_RATE_FRACTION_BITS;
         }
 
-        key |= pkt_key_prefix;
-        payload |= pkt_payload_prefix;
-
-        log_debug("check before send packet: %d",
-                  (!check) || (check && ((key & mask) == key_space)));
-
-        if (has_key) {
-            if (!check || (check && ((key & mask) == key_space))) {
-                if (pkt_has_payload && !pkt_payload_is_timestamp) {
-                    log_debug(
-                        "mc packet 32-bit key=0x%08x , payload=0x%08x",
-                        key, payload);
-                    while (!spin1_send_mc_packet(key, payload, WITH_PAYLOAD)) {
-                        spin1_delay_us(1);
-                    }
-                } else {
-                    log_debug("mc packet 32-bit key=0x%08x", key);
-                    while (!spin1_send_mc_packet(key, 0, NO_PAYLOAD)) {
-                        spin1_delay_us(1);
-                    }
-                }
-            } else {
-                incorrect_keys++;
-            }
+        uint32_t next_read = transmit_queue_read + 1;
+        if (next_read == transmit_queue_size) {
+            next_read = 0;
         }
+        transmit_queue_read = next_read;
+    }
+
+    // Carry on with the packets left, including any queued after the queue
+    // was found to be empty, which did not start a callback of their own.
+    // If the callback can't be scheduled, the next timer tick restarts it.
+    uint sr = spin1_int_disable();
+    if ((transmit_queue_read == transmit_queue_write) ||
+            !spin1_schedule_callback(
+                transmit_queue_callback, 0, 0, TRANSMIT)) {
+        transmitting = false;
     }
+    spin1_mode_restore(sr);
+}
+
+//! \brief Restarts the sending of the transmit queue if there are packets
+//!        left in it that are not going to be sent, because the callback
+//!        could not be scheduled.  Called at each timer tick.
+static inline void transmit_queue_resume(void) {
+    uint sr = spin1_int_disable();
+    if (!transmitting && (transmit_queue_read != transmit_queue_write)) {
+        transmitting = true;
+        spin1_trigger_user_event(0, 0);
+    }
+    spin1_mode_restore(sr);
+}
+
+//! How the payloads of the events of a packet are handled
+typedef enum payload_modes {
+    PAYLOAD_NONE, PAYLOAD_SENT, PAYLOAD_SKIPPED, N_PAYLOAD_MODES
+} payload_modes;
+
+//! \brief A function that decodes the events of a packet of one format and
+//!        queues them to be sent
+//! \param[in] stream The stream whose key space the keys are checked against
+//! \param[in] event The first event of the packet
+//! \param[in] count The number of events in the packet
+//! \param[in] key_prefix The prefix to add to each key
+//! \param[in] payload_prefix The prefix to add to each payload
+typedef void (*event_kernel_t)(
+    const stream_t *stream, const uint16_t *event, uint32_t count,
+    uint32_t key_prefix, uint32_t payload_prefix);
+
+//! Reads a 16-bit key or payload, and moves on to the next half-word
+#define READ_16(event) ((uint32_t) *(event)++)
+
+//! Reads a 32-bit key or payload, and moves on past it
+#define READ_32(event) \
+    ((event) += 2, ((uint32_t) (event)[-1] << 16) | (uint32_t) (event)[-2])
+
+//! \brief Defines an event kernel.  The format is fixed by the arguments, so
+//!        the compiler removes the tests of the format from the loop.
+//! \param[in] name The name of the kernel
+//! \param[in] read READ_16 or READ_32
+//! \param[in] shift The number of bits to shift each key up by
+//! \param[in] payload_mode How the payloads are handled
+//! \param[in] checked Whether the keys are to be checked against the mask
+#define EVENT_KERNEL(name, read, shift, payload_mode, checked)              \
+    static void name(                                                       \
+            const stream_t *stream, const uint16_t *event, uint32_t count,  \
+            uint32_t key_prefix, uint32_t payload_prefix) {                 \
+        uint32_t mask = stream->mask;                                       \
+        uint32_t key_space = stream->key_space;                             \
+        for (uint32_t i = count; i > 0; i--) {                              \
+            uint32_t key = (read(event) << (shift)) | key_prefix;           \
+            uint32_t payload = payload_prefix;                              \
+            if ((payload_mode) != PAYLOAD_NONE) {                           \
+                payload |= read(event);                                     \
+            }                                                               \
+            if ((checked) && ((key & mask) != key_space)) {                 \
+                incorrect_keys++;                                           \
+                continue;                                                   \
+            }                                                               \
+            if ((payload_mode) == PAYLOAD_SENT) {                           \
+                transmit_queue_add(key, payload, WITH_PAYLOAD);             \
+            } else {                                                        \
+                transmit_queue_add(key, 0, NO_PAYLOAD);                     \
+            }                                                               \
+        }                                                                   \
+    }
+
+//! Defines the event kernels of each payload mode and key check of a key
+//! size and shift
+#define EVENT_KERNELS(name, read, shift)                                    \
+    EVENT_KERNEL(name##_none, read, shift, PAYLOAD_NONE, false)             \
+    EVENT_KERNEL(name##_none_checked, read, shift, PAYLOAD_NONE, true)      \
+    EVENT_KERNEL(name##_sent, read, shift, PAYLOAD_SENT, false)             \
+    EVENT_KERNEL(name##_sent_checked, read, shift, PAYLOAD_SENT, true)      \
+    EVENT_KERNEL(name##_skipped, read, shift, PAYLOAD_SKIPPED, false)       \
+    EVENT_KERNEL(name##_skipped_checked, read, shift, PAYLOAD_SKIPPED, true)
+
+//! The entries of event_kernels for the kernels defined by EVENT_KERNELS
+#define EVENT_KERNEL_ENTRIES(name)                                          \
+    {                                                                       \
+        {name##_none, name##_none_checked},                                 \
+        {name##_sent, name##_sent_checked},                                 \
+        {name##_skipped, name##_skipped_checked}                            \
+    }
+
+// 16-bit keys go in the upper half-word when the prefix is in the lower one
+EVENT_KERNELS(events_16_lower_prefix, READ_16, 16)
+EVENT_KERNELS(events_16_upper_prefix, READ_16, 0)
+EVENT_KERNELS(events_32, READ_32, 0)
+
+//! \brief The event kernels, indexed by whether the keys are 32-bit, whether
+//!        the prefix is in the upper half-word, the payload mode and whether
+//!        the keys are checked
+static const event_kernel_t event_kernels[2][2][N_PAYLOAD_MODES][2] = {
+    {
+        EVENT_KERNEL_ENTRIES(events_16_lower_prefix),
+        EVENT_KERNEL_ENTRIES(events_16_upper_prefix)
+    },
+    {
+        EVENT_KERNEL_ENTRIES(events_32),
+        EVENT_KERNEL_ENTRIES(events_32)
+    }
+};
+
+//! \brief Adds a packet to the calendar slot of the time step at which it is
+//!        to be sent, so that it doesn't hold up the packets of earlier time
+//!        steps.  This can be called at any priority.
+//! \param[in] stream The stream that the packet is from
+//! \param[in] eieio_msg_ptr The packet
+//! \param[in] length The length of the packet in bytes
+//! \param[in] packet_time The time step at which the packet is to be sent
+//! \return True if the packet was added, False if the time step is not
+//!         covered by the calendar or its slot is full
+static inline bool calendar_add(
+        const stream_t *stream, eieio_msg_t eieio_msg_ptr, uint32_t length,
+        uint32_t packet_time) {
+    if ((packet_time <= time) || ((packet_time - time) >= calendar_slots)) {
+        return false;
+    }
+
+    uint32_t slot = packet_time % calendar_slots;
+    uint sr = spin1_int_disable();
+    uint32_t fill = calendar_fill[slot];
+    if ((fill + sizeof(uint16_t) + length) > calendar_slot_size) {
+        spin1_mode_restore(sr);
+        return false;
+    }
+    uint8_t *entry = &calendar[(slot * calendar_slot_size) + fill];
+    *((uint16_t *) entry) = stream->index;
+    spin1_memcpy(&entry[sizeof(uint16_t)], eieio_msg_ptr, length);
+    calendar_fill[slot] = fill + sizeof(uint16_t) + length;
+    spin1_mode_restore(sr);
+    return true;
 }
 
 static inline bool eieio_data_parse_packet(
-        eieio_msg_t eieio_msg_ptr, uint32_t length) {
+        stream_t *stream, eieio_msg_t eieio_msg_ptr, uint32_t length) {
     log_debug("eieio_data_process_data_packet");
     print_packet_bytes(eieio_msg_ptr, length);
 
@@ -561,12 +1224,12 @@ static inline bool eieio_data_parse_packet(
         if (pkt_prefix_upper) {
             pkt_key_prefix <<= 16;
         }
-    } else if (!pkt_apply_prefix && apply_prefix) {
+    } else if (!pkt_apply_prefix && stream->apply_prefix) {
 
         // If there isn't a key prefix, but the config applies a prefix,
         // apply the prefix depending on the key_left_shift
-        pkt_key_prefix = prefix;
-        if (prefix_type == PREFIX_TYPE_UPPER_HALF_WORD) {
+        pkt_key_prefix = stream->prefix;
+        if (stream->prefix_type == PREFIX_TYPE_UPPER_HALF_WORD) {
             pkt_prefix_upper = true;
         } else {
             pkt_prefix_upper = false;
@@ -598,32 +1261,41 @@ static inline bool eieio_data_parse_packet(
     if (pkt_has_payload && pkt_payload_is_timestamp &&
             pkt_payload_prefix != time) {
         if (pkt_payload_prefix > time) {
-            add_eieio_packet_to_sdram(eieio_msg_ptr, length);
+
+            // A packet that doesn't fit in the calendar is kept in the
+            // buffer region, unless the host is writing into the region
+            // directly, as it must be the only writer of the region then
+            if (!calendar_add(
+                        stream, eieio_msg_ptr, length, pkt_payload_prefix) &&
+                    (stream->direct_writes ||
+                        !add_eieio_packet_to_sdram(
+                            stream, eieio_msg_ptr, length))) {
+                future_packets_dropped++;
+            }
             return true;
         }
         late_packets += 1;
         return false;
     }
 
-    if (pkt_type <= 1) {
-        process_16_bit_packets(
-            event_pointer, pkt_prefix_upper, pkt_count, pkt_key_prefix,
-            pkt_payload_prefix, pkt_has_payload, pkt_payload_is_timestamp);
-        if (recording_flags > 0) {
-            log_debug("recording a eieio message with length %u", length);
-            recording_record(SPIKE_HISTORY_CHANNEL, eieio_msg_ptr, length);
-        }
-        return true;
-    } else {
-        process_32_bit_packets(
-            event_pointer, pkt_count, pkt_key_prefix,
-            pkt_payload_prefix, pkt_has_payload, pkt_payload_is_timestamp);
-        if (recording_flags > 0) {
-            log_debug("recording a eieio message with length %u", length);
-            recording_record(SPIKE_HISTORY_CHANNEL, eieio_msg_ptr, length);
+    // Decode the events with the kernel for the format of the packet
+    if (stream->has_key) {
+        uint32_t payload_mode = PAYLOAD_NONE;
+        if (pkt_has_payload) {
+            payload_mode = pkt_payload_is_timestamp ?
+                PAYLOAD_SKIPPED : PAYLOAD_SENT;
         }
-        return false;
+        event_kernel_t kernel = event_kernels[pkt_type >> 1]
+            [pkt_prefix_upper][payload_mode][stream->check];
+        kernel(stream, (uint16_t *) event_pointer, pkt_count, pkt_key_prefix,
+               pkt_payload_prefix);
     }
+
+    if (recording_flags > 0) {
+        log_debug("recording a eieio message with length %u", length);
+        recording_record(SPIKE_HISTORY_CHANNEL, eieio_msg_ptr, length);
+    }
+    return true;
 }
 
 static inline void eieio_command_parse_stop_requests(
@@ -643,21 +1315,36 @@ static inline void eieio_command_parse_start_requests(
     send_packet_reqs = true;
 }
 
+//! \brief Finds the stream that has its buffer in a region
+//! \param[in] region_id The region
+//! \return The stream, or NULL if no stream has its buffer in the region
+static inline stream_t *stream_of_region(uint32_t region_id) {
+    for (uint32_t i = 0; i < n_streams; i++) {
+        if ((streams[i].region_id == region_id) &&
+                (streams[i].buffer_region_size > 0)) {
+            return &streams[i];
+        }
+    }
+    return NULL;
+}
+
 static inline void eieio_command_parse_sequenced_data(
         eieio_msg_t eieio_msg_ptr, uint16_t length) {
     uint16_t sequence_value_region_id = eieio_msg_ptr[1];
     uint16_t region_id = sequence_value_region_id & 0xFF;
     uint16_t sequence_value = (sequence_value_region_id >> 8) & 0xFF;
-    uint8_t next_expected_sequence_no =
-        (pkt_last_sequence_seen + 1) & MAX_SEQUENCE_NO;
     eieio_msg_t eieio_content_pkt = &eieio_msg_ptr[2];
 
-    if (region_id != BUFFER_REGION) {
+    stream_t *stream = stream_of_region(region_id);
+    if (stream == NULL) {
         log_debug("received sequenced eieio packet with invalid region id:"
                   " %d.", region_id);
         signal_software_error(eieio_msg_ptr, length);
         incorrect_packets++;
+        return;
     }
+    uint8_t next_expected_sequence_no =
+        (stream->pkt_last_sequence_seen + 1) & MAX_SEQUENCE_NO;
 
     log_debug("Received packet sequence number: %d", sequence_value);
 
@@ -666,14 +1353,17 @@ static inline void eieio_command_parse_sequenced_data(
         // parse_event_pkt returns false in case there is an error and the
         // packet is dropped (i.e. as it was never received)
         log_debug("add_eieio_packet_to_sdram");
-        bool ret_value = add_eieio_packet_to_sdram(eieio_content_pkt,
-                                                   length - 4);
+        bool ret_value = add_eieio_packet_to_sdram(
+            stream, eieio_content_pkt, length - 4);
         log_debug("add_eieio_packet_to_sdram return value: %d", ret_value);
 
         if (ret_value) {
-            pkt_last_sequence_seen = sequence_value;
+            stream->pkt_last_sequence_seen = sequence_value;
             log_debug("Updating last sequence seen to %d",
-                pkt_last_sequence_seen);
+                stream->pkt_last_sequence_seen);
+
+            // Start prefetching the data before it is needed
+            prefetch_start(stream);
         } else {
             log_debug("unable to buffer sequenced data packet.");
             signal_software_error(eieio_msg_ptr, length);
@@ -682,8 +1372,124 @@ static inline void eieio_command_parse_sequenced_data(
     }
 }
 
-static inline bool eieio_commmand_parse_packet(eieio_msg_t eieio_msg_ptr,
-                                               uint16_t length) {
+//! \brief Accepts data that the host has written directly into the free
+//!        space of the buffer region of a stream, starting at the write
+//!        pointer, by advancing the write pointer over it.  The command is
+//!        { uint16_t command; uint16_t (sequence << 8) | region;
+//!          uint32_t write_offset; uint32_t n_bytes }, where write_offset is
+//!        the offset of the write pointer in the buffer region that the host
+//!        expects; it is sequenced with HOST_SEND_SEQUENCED_DATA, so a repeat
+//!        of a command that has already been accepted is ignored.
+static inline void eieio_command_parse_publish_write_pointer(
+        eieio_msg_t eieio_msg_ptr, uint16_t length) {
+    uint16_t sequence_value_region_id = eieio_msg_ptr[1];
+    uint16_t region_id = sequence_value_region_id & 0xFF;
+    uint16_t sequence_value = (sequence_value_region_id >> 8) & 0xFF;
+    uint32_t write_offset =
+        eieio_msg_ptr[2] | (((uint32_t) eieio_msg_ptr[3]) << 16);
+    uint32_t n_bytes =
+        eieio_msg_ptr[4] | (((uint32_t) eieio_msg_ptr[5]) << 16);
+
+    stream_t *stream = stream_of_region(region_id);
+    if (stream == NULL) {
+        log_debug("Published data for invalid region id %d", region_id);
+        signal_software_error(eieio_msg_ptr, length);
+        incorrect_packets++;
+        return;
+    }
+
+    uint8_t next_expected_sequence_no =
+        (stream->pkt_last_sequence_seen + 1) & MAX_SEQUENCE_NO;
+    if (sequence_value != next_expected_sequence_no) {
+        log_debug("Ignoring published data with sequence number %d",
+                  sequence_value);
+        return;
+    }
+
+    // The data must follow on from the write pointer and fit in the space
+    if ((write_offset !=
+                (uint32_t) stream->write_pointer -
+                (uint32_t) stream->buffer_region) ||
+            (n_bytes > get_sdram_buffer_space_available(stream))) {
+        log_debug("Published data of %d bytes at offset %d does not fit",
+                  n_bytes, write_offset);
+        signal_software_error(eieio_msg_ptr, length);
+        incorrect_packets++;
+        return;
+    }
+
+    if (n_bytes > 0) {
+        stream->write_pointer += n_bytes;
+        if (stream->write_pointer >= stream->end_of_buffer_region) {
+            stream->write_pointer -= stream->buffer_region_size;
+        }
+        stream->last_buffer_operation = BUFFER_OPERATION_WRITE;
+    }
+    stream->pkt_last_sequence_seen = sequence_value;
+    log_debug("Updating last sequence seen to %d",
+              stream->pkt_last_sequence_seen);
+
+    // Start prefetching the data before it is needed
+    prefetch_start(stream);
+}
+
+//! \brief Throws away all the packets in the calendar
+static inline void calendar_reset(void) {
+    for (uint32_t i = 0; i < calendar_slots; i++) {
+        calendar_fill[i] = 0;
+    }
+}
+
+//! \brief Sends the packets in the calendar slot of the current time step,
+//!        and empties the slot
+static inline void calendar_process(void) {
+    if (calendar_slots == 0) {
+        return;
+    }
+
+    uint32_t slot = time % calendar_slots;
+    uint8_t *slot_data = &calendar[slot * calendar_slot_size];
+    uint32_t offset = 0;
+    while (offset < calendar_fill[slot]) {
+        uint32_t stream_index = *((uint16_t *) &slot_data[offset]);
+        offset += sizeof(uint16_t);
+        uint32_t len = calculate_eieio_packet_size(
+            (eieio_msg_t) &slot_data[offset]);
+        if (len == 0) {
+            break;
+        }
+        spin1_memcpy(msg_from_calendar, &slot_data[offset], len);
+        eieio_data_parse_packet(&streams[stream_index], msg_from_calendar, len);
+        offset += len;
+    }
+    calendar_fill[slot] = 0;
+}
+
+//! \brief Stops a stream that has read an EVENT_STOP command, and stops the
+//!        core once every stream that is buffered has stopped
+//! \param[in] stream The stream to stop
+static inline void stream_stop(stream_t *stream) {
+    stream->stopped = true;
+    prefetch_reset(stream);
+    stream->write_pointer = stream->read_pointer;
+    stream->last_buffer_operation = BUFFER_OPERATION_READ;
+
+    for (uint32_t i = 0; i < n_streams; i++) {
+        if ((streams[i].buffer_region_size > 0) && !streams[i].stopped) {
+            return;
+        }
+    }
+
+    // The pattern carries on being replayed after the streams have stopped
+    if (pattern != NULL) {
+        return;
+    }
+    stopped = true;
+    calendar_reset();
+}
+
+static inline bool eieio_commmand_parse_packet(
+        stream_t *stream, eieio_msg_t eieio_msg_ptr, uint16_t length) {
     uint16_t data_hdr_value = eieio_msg_ptr[0];
     uint16_t pkt_command = data_hdr_value & (~0xC000);
 
@@ -693,6 +1499,11 @@ static inline bool eieio_commmand_parse_packet(eieio_msg_t eieio_msg_ptr,
         eieio_command_parse_sequenced_data(eieio_msg_ptr, length);
         break;
 
+    case HOST_PUBLISH_WRITE_POINTER:
+        log_debug("command: HOST_PUBLISH_WRITE_POINTER");
+        eieio_command_parse_publish_write_pointer(eieio_msg_ptr, length);
+        break;
+
     case STOP_SENDING_REQUESTS:
         log_debug("command: STOP_SENDING_REQUESTS");
         eieio_command_parse_stop_requests(eieio_msg_ptr, length);
@@ -705,8 +1516,7 @@ static inline bool eieio_commmand_parse_packet(eieio_msg_t eieio_msg_ptr,
 
     case EVENT_STOP_COMMANDS:
         log_debug("command: EVENT_STOP");
-        stopped = true;
-        write_pointer = read_pointer;
+        stream_stop(stream);
         break;
 
     default:
@@ -716,166 +1526,355 @@ static inline bool eieio_commmand_parse_packet(eieio_msg_t eieio_msg_ptr,
     return true;
 }
 
-static inline bool packet_handler_selector(eieio_msg_t eieio_msg_ptr,
-                                           uint16_t length) {
-    log_debug("packet_handler_selector");
-
+static inline bool eieio_packet_handler(
+        stream_t *stream, eieio_msg_t eieio_msg_ptr, uint16_t length) {
     uint16_t data_hdr_value = eieio_msg_ptr[0];
     uint8_t pkt_type = (data_hdr_value >> 14) & 0x03;
 
     if (pkt_type == 0x01) {
         log_debug("parsing a command packet");
-        return eieio_commmand_parse_packet(eieio_msg_ptr, length);
+        return eieio_commmand_parse_packet(stream, eieio_msg_ptr, length);
     } else {
         log_debug("parsing an event packet");
-        return eieio_data_parse_packet(eieio_msg_ptr, length);
+        return eieio_data_parse_packet(stream, eieio_msg_ptr, length);
     }
 }
 
-void fetch_and_process_packet() {
-    uint32_t last_len = 2;
+//! \brief Handles a packet, or each of the packets of a container
+//! \param[in] stream The stream that the packet is from; live packets are
+//!            from the first stream
+//! \param[in] eieio_msg_ptr The packet
+//! \param[in] length The length of the packet in bytes
+static inline bool packet_handler_selector(
+        stream_t *stream, eieio_msg_t eieio_msg_ptr, uint16_t length) {
+    log_debug("packet_handler_selector");
+
+    if (eieio_msg_ptr[0] != ((1 << 14) | EVENT_CONTAINER)) {
+        return eieio_packet_handler(stream, eieio_msg_ptr, length);
+    }
+
+    // Handle each of the packets in the container in turn
+    log_debug("parsing a container of length %u", length);
+    eieio_msg_t next_packet = &eieio_msg_ptr[1];
+    uint32_t remaining = length - sizeof(uint16_t);
+    while (remaining >= sizeof(uint16_t)) {
+        uint16_t packet_length = next_packet[0];
+        if (((packet_length & 0x1) != 0) ||
+                ((packet_length + sizeof(uint16_t)) > remaining)) {
+            log_debug("invalid packet of length %u in container",
+                      packet_length);
+            signal_software_error(eieio_msg_ptr, length);
+            incorrect_packets++;
+            return false;
+        }
+        eieio_packet_handler(stream, &next_packet[1], packet_length);
+        next_packet += 1 + (packet_length >> 1);
+        remaining -= sizeof(uint16_t) + packet_length;
+    }
+    return true;
+}
 
+void fetch_and_process_packet(stream_t *stream) {
     log_debug("in fetch_and_process_packet");
-    msg_from_sdram_in_use = false;
+    stream->msg_from_sdram_in_use = false;
 
     // If we are not buffering, there is nothing to do
-    log_debug("buffer size is %d", buffer_region_size);
-    if (buffer_region_size == 0) {
+    log_debug("buffer size is %d", stream->buffer_region_size);
+    if (stream->buffer_region_size == 0) {
         return;
     }
 
-    log_debug("dealing with SDRAM is set to %d", msg_from_sdram_in_use);
-    log_debug(
-        "has_eieio_packet_in_buffer set to %d",
-        is_eieio_packet_in_buffer());
-    while ((!msg_from_sdram_in_use) && is_eieio_packet_in_buffer() &&
-            last_len > 0) {
+    eieio_msg_t packet;
+    uint32_t len;
+    while ((!stream->msg_from_sdram_in_use) &&
+            prefetch_next_packet(stream, &packet, &len)) {
+
+        // If there is padding, move on
+        if (packet[0] == (0x4000 | EVENT_PADDING)) {
+            continue;
+        }
 
-        // If there is padding, move on 2 bytes
-        uint16_t next_header = (uint16_t) *read_pointer;
-        if (next_header == 0x4002) {
-            read_pointer += 2;
-            if (read_pointer >= end_of_buffer_region) {
-                read_pointer = buffer_region;
+        // If there is unused space, jump over it
+        if (packet[0] == (0x4000 | EVENT_SKIP)) {
+            uint32_t n_bytes = packet[2] | (((uint32_t) packet[3]) << 16);
+            if (n_bytes > len) {
+                prefetch_skip(stream, n_bytes - len);
             }
+            continue;
+        }
+
+        print_packet_bytes(packet, len);
+        stream->next_buffer_time = extract_time_from_eieio_msg(packet);
+        log_debug("packet time: %d, current time: %d",
+                  stream->next_buffer_time, time);
+
+        if (stream->next_buffer_time <= time) {
+            packet_handler_selector(stream, packet, len);
+        } else if (calendar_add(
+                stream, packet, len, stream->next_buffer_time)) {
+
+            // The packet will be sent from the calendar, so the packets
+            // after it can carry on being read
+            continue;
         } else {
-            uint8_t *src_ptr = (uint8_t *) read_pointer;
-            uint8_t *dst_ptr = (uint8_t *) msg_from_sdram;
-            uint32_t len = calculate_eieio_packet_size(
-                (eieio_msg_t) read_pointer);
-
-            last_len = len;
-            if (len > MAX_PACKET_SIZE) {
-                log_error("Packet from SDRAM of %u bytes is too big!", len);
-                rt_error(RTE_SWERR);
+
+            // Keep the packet, as the prefetch block will be reused
+            if (packet != stream->msg_from_sdram) {
+                spin1_memcpy(stream->msg_from_sdram, packet, len);
             }
-            uint32_t final_space = (end_of_buffer_region - read_pointer);
+            stream->msg_from_sdram_in_use = true;
+            stream->msg_from_sdram_length = len;
+        }
+    }
+}
 
-            log_debug("packet with length %d, from address: %08x", len,
-                      read_pointer);
+void send_buffer_request_pkt(stream_t *stream, uint32_t space) {
+    log_debug("sending request packet for region %d with space: %d and "
+              "seq_no: %d at %u", stream->region_id, space,
+              stream->pkt_last_sequence_seen, time);
+
+    stream->last_space = space;
+    stream->last_request_tick = time;
+    req_ptr->region = stream->region_id & 0x0F;
+    req_ptr->sequence |= stream->pkt_last_sequence_seen;
+    req_ptr->space_available = space;
+    req_ptr->drain_rate = stream->drain_rate;
+    spin1_send_sdp_msg(&req, 1);
+    req_ptr->sequence &= 0;
+    req_ptr->space_available = 0;
+}
 
-            if (len > final_space) {
+//! \brief Updates the estimate of the rate at which the buffer region of a
+//!        stream is being emptied, and requests more data when the space in
+//!        the buffer region rises to the low-water mark of
+//!        space_before_data_request.  Once a request has been sent, the next
+//!        is only sent once the buffer has been refilled to
+//!        refill_hysteresis bytes above the mark, or if the request has not
+//!        been answered after TICKS_BETWEEN_REQUESTS time steps.
+//! \param[in] stream The stream to check
+static inline void refill_check(stream_t *stream) {
+    uint sr = spin1_int_disable();
+    uint32_t n_bytes = stream->refill_bytes_read;
+    stream->refill_bytes_read = 0;
+    spin1_mode_restore(sr);
+    stream->drain_rate += ((int32_t) (n_bytes << DRAIN_RATE_FRACTION_BITS) -
+        (int32_t) stream->drain_rate) >> DRAIN_RATE_SHIFT;
+
+    if (!send_packet_reqs || (stream->buffer_region_size == 0)) {
+        return;
+    }
 
-                // If the packet is split, get the bits
-                log_debug("split packet");
-                log_debug("1 - reading packet to %08x from %08x length: %d",
-                          (uint32_t) dst_ptr, (uint32_t) src_ptr, final_space);
-                spin1_memcpy(dst_ptr, src_ptr, final_space);
+    uint32_t space = get_sdram_buffer_space_available(stream);
+    if (space >= stream->space_before_data_request) {
+        if (stream->refill_armed) {
+            stream->refill_armed = false;
+            send_buffer_request_pkt(stream, space);
+        } else if (((time - stream->last_request_tick) >=
+                    TICKS_BETWEEN_REQUESTS) &&
+                ((space != stream->last_space) ||
+                    (space == stream->buffer_region_size))) {
+            send_buffer_request_pkt(stream, space);
+        }
+    } else if ((stream->space_before_data_request - space) >=
+            stream->refill_hysteresis) {
+        stream->refill_armed = true;
+    }
+}
 
-                uint32_t remaining_len = len - final_space;
-                dst_ptr += final_space;
-                src_ptr = buffer_region;
-                log_debug("2 - reading packet to %08x from %08x length: %d",
-                          (uint32_t) dst_ptr, (uint32_t) src_ptr,
-                          remaining_len);
+//! \brief Sends the keys of the pattern for the current time step
+static inline void pattern_process(void) {
+    if ((pattern == NULL) || (time < pattern->start_time)) {
+        return;
+    }
 
-                spin1_memcpy(dst_ptr, src_ptr, remaining_len);
-                read_pointer = buffer_region + remaining_len;
-            } else {
+    uint32_t elapsed = time - pattern->start_time;
+    uint32_t cycle = elapsed / pattern->period;
+    if ((pattern->n_repeats != 0) && (cycle >= pattern->n_repeats)) {
+        return;
+    }
+    uint32_t offset = elapsed - (cycle * pattern->period);
+    uint32_t key_offset = cycle * pattern->key_offset;
+    uint32_t end = pattern->index[offset + 1];
+    for (uint32_t i = pattern->index[offset]; i < end; i++) {
+        transmit_queue_add(pattern_keys[i] + key_offset, 0, NO_PAYLOAD);
+    }
+}
 
-                // If the packet is whole, get the packet
-                log_debug("full packet");
-                log_debug("1 - reading packet to %08x from %08x length: %d",
-                          (uint32_t) dst_ptr, (uint32_t) src_ptr, len);
+//! \brief Services a stream in a time step, sending the packets of the
+//!        time step from its buffer region and requesting more data
+//! \param[in] stream The stream to service
+static inline void stream_process(stream_t *stream) {
+    if (!stream->msg_from_sdram_in_use) {
+        fetch_and_process_packet(stream);
+    } else if (stream->next_buffer_time < time) {
+        late_packets += 1;
+        fetch_and_process_packet(stream);
+    } else if (stream->next_buffer_time == time) {
+        eieio_data_parse_packet(
+            stream, stream->msg_from_sdram, stream->msg_from_sdram_length);
+        fetch_and_process_packet(stream);
+    }
 
-                spin1_memcpy(dst_ptr, src_ptr, len);
-                read_pointer += len;
-                if (read_pointer >= end_of_buffer_region) {
-                    read_pointer = buffer_region;
-                }
-            }
+    refill_check(stream);
+}
 
-            last_buffer_operation = BUFFER_OPERATION_READ;
+//! \brief Reads the parameters of a stream
+//! \param[in] stream The stream to read the parameters of
+//! \param[in] index The index of the stream
+//! \param[in] params The parameters of the stream
+//! \return True if the stream could be set up, False otherwise
+static bool read_stream_parameters(
+        stream_t *stream, uint32_t index, address_t params) {
+    stream->index = index;
+    stream->region_id = params[STREAM_REGION];
+    stream->apply_prefix = params[APPLY_PREFIX];
+    stream->prefix = params[PREFIX];
+    stream->prefix_type = (eieio_prefix_types) params[PREFIX_TYPE];
+    stream->check = params[CHECK_KEYS];
+    stream->has_key = params[HAS_KEY];
+    stream->key_space = params[KEY_SPACE];
+    stream->mask = params[MASK];
+    stream->buffer_region_size = params[BUFFER_REGION_SIZE];
+    stream->space_before_data_request = params[SPACE_BEFORE_DATA_REQUEST];
+    stream->refill_hysteresis = params[REFILL_HYSTERESIS];
+    stream->direct_writes = params[DIRECT_WRITES];
 
-            print_packet_bytes(msg_from_sdram, len);
-            next_buffer_time = extract_time_from_eieio_msg(msg_from_sdram);
-            log_debug("packet time: %d, current time: %d",
-                      next_buffer_time, time);
+    // There is no point in sending requests until there is space for
+    // at least one packet
+    if (stream->space_before_data_request < MIN_BUFFER_SPACE) {
+        stream->space_before_data_request = MIN_BUFFER_SPACE;
+    }
 
-            if (next_buffer_time <= time) {
-                packet_handler_selector(msg_from_sdram, len);
-            } else {
-                msg_from_sdram_in_use = true;
-                msg_from_sdram_length = len;
-            }
-        }
+    // Set the initial values
+    stream->msg_from_sdram_in_use = false;
+    stream->next_buffer_time = 0;
+    stream->pkt_last_sequence_seen = MAX_SEQUENCE_NO;
+    stream->last_request_tick = 0;
+    stream->drain_rate = 0;
+    stream->stopped = false;
+    stream->prefetch_in_progress = false;
+    stream->prefetch_dma_block = 0;
+    stream->prefetch_discard = false;
+    stream->prefetch_overtaken = false;
+    for (uint32_t i = 0; i < N_PREFETCH_BLOCKS; i++) {
+        stream->prefetch_blocks[i].state = PREFETCH_EMPTY;
     }
-}
 
-void send_buffer_request_pkt(void) {
-    uint32_t space = get_sdram_buffer_space_available();
-    if ((space >= space_before_data_request) &&
-            ((space != last_space) || (space == buffer_region_size))) {
-        log_debug("sending request packet with space: %d and seq_no: %d at %u",
-                  space, pkt_last_sequence_seen, time);
+    if (stream->buffer_region_size != 0) {
+        stream->last_buffer_operation = BUFFER_OPERATION_WRITE;
+    } else {
+        stream->last_buffer_operation = BUFFER_OPERATION_READ;
+    }
 
-        last_space = space;
-        req_ptr->sequence |= pkt_last_sequence_seen;
-        req_ptr->space_available = space;
-        spin1_send_sdp_msg(&req, 1);
-        req_ptr->sequence &= 0;
-        req_ptr->space_available = 0;
+    // allocate a buffer size of the maximum SDP payload size
+    stream->msg_from_sdram = (eieio_msg_t) spin1_malloc(MAX_PACKET_SIZE);
+    if (stream->msg_from_sdram == NULL) {
+        log_error("Could not allocate packet buffer of stream %u", index);
+        return false;
     }
+
+    log_info("stream %d: region %d", index, stream->region_id);
+    log_info("apply_prefix: %d", stream->apply_prefix);
+    log_info("prefix: %d", stream->prefix);
+    log_info("prefix_type: %d", stream->prefix_type);
+    log_info("check: %d", stream->check);
+    log_info("key_space: 0x%08x", stream->key_space);
+    log_info("mask: 0x%08x", stream->mask);
+    log_info("space_before_read_request: %d",
+             stream->space_before_data_request);
+    log_info("refill_hysteresis: %d", stream->refill_hysteresis);
+    log_info("direct_writes: %d", stream->direct_writes);
+    return true;
 }
 
 bool read_parameters(address_t region_address) {
 
     // Get the configuration data
-    apply_prefix = region_address[APPLY_PREFIX];
-    prefix = region_address[PREFIX];
-    prefix_type = (eieio_prefix_types) region_address[PREFIX_TYPE];
-    check = region_address[CHECK_KEYS];
-    has_key = region_address[HAS_KEY];
-    key_space = region_address[KEY_SPACE];
-    mask = region_address[MASK];
-    buffer_region_size = region_address[BUFFER_REGION_SIZE];
-    space_before_data_request = region_address[SPACE_BEFORE_DATA_REQUEST];
     return_tag_id = region_address[RETURN_TAG_ID];
     buffered_in_sdp_port = region_address[BUFFERED_IN_SDP_PORT];
-
-    // There is no point in sending requests until there is space for
-    // at least one packet
-    if (space_before_data_request < MIN_BUFFER_SPACE) {
-        space_before_data_request = MIN_BUFFER_SPACE;
-    }
+    transmit_queue_size = region_address[TRANSMIT_QUEUE_SIZE];
+    transmit_rate = region_address[TRANSMIT_RATE];
+    calendar_slots = region_address[CALENDAR_SLOTS];
+    calendar_slot_size = region_address[CALENDAR_SLOT_SIZE];
+    n_streams = region_address[N_STREAMS];
+    bool has_pattern = region_address[HAS_PATTERN];
 
     // Set the initial values
     incorrect_keys = 0;
     incorrect_packets = 0;
-    msg_from_sdram_in_use = false;
-    next_buffer_time = 0;
-    pkt_last_sequence_seen = MAX_SEQUENCE_NO;
     send_packet_reqs = true;
-    last_request_tick = 0;
+    next_stream = 0;
 
-    if (buffer_region_size != 0) {
-        last_buffer_operation = BUFFER_OPERATION_WRITE;
-    } else {
-        last_buffer_operation = BUFFER_OPERATION_READ;
+    // allocate and read the streams
+    if ((n_streams == 0) || (n_streams > MAX_STREAMS)) {
+        log_error("Cannot have %u streams", n_streams);
+        return false;
+    }
+    streams = (stream_t *) spin1_malloc(n_streams * sizeof(stream_t));
+    if (streams == NULL) {
+        log_error("Could not allocate %u streams", n_streams);
+        return false;
+    }
+    for (uint32_t i = 0; i < n_streams; i++) {
+        if (!read_stream_parameters(&streams[i], i, &region_address[
+                STREAM_PARAMETERS + (i * N_STREAM_PARAMETERS)])) {
+            return false;
+        }
     }
 
-    // allocate a buffer size of the maximum SDP payload size
-    msg_from_sdram = (eieio_msg_t) spin1_malloc(MAX_PACKET_SIZE);
+    // allocate the transmit queue; one entry is always left empty so that
+    // a full queue can be told apart from an empty one
+    if (transmit_queue_size < 2) {
+        transmit_queue_size = 2;
+    }
+    transmit_queue = (transmit_entry_t *) spin1_malloc(
+        transmit_queue_size * sizeof(transmit_entry_t));
+    if (transmit_queue == NULL) {
+        log_error("Could not allocate transmit queue of %u entries",
+                  transmit_queue_size);
+        return false;
+    }
+    transmit_queue_read = 0;
+    transmit_queue_write = 0;
+    transmitting = false;
+    transmit_queue_overflows = 0;
+    future_packets_dropped = 0;
+
+    // Timer 2 measures the time between sends when the queue is paced
+    transmit_credit = 0;
+    if (transmit_rate != 0) {
+        tc[T2_CONTROL] = TRANSMIT_TIMER_CONTROL;
+        transmit_credit_time = tc[T2_COUNT];
+    }
+
+    // allocate the calendar fill levels and a buffer to read packets from
+    // the calendar into
+    if (calendar_slots > 0) {
+        calendar_fill = (uint32_t *) spin1_malloc(
+            calendar_slots * sizeof(uint32_t));
+        msg_from_calendar = (eieio_msg_t) spin1_malloc(MAX_PACKET_SIZE);
+        if ((calendar_fill == NULL) || (msg_from_calendar == NULL)) {
+            log_error("Could not allocate calendar of %u slots",
+                      calendar_slots);
+            return false;
+        }
+        calendar_reset();
+    }
+
+    // find the pattern to replay
+    pattern = NULL;
+    if (has_pattern) {
+        pattern = (pattern_t *) data_specification_get_region(
+            PATTERN_REGION, data_specification_get_data_address());
+        if (pattern->period == 0) {
+            log_error("The pattern must have a period of at least 1");
+            return false;
+        }
+        pattern_keys = &pattern->index[pattern->period + 1];
+        log_info("pattern of %u keys every %u time steps from %u, %u times",
+                 pattern->n_keys, pattern->period, pattern->start_time,
+                 pattern->n_repeats);
+    }
 
     req.length = 8 + sizeof(req_packet_sdp_t);
     req.flags = 0x7;
@@ -885,37 +1884,74 @@ bool read_parameters(address_t region_address) {
     req.dest_addr = 0;
     req.srce_addr = spin1_get_chip_id();
     req_ptr = (req_packet_sdp_t*) &(req.cmd_rc);
-    req_ptr->eieio_header_command = 1 << 14 | SPINNAKER_REQUEST_BUFFERS;
+    req_ptr->eieio_header_command = 1 << 14 | SPINNAKER_REQUEST_REFILL;
     req_ptr->chip_id = spin1_get_chip_id();
     req_ptr->processor = (spin1_get_core_id() << 3);
     req_ptr->pad1 = 0;
     req_ptr->region = BUFFER_REGION & 0x0F;
 
-    log_info("apply_prefix: %d", apply_prefix);
-    log_info("prefix: %d", prefix);
-    log_info("prefix_type: %d", prefix_type);
-    log_info("check: %d", check);
-    log_info("key_space: 0x%08x", key_space);
-    log_info("mask: 0x%08x", mask);
-    log_info("space_before_read_request: %d", space_before_data_request);
+    log_info("n_streams: %d", n_streams);
     log_info("return_tag_id: %d", return_tag_id);
+    log_info("transmit_queue_size: %d", transmit_queue_size);
+    log_info("transmit_rate: %d", transmit_rate);
+    log_info("calendar_slots: %d", calendar_slots);
+    log_info("calendar_slot_size: %d", calendar_slot_size);
 
     return true;
 }
 
-bool setup_buffer_region(address_t region_address) {
-    buffer_region = (uint8_t *) region_address;
-    read_pointer = buffer_region;
-    write_pointer = buffer_region;
-    end_of_buffer_region = buffer_region + buffer_region_size;
+//! \brief Sets up the buffer regions of the streams, which start empty.  The
+//!        calendar follows the buffer of the first stream.
+//! \param[in] address The address of the data of the core
+bool setup_buffer_regions(address_t address) {
+    for (uint32_t i = 0; i < n_streams; i++) {
+        stream_t *stream = &streams[i];
+        prefetch_reset(stream);
+        stream->stopped = false;
+        stream->refill_armed = true;
+        stream->refill_bytes_read = 0;
+        if ((stream->buffer_region_size == 0) &&
+                ((i > 0) || (calendar_slots == 0))) {
+            continue;
+        }
+
+        stream->buffer_region = (uint8_t *) data_specification_get_region(
+            stream->region_id, address);
+        stream->read_pointer = stream->buffer_region;
+        stream->write_pointer = stream->buffer_region;
+        stream->end_of_buffer_region =
+            stream->buffer_region + stream->buffer_region_size;
+        if (i == 0) {
+            calendar = stream->end_of_buffer_region;
+        }
 
-    log_info("buffer_region: 0x%.8x", buffer_region);
-    log_info("buffer_region_size: %d", buffer_region_size);
-    log_info("end_of_buffer_region: 0x%.8x", end_of_buffer_region);
+        log_info("stream %d buffer_region: 0x%.8x", i, stream->buffer_region);
+        log_info("buffer_region_size: %d", stream->buffer_region_size);
+        log_info("end_of_buffer_region: 0x%.8x",
+                 stream->end_of_buffer_region);
+    }
 
     return true;
 }
 
+//! \brief Stores the additional provenance data of the model
+//! \param[in] provenance_region_address The address to store the data at
+void record_provenance_data(address_t provenance_region_address) {
+    provenance_region_address[TRANSMIT_QUEUE_OVERFLOWS] =
+        transmit_queue_overflows;
+    provenance_region_address[FUTURE_PACKETS_DROPPED] =
+        future_packets_dropped;
+}
+
+//! \brief Handles the completion of a prefetch DMA; recording passes on
+//!        those that it did not start
+//! \param[in] unused The id of the transfer (unused)
+//! \param[in] tag The tag of the transfer
+void dma_transfer_done_callback(uint unused, uint tag) {
+    use(unused);
+    prefetch_done(tag);
+}
+
 //! \brief Initialises the recording parts of the model
 //! \return True if recording initialisation is successful, false otherwise
 static bool initialise_recording(){
@@ -927,6 +1963,10 @@ static bool initialise_recording(){
 
     bool success = recording_initialize(recording_region, &recording_flags);
     log_info("Recording flags = 0x%08x", recording_flags);
+
+    // Recording may have registered its own DMA callback, so chain the
+    // prefetching on to it
+    recording_chain_dma_transfer_done(dma_transfer_done_callback);
     return success;
 }
 
@@ -944,7 +1984,7 @@ bool initialise(uint32_t *timer_period) {
     if (!simulation_initialise(
             data_specification_get_region(SYSTEM, address),
             APPLICATION_NAME_HASH, timer_period, &simulation_ticks,
-            &infinite_run, SDP_CALLBACK, NULL,
+            &infinite_run, SDP_CALLBACK, record_provenance_data,
             data_specification_get_region(PROVENANCE_REGION, address))) {
         return false;
     }
@@ -960,12 +2000,9 @@ bool initialise(uint32_t *timer_period) {
          return false;
     }
 
-    // Read the buffer region
-    if (buffer_region_size > 0) {
-        if (!setup_buffer_region(data_specification_get_region(
-                BUFFER_REGION, address))) {
-            return false;
-        }
+    // Read the buffer regions
+    if (!setup_buffer_regions(address)) {
+        return false;
     }
 
     return true;
@@ -974,14 +2011,15 @@ bool initialise(uint32_t *timer_period) {
 void resume_callback() {
 
     address_t address = data_specification_get_data_address();
-    setup_buffer_region(data_specification_get_region(
-        BUFFER_REGION, address));
+    setup_buffer_regions(address);
 
     // set the code to start sending packet requests again
     send_packet_reqs = true;
 
     // magic state to allow the model to check for stuff in the SDRAM
-    last_buffer_operation = BUFFER_OPERATION_WRITE;
+    for (uint32_t i = 0; i < n_streams; i++) {
+        streams[i].last_buffer_operation = BUFFER_OPERATION_WRITE;
+    }
 
     // have fallen out of a resume mode, set up the functions to start
     // resuming again
@@ -997,9 +2035,8 @@ void timer_callback(uint unused0, uint unused1) {
     use(unused1);
     time++;
 
-    log_debug("timer_callback, final time: %d, current time: %d,"
-              "next packet buffer time: %d", simulation_ticks, time,
-              next_buffer_time);
+    log_debug("timer_callback, final time: %d, current time: %d",
+              simulation_ticks, time);
 
     if (stopped || ((infinite_run != TRUE) && (time >= simulation_ticks))) {
 
@@ -1014,6 +2051,7 @@ void timer_callback(uint unused0, uint unused1) {
         log_info("Incorrect keys discarded: %d", incorrect_keys);
         log_info("Incorrect packets discarded: %d", incorrect_packets);
         log_info("Late packets: %d", late_packets);
+        log_info("Transmit queue overflows: %d", transmit_queue_overflows);
         log_info("Last time of stop notification request: %d",
                  last_stop_notification_request);
 
@@ -1024,20 +2062,24 @@ void timer_callback(uint unused0, uint unused1) {
         return;
     }
 
-    if (send_packet_reqs &&
-            ((time - last_request_tick) >= TICKS_BETWEEN_REQUESTS)) {
-        send_buffer_request_pkt();
-        last_request_tick = time;
+    transmit_queue_resume();
+    calendar_process();
+    pattern_process();
+
+    // Service the streams round-robin, starting from a different stream in
+    // each time step so that none is always left until the transmit queue
+    // is full
+    uint32_t index = next_stream;
+    for (uint32_t i = 0; i < n_streams; i++) {
+        stream_process(&streams[index]);
+        index++;
+        if (index == n_streams) {
+            index = 0;
+        }
     }
-
-    if (!msg_from_sdram_in_use) {
-        fetch_and_process_packet();
-    } else if (next_buffer_time < time) {
-        late_packets += 1;
-        fetch_and_process_packet();
-    } else if (next_buffer_time == time) {
-        eieio_data_parse_packet(msg_from_sdram, msg_from_sdram_length);
-        fetch_and_process_packet();
+    next_stream++;
+    if (next_stream == n_streams) {
+        next_stream = 0;
     }
 
     if (recording_flags > 0) {
@@ -1051,7 +2093,7 @@ void sdp_packet_callback(uint mailbox, uint port) {
     uint16_t length = msg->length;
     eieio_msg_t eieio_msg_ptr = (eieio_msg_t) &(msg->cmd_rc);
 
-    packet_handler_selector(eieio_msg_ptr, length - 8);
+    packet_handler_selector(&streams[0], eieio_msg_ptr, length - 8);
 
     // free the message to stop overload
     spin1_msg_free(msg);
@@ -1073,6 +2115,7 @@ void c_main(void) {
     // Register callbacks
     simulation_sdp_callback_on(buffered_in_sdp_port, sdp_packet_callback);
     spin1_callback_on(TIMER_TICK, timer_callback, TIMER);
+    spin1_callback_on(USER_EVENT, transmit_queue_callback, TRANSMIT);
 
     // Start the time at "-1" so that the first tick will be 0
     time = UINT32_MAX;
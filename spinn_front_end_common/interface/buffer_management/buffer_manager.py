@@ -36,14 +36,15 @@ from spinnman.messages.eieio import create_eieio_command
 # front end common imports
 from spinn_front_end_common.utilities import helpful_functions
 from spinn_front_end_common.utilities import exceptions
+from spinn_front_end_common.utilities import eieio_container
 from spinn_front_end_common.interface.buffer_management.\
     storage_objects.buffers_sent_deque import BuffersSentDeque
 from spinn_front_end_common.interface.buffer_management.\
     storage_objects.buffered_receiving_data import BufferedReceivingData
+from spinn_front_end_common.interface.buffer_management.\
+    storage_objects.direct_write_state import DirectWriteState
 from spinn_front_end_common.utilities import constants as \
     spinn_front_end_constants
-from spinn_front_end_common.interface.buffer_management.storage_objects.\
-    channel_buffer_state import ChannelBufferState
 from spinn_front_end_common.interface.buffer_management \
     import recording_utilities
 
@@ -53,6 +54,7 @@ import logging
 import traceback
 import os
 import re
+import struct
 
 
 logger = logging.getLogger(__name__)
@@ -64,6 +66,31 @@ _MIN_MESSAGE_SIZE = (EIEIO32BitTimedPayloadPrefixDataMessage
 # The number of bytes in each key to be sent
 _N_BYTES_PER_KEY = EIEIOType.KEY_32_BIT.key_bytes  # @UndefinedVariable
 
+# The largest packet that a core can read from its buffer
+_MAX_BUFFERED_PACKET_SIZE = 280
+
+# The body of a request for more data which gives the rate at which the
+# buffer is being emptied: chip id, processor, unused, region, sequence,
+# space available, drain rate
+_REQUEST_REFILL = struct.Struct("<HBBBBII")
+
+# The number of fractional bits of the drain rate of a request
+_DRAIN_RATE_FRACTION_BITS = 8
+
+# The number of time steps that the data sent in response to a request is
+# to last at the rate at which the buffer is being emptied, and the least
+# data to send in response to a request
+_REFILL_HORIZON = 10000
+_MIN_REFILL_SIZE = 1024
+
+# The command marking unused space in the buffer of a core: command, zero,
+# number of bytes of the space including the command
+_SKIP = struct.Struct("<HHI")
+
+# The command publishing data written directly into the buffer of a core:
+# command, (sequence << 8) | region, offset written at, number of bytes
+_PUBLISH_WRITE_POINTER = struct.Struct("<HHII")
+
 
 class BufferManager(object):
     """ Manager of send buffers
@@ -100,12 +127,18 @@ class BufferManager(object):
         # Set of vertices with buffers to be sent
         "_sender_vertices",
 
-        # Dictionary of sender vertex -> buffers sent
+        # Dictionary of (sender vertex, region) -> buffers sent
         "_sent_messages",
 
+        # Dictionary of (sender vertex, region) -> buffers written directly
+        "_direct_writes",
+
         # storage area for received data from cores
         "_received_data",
 
+        # Dictionary of (x, y, p) -> recording header of the core
+        "_recording_headers",
+
         # Lock to avoid multiple messages being processed at the same time
         "_thread_lock_buffer_out",
 
@@ -146,12 +179,19 @@ class BufferManager(object):
         # Set of vertices with buffers to be sent
         self._sender_vertices = set()
 
-        # Dictionary of sender vertex -> buffers sent
+        # Dictionary of (sender vertex, region) -> buffers sent
         self._sent_messages = dict()
 
+        # Dictionary of (sender vertex, region) -> buffers written directly
+        self._direct_writes = dict()
+
         # storage area for received data from cores
         self._received_data = BufferedReceivingData()
 
+        # Dictionary of (x, y, p) -> recording header of the core, which is
+        # read in one go the first time that any of it is needed
+        self._recording_headers = dict()
+
         # Lock to avoid multiple messages being processed at the same time
         self._thread_lock_buffer_out = threading.Lock()
         self._thread_lock_buffer_in = threading.Lock()
@@ -169,24 +209,22 @@ class BufferManager(object):
             if not self._finished:
                 if isinstance(packet, SpinnakerRequestBuffers):
                     with self._thread_lock_buffer_in:
-                        vertex = self._placements.get_vertex_on_processor(
-                            packet.x, packet.y, packet.p)
-
-                        if vertex in self._sender_vertices:
-
-                            # logger.debug(
-                            #     "received send request with sequence: {1:d},"
-                            #     " space available: {0:d}".format(
-                            #         packet.space_available,
-                            #         packet.sequence_no))
-
-                            # noinspection PyBroadException
-                            try:
-                                self._send_messages(
-                                    packet.space_available, vertex,
-                                    packet.region_id, packet.sequence_no)
-                            except Exception:
-                                traceback.print_exc()
+                        self._handle_buffer_request(
+                            packet.x, packet.y, packet.p, packet.region_id,
+                            packet.sequence_no, packet.space_available)
+                elif (isinstance(packet, EIEIOCommandMessage) and
+                        packet.eieio_header.command ==
+                        spinn_front_end_constants.EIEIO_COMMAND_IDS
+                        .SPINNAKER_REQUEST_REFILL.value):
+                    (chip_id, processor, _, region_id, sequence_no,
+                     space_available, drain_rate) = \
+                        _REQUEST_REFILL.unpack_from(packet.data, packet.offset)
+                    with self._thread_lock_buffer_in:
+                        self._handle_buffer_request(
+                            (chip_id >> 8) & 0xFF, chip_id & 0xFF,
+                            (processor >> 3) & 0x1F, region_id & 0x0F,
+                            sequence_no, self._get_refill_size(
+                                space_available, drain_rate))
                 elif isinstance(packet, SpinnakerRequestReadData):
                     with self._thread_lock_buffer_out:
 
@@ -211,6 +249,49 @@ class BufferManager(object):
         except Exception:
             traceback.print_exc()
 
+    def _handle_buffer_request(
+            self, x, y, p, region_id, sequence_no, space_available):
+        """ Send data in response to a request for more data from a core
+        """
+        vertex = self._placements.get_vertex_on_processor(x, y, p)
+
+        if vertex in self._sender_vertices:
+
+            # logger.debug(
+            #     "received send request with sequence: {1:d},"
+            #     " space available: {0:d}".format(
+            #         space_available, sequence_no))
+
+            # noinspection PyBroadException
+            try:
+                if vertex.is_direct_write(region_id):
+                    self._write_messages(
+                        space_available, vertex, region_id, sequence_no)
+                else:
+                    self._send_messages(
+                        space_available, vertex, region_id, sequence_no)
+            except Exception:
+                traceback.print_exc()
+
+    @staticmethod
+    def _get_refill_size(space_available, drain_rate):
+        """ Get the amount of data to send in response to a request, which\
+            is enough to last for _REFILL_HORIZON time steps at the rate at\
+            which the buffer is being emptied, so that slowly emptied buffers\
+            are refilled in smaller blocks
+
+        :param space_available: The space available in the buffer
+        :param drain_rate: The number of bytes read from the buffer per time\
+            step, with _DRAIN_RATE_FRACTION_BITS fractional bits, or 0 if\
+            not known
+        :return: The number of bytes to send
+        """
+        if drain_rate == 0:
+            return space_available
+        return min(space_available, max(
+            _MIN_REFILL_SIZE,
+            (drain_rate * _REFILL_HORIZON) >> _DRAIN_RATE_FRACTION_BITS))
+
     def _create_connection(self, tag):
         if self._transceiver is not None:
             connection = self._transceiver.register_udp_listener(
@@ -313,6 +394,7 @@ class BufferManager(object):
         """
         # reset buffered out
         self._received_data = BufferedReceivingData()
+        self._recording_headers = dict()
 
         # rewind buffered in
         for vertex in self._sender_vertices:
@@ -326,14 +408,22 @@ class BufferManager(object):
         # update the received data items
         self._received_data.resume()
 
-    def _generate_end_buffering_state_from_machine(
-            self, placement, state_region_base_address):
+    def _recover_end_buffering_state(self, placement, recording_region_id):
+        """ Read the last sequence number and the end state of the recorded\
+            regions of a core from the state block of the core, along with\
+            the rest of the recording header, in one read
 
-        # retrieve channel state memory area
-        channel_state_data = str(self._transceiver.read_memory(
-            placement.x, placement.y, state_region_base_address,
-            ChannelBufferState.size_of_channel_state()))
-        return ChannelBufferState.create_from_bytearray(channel_state_data)
+        :param placement: the placement of the core
+        :param recording_region_id: a region that must be included
+        """
+        header = self._read_recording_header(placement, recording_region_id)
+        recording_utilities.check_recording_state(placement, header)
+        self._received_data.store_end_buffering_sequence_number(
+            placement.x, placement.y, placement.p,
+            header.last_sequence_number)
+        for region_id, end_state in enumerate(header.channel_states):
+            self._received_data.store_end_buffering_state(
+                placement.x, placement.y, placement.p, region_id, end_state)
 
     def _create_message_to_send(self, size, vertex, region):
         """ Creates a single message to send with the given boundaries.
@@ -412,7 +502,7 @@ class BufferManager(object):
                 EIEIO32BitTimedPayloadPrefixDataMessage.get_min_packet_length()
             while (vertex.is_next_timestamp(region) and
                     bytes_to_go > min_size_of_packet):
-                space_available = min(bytes_to_go, 280)
+                space_available = min(bytes_to_go, _MAX_BUFFERED_PACKET_SIZE)
                 next_message = self._create_message_to_send(
                     space_available, vertex, region)
                 if next_message is None:
@@ -443,11 +533,21 @@ class BufferManager(object):
             all_data += data
             bytes_to_go -= len(data)
             progress_bar.update(len(data))
-            self._sent_messages[vertex] = BuffersSentDeque(
+            self._sent_messages[vertex, region] = BuffersSentDeque(
                 region, sent_stop_message=True)
-
-        # If there is any space left, add padding
-        if bytes_to_go > 0:
+            if vertex.is_direct_write(region):
+                self._direct_writes[vertex, region] = DirectWriteState(
+                    region, region_base_address,
+                    vertex.get_max_buffer_size_possible(region),
+                    sent_stop_message=True)
+
+        # If there is any space left, mark it as unused, or fill it with
+        # padding if it is too small to be marked
+        if bytes_to_go >= _SKIP.size:
+            all_data += _SKIP.pack(
+                0x4000 | spinn_front_end_constants.EIEIO_COMMAND_IDS
+                .EVENT_SKIP.value, 0, bytes_to_go)
+        elif bytes_to_go > 0:
             padding_packet = PaddingRequest()
             n_packets = bytes_to_go / padding_packet.get_min_packet_length()
             data = padding_packet.bytestring
@@ -462,10 +562,10 @@ class BufferManager(object):
         """ Send a set of messages
         """
 
-        # Get the sent messages for the vertex
-        if vertex not in self._sent_messages:
-            self._sent_messages[vertex] = BuffersSentDeque(region)
-        sent_messages = self._sent_messages[vertex]
+        # Get the sent messages for the region of the vertex
+        if (vertex, region) not in self._sent_messages:
+            self._sent_messages[vertex, region] = BuffersSentDeque(region)
+        sent_messages = self._sent_messages[vertex, region]
 
         # If the sequence number is outside the window, return no messages
         if not sent_messages.update_last_received_sequence_number(sequence_no):
@@ -507,15 +607,110 @@ class BufferManager(object):
             sent_messages.send_stop_message()
 
         # If there are no more messages, turn off requests for more messages
-        if not vertex.is_next_timestamp(region) and sent_messages.is_empty():
+        if self._is_finished(vertex):
             # logger.debug("Sending stop")
             self._send_request(vertex, StopRequests())
 
-        # Send the messages
-        for message in sent_messages.messages:
-            # logger.debug("Sending message with sequence {}".format(
-            #     message.sequence_no))
-            self._send_request(vertex, message)
+        # Send the messages, packing those that fit together into containers
+        for data in eieio_container.pack_eieio_packets(
+                [message.bytestring for message in sent_messages.messages],
+                constants.UDP_MESSAGE_MAX_SIZE):
+            self._send_data(vertex, data)
+
+    def _write_messages(self, size, vertex, region, sequence_no):
+        """ Write a set of messages directly into the free space of the\
+            buffer of a core, and publish them to the core
+        """
+
+        # Get the state of the buffer of the region of the vertex
+        if (vertex, region) not in self._direct_writes:
+            self._direct_writes[vertex, region] = DirectWriteState(
+                region, helpful_functions.locate_memory_region_for_placement(
+                    self._placements.get_placement_of_vertex(vertex), region,
+                    self._transceiver),
+                vertex.get_max_buffer_size_possible(region))
+        state = self._direct_writes[vertex, region]
+
+        # If the core hasn't received the last publish, send it again, as
+        # the space available doesn't account for the data published
+        if not state.update_last_received_sequence_number(sequence_no):
+            if state.pending_n_bytes is not None:
+                self._send_publish(vertex, state)
+            return
+
+        # Add messages up to the space available
+        data = ""
+        bytes_to_go = size
+        while vertex.is_next_timestamp(region) and bytes_to_go > 0:
+            next_message = self._create_message_to_send(
+                min(bytes_to_go, _MAX_BUFFERED_PACKET_SIZE), vertex, region)
+            if next_message is None:
+                break
+            data += next_message.bytestring
+            bytes_to_go -= next_message.size
+
+        # If the vertex is empty, write the stop message if there is space
+        is_stop_message = False
+        if (not state.sent_stop_message and
+                not vertex.is_next_timestamp(region) and
+                bytes_to_go >= EventStopRequest.get_min_packet_length()):
+            data += EventStopRequest().bytestring
+            is_stop_message = True
+
+        # Write the data, wrapping around the end of the buffer if needed,
+        # and then tell the core about it
+        if len(data) > 0:
+            placement = self._placements.get_placement_of_vertex(vertex)
+            offset = 0
+            for address, n_bytes in state.get_spans(len(data)):
+                self._transceiver.write_memory(
+                    placement.x, placement.y, address,
+                    data[offset:offset + n_bytes])
+                offset += n_bytes
+            state.add_pending(len(data), is_stop_message)
+            self._send_publish(vertex, state)
+
+        # If there are no more messages, turn off requests for more messages
+        elif self._is_finished(vertex):
+            self._send_request(vertex, StopRequests())
+
+    def _is_finished(self, vertex):
+        """ Determine if all the messages of every region of a vertex have\
+            been sent and received, so that the vertex no longer needs to\
+            request more; requests are turned off for all the regions of a\
+            vertex at once
+
+        :param vertex: The vertex to check
+        :rtype: bool
+        """
+        for region in vertex.get_regions():
+            if vertex.is_next_timestamp(region):
+                return False
+            if vertex.is_direct_write(region):
+                state = self._direct_writes.get((vertex, region))
+                if (state is None or not state.sent_stop_message or
+                        state.pending_n_bytes is not None):
+                    return False
+            else:
+                sent_messages = self._sent_messages.get((vertex, region))
+                if sent_messages is None or not sent_messages.is_empty():
+                    return False
+        return True
+
+    def _send_publish(self, vertex, state):
+        """ Sends the command publishing the pending data written into the\
+            buffer of a core
+
+        :param vertex: The vertex to send to
+        :param state: The state of the buffer of the vertex
+        :type state: \
+            :py:class:`spinn_front_end_common.interface.buffer_management.storage_objects.direct_write_state.DirectWriteState`
+        """
+        self._send_data(vertex, _PUBLISH_WRITE_POINTER.pack(
+            0x4000 | spinn_front_end_constants.EIEIO_COMMAND_IDS
+            .HOST_PUBLISH_WRITE_POINTER.value,
+            (state.next_sequence_number << 8) | state.region,
+            state.write_offset, state.pending_n_bytes))
 
     def _send_request(self, vertex, message):
         """ Sends a request
@@ -523,6 +718,15 @@ class BufferManager(object):
         :param vertex: The vertex to send to
         :param message: The message to send
         """
+        self._send_data(vertex, message.bytestring)
+
+    def _send_data(self, vertex, data):
+        """ Sends the data of one or more requests
+
+        :param vertex: The vertex to send to
+        :param data: The data to send
+        :type data: str
+        """
 
         placement = self._placements.get_placement_of_vertex(vertex)
         sdp_header = SDPHeader(
@@ -530,7 +734,7 @@ class BufferManager(object):
             destination_cpu=placement.p, flags=SDPFlag.REPLY_NOT_EXPECTED,
             destination_port=spinn_front_end_constants.SDP_PORTS.
             INPUT_BUFFERING_SDP_PORT.value)
-        sdp_message = SDPMessage(sdp_header, message.bytestring)
+        sdp_message = SDPMessage(sdp_header, data)
         self._transceiver.send_sdp_message(sdp_message)
 
     def stop(self):
@@ -558,46 +762,31 @@ class BufferManager(object):
                 py:class:`spinn_front_end_common.interface.buffer_management.buffer_models.abstract_buffered_data_storage.AbstractBufferedDataStorage`
         """
 
-        recording_data_address = \
-            placement.vertex.get_recording_region_base_address(
-                self._transceiver, placement)
-
-        # Ensure the last sequence number sent has been retrieved
-        if not self._received_data.is_end_buffering_sequence_number_stored(
-                placement.x, placement.y, placement.p):
-            self._received_data.store_end_buffering_sequence_number(
-                placement.x, placement.y, placement.p,
-                recording_utilities.get_last_sequence_number(
-                    placement, self._transceiver, recording_data_address))
+        # Ensure the last sequence number sent and the end state of the
+        # recorded regions have been retrieved; these are all read at once
+        if not self._received_data.is_end_buffering_state_recovered(
+                placement.x, placement.y, placement.p, recording_region_id):
+            self._recover_end_buffering_state(placement, recording_region_id)
 
         # Read the data if not already received
         if not self._received_data.is_data_from_region_flushed(
                 placement.x, placement.y, placement.p,
                 recording_region_id):
 
-            # Read the end state of the recording for this region
-            if not self._received_data.is_end_buffering_state_recovered(
-                    placement.x, placement.y, placement.p,
-                    recording_region_id):
-
-                end_state_address = recording_utilities.get_region_pointer(
-                    placement, self._transceiver, recording_data_address,
-                    recording_region_id)
-                end_state = self._generate_end_buffering_state_from_machine(
-                    placement, end_state_address)
-                self._received_data.store_end_buffering_state(
-                    placement.x, placement.y, placement.p, recording_region_id,
-                    end_state)
-            else:
-                end_state = self._received_data.\
-                    get_end_buffering_state(
-                        placement.x, placement.y, placement.p,
-                        recording_region_id)
+            end_state = self._received_data.get_end_buffering_state(
+                placement.x, placement.y, placement.p, recording_region_id)
 
             start_ptr = end_state.start_address
             write_ptr = end_state.current_write
             end_ptr = end_state.end_address
             read_ptr = end_state.current_read
+            region_flags = self._get_region_flags(
+                placement, recording_region_id)
+            is_pooled = region_flags & recording_utilities.REGION_FLAG_POOLED
+
+            # the number of bytes to skip at the start of a pooled region,
+            # where the read pointer cannot simply be moved on
+            pool_skip = 0
 
             # current read needs to be adjusted in case the last portion of the
             # memory has already been read, but the HostDataRead packet has not
@@ -614,7 +803,31 @@ class BufferManager(object):
                 self._received_data.get_end_buffering_sequence_number(
                     placement.x, placement.y, placement.p)
 
-            if last_sequence_number == seq_no_last_ack_packet:
+            read_window_size = self._get_read_window_size(placement)
+            if read_window_size > 1:
+
+                # the core records the oldest request that it has not
+                # applied; any requests from there up to the last one read
+                # have been stored, but the core does not know it
+                unapplied_space = self._received_data.get_read_history_space(
+                    placement.x, placement.y, placement.p,
+                    recording_region_id, last_sequence_number,
+                    seq_no_last_ack_packet, read_window_size)
+                if unapplied_space > 0 and not end_state.is_state_updated:
+                    if is_pooled:
+                        pool_skip = unapplied_space
+                    else:
+                        read_ptr += unapplied_space
+                        if read_ptr >= end_ptr:
+                            read_ptr -= end_ptr - start_ptr
+                        if read_ptr == write_ptr:
+                            end_state.update_last_operation(
+                                spinn_front_end_constants.BUFFERING_OPERATIONS.
+                                BUFFER_READ.value)
+                    end_state.update_read_pointer(read_ptr)
+                    end_state.set_update_completed()
+
+            elif last_sequence_number == seq_no_last_ack_packet:
 
                 # if the last ACK packet has not been processed on the chip,
                 # process it now
@@ -636,6 +849,9 @@ class BufferManager(object):
                         last_sent_ack_packet.region_id(i)
 
                     if (last_ack_packet_is_of_this_region and
+                            not end_state.is_state_updated and is_pooled):
+                        pool_skip += last_sent_ack_packet.space_read(i)
+                    elif (last_ack_packet_is_of_this_region and
                             not end_state.is_state_updated):
                         read_ptr += last_sent_ack_packet.space_read(i)
                         if (read_ptr == write_ptr or
@@ -661,7 +877,27 @@ class BufferManager(object):
             read_ptr = end_state.current_read
 
             # now read_ptr is updated, check memory to read
-            if read_ptr < write_ptr:
+            if is_pooled:
+
+                # A pooled region is read by following its chunks
+                data = self._read_pool_region(
+                    placement, start_ptr, read_ptr, write_ptr)
+                self._received_data.flushing_data_from_region(
+                    placement.x, placement.y, placement.p, recording_region_id,
+                    data[pool_skip:])
+
+            elif region_flags & recording_utilities.REGION_FLAG_RING:
+
+                # A ring region holds the most recent records, which are
+                # read in one go, oldest first, and stripped of their framing
+                data = self._read_ring_region(
+                    placement, start_ptr, end_ptr, read_ptr, write_ptr,
+                    last_operation)
+                self._received_data.flushing_data_from_region(
+                    placement.x, placement.y, placement.p, recording_region_id,
+                    recording_utilities.get_records_from_ring_data(data))
+
+            elif read_ptr < write_ptr:
                 length = write_ptr - read_ptr
                 data = self._transceiver.read_memory(
                     placement.x, placement.y, read_ptr, length)
@@ -715,6 +951,235 @@ class BufferManager(object):
         return self._received_data.get_region_data_pointer(
             placement.x, placement.y, placement.p, recording_region_id)
 
+    def get_data_for_vertex_in_time_window(
+            self, placement, recording_region_id, start_time, end_time):
+        """ Get the data recorded by a framed region of a core within a\
+            window of time steps, without decoding the rest of the data
+
+        :param placement: the placement to get the data from
+        :type placement: pacman.model.placements.placement.Placement
+        :param recording_region_id: desired recording data region, which\
+            must have been recorded with framing enabled
+        :type recording_region_id: int
+        :param start_time: The first time step of the window
+        :type start_time: int
+        :param end_time: The time step after the last one of the window
+        :type end_time: int
+        :return: the records of the window, each preceded by its frame\
+            header, and a flag indicating if any data was lost
+        :rtype: (bytearray, bool)
+        """
+        if not (self._get_region_flags(placement, recording_region_id) &
+                recording_utilities.REGION_FLAG_FRAMED):
+            raise exceptions.ConfigurationException(
+                "Region {} of {} is not framed".format(
+                    recording_region_id, placement))
+
+        # Make sure that all the data has been retrieved
+        _, missing = self.get_data_for_vertex(placement, recording_region_id)
+        data = self._received_data.get_region_data_in_time_window(
+            placement.x, placement.y, placement.p, recording_region_id,
+            start_time, end_time)
+        return data, missing
+
+    def _retrieve_and_store_windowed_data(self, packet, placement):
+        """ Following a SpinnakerRequestReadData packet from a core that can\
+            have several requests outstanding, read the data of the request\
+            and store it once the data of all earlier requests is stored,\
+            then acknowledge all the requests read so far
+
+        :param packet: SpinnakerRequestReadData packet received from the\
+                SpiNNaker system
+        :type packet:\
+                :py:class:`spinnman.messages.eieio.command_messages.spinnaker_request_read_data.SpinnakerRequestReadData`
+        :param placement: The placement of the core that sent the packet
+        :return: None
+        """
+        x = packet.x
+        y = packet.y
+        p = packet.p
+        pkt_seq = packet.sequence_no
+        last_pkt_seq = self._received_data.last_sequence_no_for_core(x, y, p)
+
+        # Read the data of any new request now; the core will not overwrite
+        # it until the request is acknowledged.  Old or repeated requests
+        # only need acknowledging again.
+        distance = (pkt_seq - last_pkt_seq) % 256
+        if (0 < distance <= spinn_front_end_constants.MAX_READ_WINDOW and
+                not self._received_data.is_read_pending(x, y, p, pkt_seq)):
+            reads = list()
+            for i in xrange(packet.n_requests):
+                length = packet.space_to_be_read(i)
+                if length > 0:
+                    region_id = packet.region_id(i)
+                    data = self._transceiver.read_memory(
+                        x, y, packet.start_address(i), length)
+                    reads.append((region_id, data))
+            self._received_data.store_pending_read(x, y, p, pkt_seq, reads)
+            self._received_data.store_last_received_packet_from_core(
+                x, y, p, packet)
+
+            # Store the data of the requests that are now in order
+            next_pkt_seq = (last_pkt_seq + 1) % 256
+            while self._received_data.is_read_pending(x, y, p, next_pkt_seq):
+                reads = self._received_data.pop_pending_read(
+                    x, y, p, next_pkt_seq)
+                for region_id, data in reads:
+                    self._received_data.store_data_in_region_buffer(
+                        x, y, p, region_id, data)
+                self._received_data.store_read_history(
+                    x, y, p, next_pkt_seq,
+                    [(region_id, len(data)) for region_id, data in reads])
+                self._received_data.update_sequence_no_for_core(
+                    x, y, p, next_pkt_seq)
+                last_pkt_seq = next_pkt_seq
+                next_pkt_seq = (next_pkt_seq + 1) % 256
+
+        # Acknowledge all requests up to the last in order, and any after
+        # that have been read out of order
+        selective = 0
+        for i in xrange(32):
+            if self._received_data.is_read_pending(
+                    x, y, p, (last_pkt_seq + 1 + i) % 256):
+                selective |= 1 << i
+        ack_data = struct.pack(
+            "<HBBI",
+            0x4000 | spinn_front_end_constants.EIEIO_COMMAND_IDS
+            .HOST_DATA_READ_ACK.value,
+            last_pkt_seq, 0, selective)
+        return_message_header = SDPHeader(
+            destination_port=(
+                spinn_front_end_constants.SDP_PORTS
+                .OUTPUT_BUFFERING_SDP_PORT.value),
+            destination_cpu=p, destination_chip_x=x, destination_chip_y=y,
+            flags=SDPFlag.REPLY_NOT_EXPECTED)
+        return_message = SDPMessage(return_message_header, ack_data)
+        self._received_data.store_last_sent_packet_to_core(
+            x, y, p, return_message)
+        self._transceiver.send_sdp_message(return_message)
+
+    def _read_recording_header(self, placement, recording_region_id=0):
+        """ Read the whole recording header of a core in one read, and keep\
+            it and the flags of its regions
+
+        :param placement: the placement of the core
+        :param recording_region_id: a region that must be included
+        :rtype: RecordingHeader
+        """
+        n_regions = max(
+            [recording_region_id] +
+            list(placement.vertex.get_recorded_region_ids())) + 1
+        recording_data_address = \
+            placement.vertex.get_recording_region_base_address(
+                self._transceiver, placement)
+        header = recording_utilities.read_recording_header(
+            placement, self._transceiver, recording_data_address, n_regions)
+        self._recording_headers[placement.x, placement.y, placement.p] = \
+            header
+
+        # The flags must be known before any data of a region is stored, so
+        # that the data is decoded and indexed as it is stored
+        for region_id, flags in enumerate(header.region_flags):
+            if not self._received_data.is_region_flags_stored(
+                    placement.x, placement.y, placement.p, region_id):
+                self._received_data.store_region_flags(
+                    placement.x, placement.y, placement.p, region_id, flags)
+        return header
+
+    def _get_recording_header(self, placement):
+        """ Get the recording header of a core, reading it from the machine\
+            the first time it is needed; the parts of it that are used while\
+            running don't change
+
+        :param placement: the placement of the core
+        :rtype: RecordingHeader
+        """
+        header = self._recording_headers.get(
+            (placement.x, placement.y, placement.p))
+        if header is None:
+            header = self._read_recording_header(placement)
+        return header
+
+    def _get_read_window_size(self, placement):
+        """ Get the number of read requests that a core can have outstanding\
+            at once
+
+        :param placement: the placement of the core
+        :rtype: int
+        """
+        return self._get_recording_header(placement).read_window_size
+
+    def _get_region_flags(self, placement, recording_region_id):
+        """ Get the recording flags of a region of a core
+
+        :param placement: the placement of the core
+        :param recording_region_id: the region to get the flags of
+        :rtype: int
+        """
+        return self._get_recording_header(placement).region_flags[
+            recording_region_id]
+
+    def _read_pool_region(self, placement, pool_start, read_ptr, write_ptr):
+        """ Read the data of a pooled region, following the links between\
+            the chunks of the region from the one being read to the one being\
+            written
+
+        :param placement: the placement to read the data from
+        :param pool_start: the address of the first chunk of the pool
+        :param read_ptr: the start of the data in the region
+        :param write_ptr: the end of the data in the region
+        :rtype: bytearray
+        """
+        if read_ptr == write_ptr:
+            return bytearray()
+        chunk_size = self._get_recording_header(placement).pool_chunk_size
+
+        def chunk_of(address):
+            # Pointers can be anywhere from after the link to the very end
+            return pool_start + (
+                ((address - pool_start - 4) // chunk_size) * chunk_size)
+
+        data = bytearray()
+        write_chunk = chunk_of(write_ptr)
+        address = read_ptr
+        while chunk_of(address) != write_chunk:
+            chunk = chunk_of(address)
+            chunk_data = self._transceiver.read_memory(
+                placement.x, placement.y, chunk, chunk_size)
+            data.extend(chunk_data[address - chunk:])
+            address = struct.unpack_from("<I", chunk_data)[0] + 4
+        if write_ptr > address:
+            data.extend(self._transceiver.read_memory(
+                placement.x, placement.y, address, write_ptr - address))
+        return data
+
+    def _read_ring_region(
+            self, placement, start_ptr, end_ptr, read_ptr, write_ptr,
+            last_operation):
+        """ Read the retained window of a ring region, oldest data first
+
+        :param placement: the placement to read the data from
+        :param start_ptr: the start of the region
+        :param end_ptr: the end of the region
+        :param read_ptr: the start of the oldest record in the region
+        :param write_ptr: the end of the newest record in the region
+        :param last_operation: the last operation performed on the region
+        :rtype: bytearray
+        """
+        if read_ptr < write_ptr:
+            return self._transceiver.read_memory(
+                placement.x, placement.y, read_ptr, write_ptr - read_ptr)
+        if (read_ptr == write_ptr and
+                last_operation == spinn_front_end_constants.
+                BUFFERING_OPERATIONS.BUFFER_READ.value):
+            return bytearray()
+        data = bytearray(self._transceiver.read_memory(
+            placement.x, placement.y, read_ptr, end_ptr - read_ptr))
+        if write_ptr > start_ptr:
+            data.extend(self._transceiver.read_memory(
+                placement.x, placement.y, start_ptr, write_ptr - start_ptr))
+        return data
+
     def _retrieve_and_store_data(self, packet):
         """ Following a SpinnakerRequestReadData packet, the data stored\
            during the simulation needs to be read by the host and stored in a\
@@ -731,6 +1196,13 @@ class BufferManager(object):
         y = packet.y
         p = packet.p
 
+        # cores that can have several requests outstanding are handled
+        # separately
+        placement = self._placements.get_placement_on_processor(x, y, p)
+        if self._get_read_window_size(placement) > 1:
+            self._retrieve_and_store_windowed_data(packet, placement)
+            return
+
         # check packet sequence number
         pkt_seq = packet.sequence_no
         last_pkt_seq = self._received_data.last_sequence_no_for_core(x, y, p)
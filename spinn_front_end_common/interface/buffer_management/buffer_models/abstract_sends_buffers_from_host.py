@@ -47,6 +47,19 @@ class AbstractSendsBuffersFromHost(object):
         :rtype: int
         """
 
+    def is_direct_write(self, region):
+        """ Determine if the buffers of the region are to be refilled by\
+            writing them directly into the free space of the buffer on the\
+            machine, rather than by sending them as messages.  By default,\
+            they are sent as messages.
+
+        :param region: The region to determine the refill mode of
+        :type region: int
+        :return: True if the buffers are written directly, False otherwise
+        :rtype: bool
+        """
+        return False
+
     @abstractmethod
     def is_next_timestamp(self, region):
         """ Determine if there is another timestamp with data to be sent
@@ -14,15 +14,19 @@ class SendsBuffersFromHostPreBufferedImpl(
         which uses an existing set of buffers for the details
     """
 
-    def __init__(self, send_buffers):
+    def __init__(self, send_buffers, direct_writes=False):
         """
 
         :param send_buffers: A dictionary of the buffers of spikes to send,
                     indexed by the regions
         :type send_buffers: dict(int -> \
                     :py:class:`spinnaker.pyNN.buffer_management.storage_objects.buffered_sending_region.BufferedSendingRegion`)
+        :param direct_writes: True if the buffers are to be refilled by\
+                    writing directly into the memory of the machine
+        :type direct_writes: bool
         """
         self._send_buffers = send_buffers
+        self._direct_writes = direct_writes
 
     @property
     def send_buffers(self):
@@ -56,6 +60,14 @@ class SendsBuffersFromHostPreBufferedImpl(
         """
         return self._send_buffers[region].buffer_size
 
+    def is_direct_write(self, region):
+        """ Check if the buffers of a region are refilled by direct writes
+
+        :param region: the region to check
+        :return: bool
+        """
+        return self._direct_writes
+
     def is_next_timestamp(self, region):
         """ Check if there are more time stamps which need transmitting
 
@@ -1,5 +1,7 @@
 from spinn_front_end_common.interface.buffer_management.storage_objects\
     .channel_buffer_state import ChannelBufferState
+from spinn_front_end_common.interface.buffer_management.storage_objects\
+    .recording_header import RecordingHeader
 from spinn_front_end_common.utilities import constants
 
 from pacman.model.resources.resource_container import ResourceContainer
@@ -10,15 +12,65 @@ import struct
 import sys
 import math
 
-# The offset of the last sequence number field in bytes
-_LAST_SEQUENCE_NUMBER_OFFSET = 4 * 5
+# The offset of the pool chunk size field in bytes
+_POOL_CHUNK_SIZE_OFFSET = 4 * 8
+
+# The offset of the read window size field in bytes
+_READ_WINDOW_SIZE_OFFSET = 4 * 9
+
+# The offset of the state block in bytes
+_STATE_OFFSET = 4 * 10
+
+# The words of the state block before the state of the channels; the version
+# of the layout of the block, and the last sequence number
+_STATE_HEADER = struct.Struct("<II")
+
+# The version of the layout of the state block (see recording.c)
+_STATE_VERSION = 1
 
-# The offset of the memory addresses in bytes
-_FIRST_REGION_ADDRESS_OFFSET = 4 * 6
+# The offset of the number of regions in bytes
+_N_REGIONS_OFFSET = 0
 
 # The Buffer traffic type
 TRAFFIC_IDENTIFIER = "BufferTraffic"
 
+# Flag for a region that overwrites its oldest records when full
+# (see recording.h)
+REGION_FLAG_RING = 0x1
+
+# Flag for a region where each record is stamped with the time step in which
+# it was recorded (see recording.h)
+REGION_FLAG_FRAMED = 0x2
+
+# Flag for a region that records into the pool shared by the regions of a
+# core (see recording.h)
+REGION_FLAG_POOLED = 0x4
+
+# Flag for a region in which each record is compressed against the record
+# before it (see recording.h)
+REGION_FLAG_COMPRESSED = 0x8
+
+# The number of bytes of the previous record that each record of a compressed
+# region is compared against (see recording.h)
+COMPRESSION_HISTORY_SIZE = 256
+
+# The number of bits of the length of a compressed record that hold the level
+# of callback nesting at which it was made (see recording.h)
+COMPRESSION_LEVEL_BITS = 2
+
+# The number of levels of callback nesting that compressed records are made at
+COMPRESSION_LEVELS = 1 << COMPRESSION_LEVEL_BITS
+
+# The default size of each chunk of a recording pool, which is also the
+# largest record that can be recorded into the pool
+DEFAULT_POOL_CHUNK_SIZE = 4096
+
+# The most chunks that a recording pool can have (see recording.c)
+MAX_POOL_CHUNKS = 65536
+
+# The size of the length word in front of each record of a ring region
+_RING_RECORD_HEADER_SIZE = 4
+
 
 def get_recording_header_size(n_recorded_regions):
     """ Get the size of the data to be written for the recording header
@@ -27,7 +79,24 @@ def get_recording_header_size(n_recorded_regions):
     """
 
     # See recording.h/recording_initialise for data included in the header
-    return (6 + (2 * n_recorded_regions)) * 4
+    return (
+        _STATE_OFFSET + get_recording_state_size(n_recorded_regions) +
+        (4 * n_recorded_regions * 4))
+
+
+def get_recording_state_size(n_recorded_regions):
+    """ Get the size of the state block in the recording header, which holds\
+        the state of the recording of a core once recording is complete
+
+    :param n_recorded_regions: The number of regions to be recorded
+    """
+    return _STATE_HEADER.size + (
+        n_recorded_regions * ChannelBufferState.size_of_channel_state())
+
+
+def _get_region_arrays_offset(n_recorded_regions):
+    # The arrays of the regions follow the state block
+    return _STATE_OFFSET + get_recording_state_size(n_recorded_regions)
 
 
 def get_recording_data_size(recorded_region_sizes):
@@ -40,15 +109,30 @@ def get_recording_data_size(recorded_region_sizes):
     """
     return (
 
-        # The total recording data size
-        sum(recorded_region_sizes) +
+        # The total recording data size, with each region starting on a word
+        # boundary of one block
+        sum((size + 3) & ~0x3 for size in recorded_region_sizes) +
+
+        # The SARK allocation of SDRAM overhead
+        constants.SARK_PER_MALLOC_SDRAM_USAGE
+    )
+
+
+def get_recording_pool_data_size(pool_size):
+    """ Get the size of the recorded data to be reserved when the regions\
+        share a pool
+
+    :param pool_size: The size of the pool
+    :type pool_size: int
+    :rtype: int
+    """
+    return (
 
-        # The storage of the recording state
-        (len(recorded_region_sizes) *
-         ChannelBufferState.size_of_channel_state()) +
+        # The pool, in one block
+        pool_size +
 
         # The SARK allocation of SDRAM overhead
-        (len(recorded_region_sizes) * constants.SARK_PER_MALLOC_SDRAM_USAGE)
+        constants.SARK_PER_MALLOC_SDRAM_USAGE
     )
 
 
@@ -127,7 +211,7 @@ def get_recording_region_sizes(
 
 def get_recording_resources(
         region_sizes, buffering_ip_address=None,
-        buffering_port=None, notification_tag=None):
+        buffering_port=None, notification_tag=None, pool_size=None):
     """ Get the resources for recording
 
     :param region_sizes:\
@@ -145,6 +229,11 @@ def get_recording_resources(
     :param notification_tag:\
         The tag to send buffering messages with, or None to use a default tag
     :type notification_tag: int
+    :param pool_size:\
+        The size of a pool of SDRAM to be shared by the regions, or None if\
+        each region is to have its own SDRAM.  When a pool is used, the\
+        region sizes are the most of the pool that each region can use.
+    :type pool_size: int
     :rtype:\
         :py:class:`pacman.model.resources.resource_container.ResourceContainer`
     """
@@ -157,6 +246,12 @@ def get_recording_resources(
         ))
 
     # return the resources including the SDRAM requirements
+    if pool_size is not None:
+        return ResourceContainer(
+            iptags=ip_tags,
+            sdram=SDRAMResource(
+                get_recording_header_size(len(region_sizes)) +
+                get_recording_pool_data_size(pool_size)))
     return ResourceContainer(
         iptags=ip_tags,
         sdram=SDRAMResource(
@@ -197,7 +292,10 @@ def get_recorded_region_sizes(
 def get_recording_header_array(
         recorded_region_sizes,
         time_between_triggers=0, buffer_size_before_request=None, ip_tags=None,
-        buffering_tag=None):
+        buffering_tag=None, staging_buffer_size=0, round_trip_time=0,
+        ring_regions=None, framed_regions=None, pool_size=0,
+        pool_chunk_size=DEFAULT_POOL_CHUNK_SIZE, minimum_region_sizes=None,
+        read_window_size=1, compressed_regions=None):
     """ Get data to be written for the recording header
 
     :param recorded_region_sizes:\
@@ -209,6 +307,50 @@ def get_recording_header_array(
         The amount of buffer to fill before a read request is sent
     :param ip_tags: A list of ip tags to extract the buffer tag from
     :param buffering_tag: The tag to use for buffering requests
+    :param staging_buffer_size:\
+        The size in bytes of each of the two DTCM buffers in which records\
+        of each region are staged before being written to SDRAM by DMA, or 0\
+        to write records directly to SDRAM.  Records larger than this size\
+        cannot be recorded when staging is in use.
+    :param round_trip_time:\
+        The estimated time in timer ticks for the host to respond to a read\
+        request, or 0 to request reads at buffer_size_before_request.  When\
+        non-zero, each region tracks the average rate at which it is filled,\
+        and a read is requested when the region would otherwise fill before\
+        the host could respond; regions that are not being written to do\
+        not request reads.
+    :param ring_regions:\
+        The indices of the regions which, when full, overwrite their oldest\
+        records rather than dropping new ones, so that only the most recent\
+        records are kept.  These regions are only read once the run is\
+        complete.
+    :param framed_regions:\
+        The indices of the regions in which each record is preceded by the\
+        time step in which it was recorded and its length, as two 32-bit\
+        words.  The data of these regions can be retrieved by time window.
+    :param pool_size:\
+        The size of a pool of SDRAM to be shared by the regions, or 0 if each\
+        region is to have its own SDRAM.  When a pool is used, the region\
+        sizes are the most of the pool that each region can use, and no\
+        region can be a ring region.
+    :param pool_chunk_size:\
+        The size of each chunk of the pool; no record can be larger than this\
+        less 4 bytes.  A record of a compressed region needs space for the\
+        largest that it could be once encoded, which is 8 bytes and a 128th\
+        more than the record.
+    :param minimum_region_sizes:\
+        The part of the pool that each region is guaranteed to be able to\
+        use, or None if no region is guaranteed any
+    :param read_window_size:\
+        The number of read requests that can be waiting for the host at\
+        once, up to constants.MAX_READ_WINDOW.  With 1, each request must be\
+        read before the next is sent.
+    :param compressed_regions:\
+        The indices of the regions in which each record is compressed\
+        against the record before it, which reduces the data to be read\
+        when records are much alike.  The data is decompressed as it is\
+        received.  These regions can only be recorded into with\
+        recording_record, and cannot be ring regions.
     :return: An array of values to be written as the header
     :rtype: list of int
     """
@@ -241,9 +383,15 @@ def get_recording_header_array(
         # that the buffering will not be activated
         data.append(max(recorded_region_sizes) + 256)
     data.append(time_between_triggers)
+    data.append(staging_buffer_size)
+    data.append(round_trip_time)
+    data.append(pool_size)
+    data.append(pool_chunk_size)
+    data.append(min(read_window_size, constants.MAX_READ_WINDOW))
 
-    # The last sequence number (to be filled in by C code)
-    data.append(0)
+    # The state block (to be filled in by C code)
+    data.extend([0 for _ in xrange(
+        get_recording_state_size(len(recorded_region_sizes)) // 4)])
 
     # The pointers for each region (to be filled in by C code)
     data.extend([0 for _ in recorded_region_sizes])
@@ -251,39 +399,130 @@ def get_recording_header_array(
     # The size of the regions
     data.extend(recorded_region_sizes)
 
+    # The flags of the regions
+    flags = [0 for _ in recorded_region_sizes]
+    if ring_regions is not None:
+        if pool_size > 0 and len(ring_regions) > 0:
+            raise Exception("Ring regions cannot be recorded into a pool")
+        for region in ring_regions:
+            flags[region] |= REGION_FLAG_RING
+    if framed_regions is not None:
+        for region in framed_regions:
+            flags[region] |= REGION_FLAG_FRAMED
+    if compressed_regions is not None:
+        for region in compressed_regions:
+            if flags[region] & REGION_FLAG_RING:
+                raise Exception(
+                    "Ring region {} cannot be compressed".format(region))
+            flags[region] |= REGION_FLAG_COMPRESSED
+    if pool_size > 0:
+        if pool_size // pool_chunk_size > MAX_POOL_CHUNKS:
+            raise Exception(
+                "A pool of {} bytes has more than {} chunks of {} "
+                "bytes".format(pool_size, MAX_POOL_CHUNKS, pool_chunk_size))
+        flags = [flag | REGION_FLAG_POOLED for flag in flags]
+    data.extend(flags)
+
+    # The minimum sizes of the regions in the pool
+    if minimum_region_sizes is not None:
+        if sum(minimum_region_sizes) > pool_size:
+            raise Exception(
+                "The minimum region sizes do not fit in the pool")
+        data.extend(minimum_region_sizes)
+    else:
+        data.extend([0 for _ in recorded_region_sizes])
+
     return data
 
 
-def get_last_sequence_number(placement, transceiver, recording_data_address):
-    """ Read the last sequence number from the data
+def read_recording_header(
+        placement, transceiver, recording_data_address, n_regions):
+    """ Read the recording header of a core, including its state block, in\
+        one read.  A second read is only needed if the core has more regions\
+        than expected.
 
-    :param placement: The placement from which to read the sequence number
-    :param transceiver: The transceiver to use to read the sequence number
+    :param placement: The placement from which to read the header
+    :param transceiver: The transceiver to use to read the header
     :param recording_data_address:\
-        The address of the recording data from which to read the number
-    :rtype: int
+        The address of the recording data from which to read the header
+    :param n_regions:\
+        The number of regions that the core is expected to have
+    :rtype: RecordingHeader
     """
     data = transceiver.read_memory(
-        placement.x, placement.y,
-        recording_data_address + _LAST_SEQUENCE_NUMBER_OFFSET, 4)
-    return struct.unpack_from("<I", data)[0]
+        placement.x, placement.y, recording_data_address,
+        get_recording_header_size(n_regions))
+    actual_n_regions = struct.unpack_from("<I", data, _N_REGIONS_OFFSET)[0]
+    if actual_n_regions > n_regions:
+        n_regions = actual_n_regions
+        data = transceiver.read_memory(
+            placement.x, placement.y, recording_data_address,
+            get_recording_header_size(n_regions))
+    return parse_recording_header(data)
+
+
+def parse_recording_header(data):
+    """ Parse the recording header of a core
+
+    :param data: The data of the header, from its start up to at least the\
+        end of the flags of the regions
+    :type data: bytearray
+    :rtype: RecordingHeader
+    """
+    n_regions = struct.unpack_from("<I", data, _N_REGIONS_OFFSET)[0]
+    pool_chunk_size = struct.unpack_from(
+        "<I", data, _POOL_CHUNK_SIZE_OFFSET)[0] & ~0x3
+    read_window_size = struct.unpack_from(
+        "<I", data, _READ_WINDOW_SIZE_OFFSET)[0]
+    state_version, last_sequence_number = _STATE_HEADER.unpack_from(
+        data, _STATE_OFFSET)
+    size = ChannelBufferState.size_of_channel_state()
+    states_offset = _STATE_OFFSET + _STATE_HEADER.size
+    channel_states = [
+        ChannelBufferState.create_from_bytearray(str(
+            data[states_offset + (i * size):
+                 states_offset + ((i + 1) * size)]))
+        for i in xrange(n_regions)]
+    arrays_offset = _get_region_arrays_offset(n_regions)
+    region_pointers = list(struct.unpack_from(
+        "<{}I".format(n_regions), data, arrays_offset))
+    region_flags = list(struct.unpack_from(
+        "<{}I".format(n_regions), data, arrays_offset + (2 * n_regions * 4)))
+    return RecordingHeader(
+        read_window_size, pool_chunk_size, region_pointers, region_flags,
+        state_version, last_sequence_number, channel_states)
+
+
+def check_recording_state(placement, header):
+    """ Check that the state block of a recording header has been written\
+        with the expected layout, which happens once recording is complete
+
+    :param placement: The placement that the header was read from
+    :param header: The header to check
+    :type header: RecordingHeader
+    """
+    if header.state_version != _STATE_VERSION:
+        raise Exception(
+            "The recording state of {} has version {} instead of {}".format(
+                placement, header.state_version, _STATE_VERSION))
 
 
-def get_region_pointer(placement, transceiver, recording_data_address, region):
-    """ Get a pointer to a recording region
+def get_records_from_ring_data(data):
+    """ Get the records from the data of a ring region, removing the length\
+        and padding added to each record
 
-    :param placement: The placement from which to read the pointer
-    :param transceiver: The transceiver to use to read the pointer
-    :param recording_data_address:\
-        The address of the recording data from which to read the pointer
-    :param region: The index of the region to get the pointer of
-    :rtype: int
+    :param data: The data read from the region, starting at the oldest record
+    :type data: bytearray
+    :rtype: bytearray
     """
-    data = transceiver.read_memory(
-        placement.x, placement.y,
-        recording_data_address + _FIRST_REGION_ADDRESS_OFFSET + (region * 4),
-        4)
-    return struct.unpack_from("<I", data)[0]
+    records = bytearray()
+    offset = 0
+    while offset + _RING_RECORD_HEADER_SIZE <= len(data):
+        length = struct.unpack_from("<I", data, offset)[0]
+        offset += _RING_RECORD_HEADER_SIZE
+        records.extend(data[offset:offset + length])
+        offset += (length + 3) & ~0x3
+    return records
 
 
 def get_n_timesteps_in_buffer_space(buffer_space, buffered_sdram_per_timestep):
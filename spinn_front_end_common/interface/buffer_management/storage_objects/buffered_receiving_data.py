@@ -3,6 +3,12 @@ from spinn_storage_handlers.buffered_bytearray_data_storage \
     import BufferedBytearrayDataStorage
 from spinn_storage_handlers.buffered_tempfile_data_storage \
     import BufferedTempfileDataStorage
+from spinn_front_end_common.interface.buffer_management.storage_objects\
+    .region_frame_index import RegionFrameIndex
+from spinn_front_end_common.interface.buffer_management.storage_objects\
+    .region_decoder import RegionDecoder
+from spinn_front_end_common.interface.buffer_management \
+    import recording_utilities
 
 
 class BufferedReceivingData(object):
@@ -37,7 +43,22 @@ class BufferedReceivingData(object):
         "_end_buffering_sequence_no",
 
         # dict of end state by core
-        "_end_buffering_state"
+        "_end_buffering_state",
+
+        # dict of recording flags by region
+        "_region_flags",
+
+        # dict of index of the times of the data by framed region
+        "_frame_index",
+
+        # dict of decoder of the data by compressed region
+        "_decoders",
+
+        # dict of data read out of order, by sequence number, by core
+        "_pending_reads",
+
+        # dict of the space read by each region, by sequence number, by core
+        "_read_history"
     ]
 
     def __init__(self, store_to_file=False):
@@ -60,6 +81,11 @@ class BufferedReceivingData(object):
         self._last_packet_sent = defaultdict(lambda: None)
         self._end_buffering_sequence_no = dict()
         self._end_buffering_state = dict()
+        self._region_flags = dict()
+        self._frame_index = defaultdict(RegionFrameIndex)
+        self._decoders = defaultdict(RegionDecoder)
+        self._pending_reads = defaultdict(dict)
+        self._read_history = defaultdict(dict)
 
     def store_data_in_region_buffer(self, x, y, p, region, data):
         """ Store some information in the correspondent buffer class for a\
@@ -76,7 +102,12 @@ class BufferedReceivingData(object):
         :param data: data to be stored
         :type data: bytearray
         """
+        flags = self._region_flags.get((x, y, p, region), 0)
+        if flags & recording_utilities.REGION_FLAG_COMPRESSED:
+            data = self._decoders[x, y, p, region].decode(data)
         self._data[x, y, p, region].write(data)
+        if flags & recording_utilities.REGION_FLAG_FRAMED:
+            self._frame_index[x, y, p, region].add_data(data)
 
     def is_data_from_region_flushed(self, x, y, p, region):
         """ Check if the data region has been flushed
@@ -247,6 +278,181 @@ class BufferedReceivingData(object):
         data_pointer = self._data[x, y, p, region]
         return data_pointer, missing
 
+    def get_region_data_in_time_window(
+            self, x, y, p, region, start_time, end_time):
+        """ Get the data stored for a given framed region of a given core\
+            that was recorded within a window of time
+
+        :param x: x coordinate of the chip
+        :type x: int
+        :param y: y coordinate of the chip
+        :type y: int
+        :param p: Core within the specified chip
+        :type p: int
+        :param region: Region containing the data
+        :type region: int
+        :param start_time: The first time step of the window
+        :type start_time: int
+        :param end_time: The time step after the last one of the window
+        :type end_time: int
+        :return: the records of the window, each with its frame header
+        :rtype: bytearray
+        """
+        start, end = self._frame_index[x, y, p, region].get_range(
+            start_time, end_time)
+        if end <= start:
+            return bytearray()
+        data_pointer = self._data[x, y, p, region]
+        data_pointer.seek_read(start)
+        return data_pointer.read(end - start)
+
+    def store_region_flags(self, x, y, p, region, flags):
+        """ Store the recording flags of a region; this must be done before\
+            any data of the region is stored
+
+        :param x: x coordinate of the chip
+        :type x: int
+        :param y: y coordinate of the chip
+        :type y: int
+        :param p: Core within the specified chip
+        :type p: int
+        :param region: The region that the flags are for
+        :type region: int
+        :param flags: The flags of the region
+        :type flags: int
+        """
+        self._region_flags[x, y, p, region] = flags
+
+    def is_region_flags_stored(self, x, y, p, region):
+        """ Determine if the recording flags of a region have been stored
+
+        :param x: x coordinate of the chip
+        :type x: int
+        :param y: y coordinate of the chip
+        :type y: int
+        :param p: Core within the specified chip
+        :type p: int
+        :param region: The region to check
+        :type region: int
+        :rtype: bool
+        """
+        return (x, y, p, region) in self._region_flags
+
+    def get_region_flags(self, x, y, p, region):
+        """ Get the recording flags of a region
+
+        :param x: x coordinate of the chip
+        :type x: int
+        :param y: y coordinate of the chip
+        :type y: int
+        :param p: Core within the specified chip
+        :type p: int
+        :param region: The region to get the flags of
+        :type region: int
+        :rtype: int
+        """
+        return self._region_flags[x, y, p, region]
+
+    def store_pending_read(self, x, y, p, sequence_no, reads):
+        """ Store the data of a read request that has been read before the\
+            requests before it
+
+        :param x: x coordinate of the chip
+        :type x: int
+        :param y: y coordinate of the chip
+        :type y: int
+        :param p: Core within the specified chip
+        :type p: int
+        :param sequence_no: The sequence number of the request
+        :type sequence_no: int
+        :param reads: The region and data of each read of the request
+        :type reads: list of (int, bytearray)
+        """
+        self._pending_reads[x, y, p][sequence_no] = reads
+
+    def is_read_pending(self, x, y, p, sequence_no):
+        """ Determine if the data of a read request is waiting to be stored
+
+        :param x: x coordinate of the chip
+        :type x: int
+        :param y: y coordinate of the chip
+        :type y: int
+        :param p: Core within the specified chip
+        :type p: int
+        :param sequence_no: The sequence number of the request
+        :type sequence_no: int
+        :rtype: bool
+        """
+        return sequence_no in self._pending_reads[x, y, p]
+
+    def pop_pending_read(self, x, y, p, sequence_no):
+        """ Remove and return the data of a read request waiting to be stored
+
+        :param x: x coordinate of the chip
+        :type x: int
+        :param y: y coordinate of the chip
+        :type y: int
+        :param p: Core within the specified chip
+        :type p: int
+        :param sequence_no: The sequence number of the request
+        :type sequence_no: int
+        :return: The region and data of each read of the request
+        :rtype: list of (int, bytearray)
+        """
+        return self._pending_reads[x, y, p].pop(sequence_no)
+
+    def store_read_history(self, x, y, p, sequence_no, reads):
+        """ Store the space read from each region by a read request, in case\
+            the core has not applied the request by the end of the run
+
+        :param x: x coordinate of the chip
+        :type x: int
+        :param y: y coordinate of the chip
+        :type y: int
+        :param p: Core within the specified chip
+        :type p: int
+        :param sequence_no: The sequence number of the request
+        :type sequence_no: int
+        :param reads: The region and space read of each read of the request
+        :type reads: list of (int, int)
+        """
+        self._read_history[x, y, p][sequence_no] = reads
+
+    def get_read_history_space(
+            self, x, y, p, region, first_sequence_no, last_sequence_no,
+            max_requests):
+        """ Get the space read from a region by a range of read requests
+
+        :param x: x coordinate of the chip
+        :type x: int
+        :param y: y coordinate of the chip
+        :type y: int
+        :param p: Core within the specified chip
+        :type p: int
+        :param region: The region to get the space read from
+        :type region: int
+        :param first_sequence_no: The sequence number of the first request
+        :type first_sequence_no: int
+        :param last_sequence_no: The sequence number of the last request
+        :type last_sequence_no: int
+        :param max_requests:\
+            The most requests that the range can hold; a longer range is\
+            taken to be empty
+        :type max_requests: int
+        :rtype: int
+        """
+        n_requests = ((last_sequence_no - first_sequence_no) % 256) + 1
+        if n_requests > max_requests:
+            return 0
+        history = self._read_history[x, y, p]
+        space = 0
+        for i in xrange(n_requests):
+            sequence_no = (first_sequence_no + i) % 256
+            for read_region, space_read in history.get(sequence_no, []):
+                if read_region == region:
+                    space += space_read
+        return space
+
     def store_end_buffering_state(self, x, y, p, region, state):
         """ Store the end state of buffering
 
@@ -332,7 +538,11 @@ class BufferedReceivingData(object):
         """ Resets states so that it can behave in a resumed mode
         """
         self._end_buffering_state = dict()
+        self._end_buffering_sequence_no = dict()
         self._is_flushed = defaultdict(lambda: False)
         self._sequence_no = defaultdict(lambda: 0xFF)
         self._last_packet_received = defaultdict(lambda: None)
         self._last_packet_sent = defaultdict(lambda: None)
+        self._pending_reads = defaultdict(dict)
+        self._read_history = defaultdict(dict)
+        self._decoders = defaultdict(RegionDecoder)
@@ -0,0 +1,148 @@
+# The total number of sequence numbers
+_N_SEQUENCES = 256
+
+
+class DirectWriteState(object):
+    """ A tracker of the data written directly into the buffer of a region\
+        on the machine, and published to the core with a sequenced command
+    """
+
+    __slots__ = [
+        # The region being managed
+        "_region",
+
+        # The address of the buffer of the region on the machine
+        "_buffer_address",
+
+        # The size of the buffer of the region on the machine
+        "_buffer_size",
+
+        # The offset in the buffer at which the next data is to be written
+        "_write_offset",
+
+        # The sequence number of the last publish received by the core
+        "_last_received_sequence_number",
+
+        # The number of bytes written but not yet known to be published,
+        # or None if there are none
+        "_pending_n_bytes",
+
+        # True if the stop message has been written
+        "_sent_stop_message"
+    ]
+
+    def __init__(
+            self, region, buffer_address, buffer_size,
+            sent_stop_message=False):
+        """
+
+        :param region: The region being managed
+        :type region: int
+        :param buffer_address: The address of the buffer of the region on\
+            the machine
+        :type buffer_address: int
+        :param buffer_size: The size of the buffer of the region on the\
+            machine, which is assumed to be full from its start
+        :type buffer_size: int
+        :param sent_stop_message: True if the stop message has been written
+        :type sent_stop_message: bool
+        """
+        self._region = region
+        self._buffer_address = buffer_address
+        self._buffer_size = buffer_size
+        self._write_offset = 0
+        self._last_received_sequence_number = _N_SEQUENCES - 1
+        self._pending_n_bytes = None
+        self._sent_stop_message = sent_stop_message
+
+    @property
+    def region(self):
+        """ The region being managed
+
+        :rtype: int
+        """
+        return self._region
+
+    @property
+    def write_offset(self):
+        """ The offset in the buffer at which the next data is to be written,\
+            or at which the pending data was written
+
+        :rtype: int
+        """
+        return self._write_offset
+
+    @property
+    def next_sequence_number(self):
+        """ The sequence number of the next publish, or of the pending publish
+
+        :rtype: int
+        """
+        return (self._last_received_sequence_number + 1) % _N_SEQUENCES
+
+    @property
+    def pending_n_bytes(self):
+        """ The number of bytes written but not yet known to be published,\
+            or None if there are none
+
+        :rtype: int or None
+        """
+        return self._pending_n_bytes
+
+    @property
+    def sent_stop_message(self):
+        """ True if the stop message has been written
+
+        :rtype: bool
+        """
+        return self._sent_stop_message
+
+    def get_spans(self, n_bytes):
+        """ Get the parts of the buffer that the next data will be written\
+            to, split in two if it wraps around the end of the buffer
+
+        :param n_bytes: The number of bytes to be written
+        :type n_bytes: int
+        :return: The address and the number of bytes of each part
+        :rtype: list of (int, int)
+        """
+        first_n_bytes = min(n_bytes, self._buffer_size - self._write_offset)
+        spans = [(self._buffer_address + self._write_offset, first_n_bytes)]
+        if first_n_bytes < n_bytes:
+            spans.append((self._buffer_address, n_bytes - first_n_bytes))
+        return spans
+
+    def add_pending(self, n_bytes, is_stop_message):
+        """ Record that data has been written and is to be published
+
+        :param n_bytes: The number of bytes written
+        :type n_bytes: int
+        :param is_stop_message: True if the data ends with the stop message
+        :type is_stop_message: bool
+        """
+        self._pending_n_bytes = n_bytes
+        if is_stop_message:
+            self._sent_stop_message = True
+
+    def update_last_received_sequence_number(self, last_received_sequence_no):
+        """ Updates the last sequence number received by the core, moving on\
+            past the pending data if the core has received its publish.  The\
+            space reported along with any other sequence number does not\
+            account for all of the data written, so it can't be used.
+
+        :param last_received_sequence_no: The new sequence number
+        :type last_received_sequence_no: int
+        :return: True if all of the data written has been published, False\
+            otherwise
+        :rtype: bool
+        """
+        if self._pending_n_bytes is None:
+            return (last_received_sequence_no ==
+                    self._last_received_sequence_number)
+        if last_received_sequence_no != self.next_sequence_number:
+            return False
+        self._write_offset = (
+            (self._write_offset + self._pending_n_bytes) % self._buffer_size)
+        self._last_received_sequence_number = last_received_sequence_no
+        self._pending_n_bytes = None
+        return True
@@ -0,0 +1,124 @@
+class RecordingHeader(object):
+    """ The recording header of a core, as read from the machine in one go:\
+        the parameters that the host needs, the region pointers and flags,\
+        and the state block
+    """
+
+    __slots__ = [
+        # The number of read requests that can be outstanding at once
+        "_read_window_size",
+
+        # The size of the chunks of the recording pool
+        "_pool_chunk_size",
+
+        # The address of each region
+        "_region_pointers",
+
+        # The flags of each region
+        "_region_flags",
+
+        # The version of the layout of the state block, which is only set
+        # once recording is complete
+        "_state_version",
+
+        # The last sequence number sent by the core
+        "_last_sequence_number",
+
+        # The state of each region
+        "_channel_states"
+    ]
+
+    def __init__(
+            self, read_window_size, pool_chunk_size, region_pointers,
+            region_flags, state_version, last_sequence_number,
+            channel_states):
+        """
+
+        :param read_window_size: The number of read requests that can be\
+            outstanding at once
+        :type read_window_size: int
+        :param pool_chunk_size: The size of the chunks of the recording pool
+        :type pool_chunk_size: int
+        :param region_pointers: The address of each region
+        :type region_pointers: list of int
+        :param region_flags: The flags of each region
+        :type region_flags: list of int
+        :param state_version: The version of the layout of the state block
+        :type state_version: int
+        :param last_sequence_number: The last sequence number sent by the core
+        :type last_sequence_number: int
+        :param channel_states: The state of each region
+        :type channel_states: list of ChannelBufferState
+        """
+        self._read_window_size = read_window_size
+        self._pool_chunk_size = pool_chunk_size
+        self._region_pointers = region_pointers
+        self._region_flags = region_flags
+        self._state_version = state_version
+        self._last_sequence_number = last_sequence_number
+        self._channel_states = channel_states
+
+    @property
+    def n_regions(self):
+        """ The number of regions of the core
+
+        :rtype: int
+        """
+        return len(self._region_flags)
+
+    @property
+    def read_window_size(self):
+        """ The number of read requests that can be outstanding at once
+
+        :rtype: int
+        """
+        return self._read_window_size
+
+    @property
+    def pool_chunk_size(self):
+        """ The size of the chunks of the recording pool
+
+        :rtype: int
+        """
+        return self._pool_chunk_size
+
+    @property
+    def region_pointers(self):
+        """ The address of each region
+
+        :rtype: list of int
+        """
+        return self._region_pointers
+
+    @property
+    def region_flags(self):
+        """ The flags of each region
+
+        :rtype: list of int
+        """
+        return self._region_flags
+
+    @property
+    def state_version(self):
+        """ The version of the layout of the state block, which is 0 until\
+            recording is complete, and again once the core has been reset
+
+        :rtype: int
+        """
+        return self._state_version
+
+    @property
+    def last_sequence_number(self):
+        """ The last sequence number sent by the core
+
+        :rtype: int
+        """
+        return self._last_sequence_number
+
+    @property
+    def channel_states(self):
+        """ The state of each region
+
+        :rtype: list of ChannelBufferState
+        """
+        return self._channel_states
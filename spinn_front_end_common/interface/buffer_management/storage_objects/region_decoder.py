@@ -0,0 +1,99 @@
+from spinn_front_end_common.interface.buffer_management \
+    import recording_utilities
+
+
+class RegionDecoder(object):
+    """ Decodes the data of a compressed recording region, in which each\
+        record is encoded against the record before it made at the same\
+        level of callback nesting (see recording.h), as the data is received
+    """
+
+    __slots__ = [
+        # The data received that does not yet make up a whole record
+        "_pending",
+
+        # The start of the last record decoded at each level of nesting
+        "_histories"
+    ]
+
+    def __init__(self):
+        self._pending = bytearray()
+        self._histories = [
+            bytearray()
+            for _ in xrange(recording_utilities.COMPRESSION_LEVELS)]
+
+    def decode(self, data):
+        """ Decode some more data received from the region
+
+        :param data: The data, which follows on from the data already decoded
+        :type data: bytearray
+        :return: The records that are now complete
+        :rtype: bytearray
+        """
+        self._pending.extend(data)
+        records = bytearray()
+        offset = 0
+        while True:
+
+            # Padding is left where a record needed less space than it was
+            # given
+            while (offset < len(self._pending) and
+                    self._pending[offset] == 0):
+                offset += 1
+            decoded = self._decode_record(offset)
+            if decoded is None:
+                break
+            record, offset = decoded
+            records.extend(record)
+        del self._pending[:offset]
+        return records
+
+    def _read_varint(self, offset):
+        value = 0
+        shift = 0
+        while offset < len(self._pending):
+            byte = self._pending[offset]
+            offset += 1
+            value |= (byte & 0x7F) << shift
+            if not byte & 0x80:
+                return value, offset
+            shift += 7
+        return None
+
+    def _decode_record(self, offset):
+        """ Decode the record starting at the given offset of the pending\
+            data, if all of it has been received
+
+        :return: The record and the offset after it, or None
+        """
+        header = self._read_varint(offset)
+        if header is None:
+            return None
+        value, offset = header
+        length = value >> recording_utilities.COMPRESSION_LEVEL_BITS
+        level = value & (recording_utilities.COMPRESSION_LEVELS - 1)
+
+        # Bytes not sent are the same as those of the last record
+        record = bytearray(self._histories[level][:length])
+        record.extend(bytearray(length - len(record)))
+        index = 0
+        while index < length:
+            same = self._read_varint(offset)
+            if same is None:
+                return None
+            n_same, offset = same
+            diff = self._read_varint(offset)
+            if diff is None:
+                return None
+            n_diff, offset = diff
+            if offset + n_diff > len(self._pending):
+                return None
+            index += n_same
+            for i in xrange(n_diff):
+                record[index + i] ^= self._pending[offset + i]
+            index += n_diff
+            offset += n_diff
+
+        self._histories[level] = record[
+            :recording_utilities.COMPRESSION_HISTORY_SIZE]
+        return record, offset
@@ -0,0 +1,90 @@
+import bisect
+import struct
+
+# The header in front of each record of a framed region (see recording.h)
+_FRAME_HEADER = struct.Struct("<II")
+
+
+class RegionFrameIndex(object):
+    """ An index of where the records of each time step start in the data\
+        of a framed recording region, built up as the data is received
+    """
+
+    __slots__ = [
+        # The distinct times of the records, in the order received
+        "_times",
+
+        # The offset in the data of the first record of each time
+        "_offsets",
+
+        # The offset in the data of the last record header
+        "_last_frame",
+
+        # The offset in the data of the next record header
+        "_next_frame",
+
+        # The number of bytes of data indexed so far
+        "_received",
+
+        # The part of a record header received so far
+        "_header"
+    ]
+
+    def __init__(self):
+        self._times = list()
+        self._offsets = list()
+        self._last_frame = 0
+        self._next_frame = 0
+        self._received = 0
+        self._header = bytearray()
+
+    def add_data(self, data):
+        """ Index some more data received from the region
+
+        :param data: The data, which follows on from the data already indexed
+        :type data: bytearray
+        """
+        data_start = self._received
+        self._received += len(data)
+
+        # Records and their headers can be split across reads
+        offset = self._next_frame + len(self._header) - data_start
+        while offset < len(data):
+            needed = _FRAME_HEADER.size - len(self._header)
+            self._header.extend(data[offset:offset + needed])
+            if len(self._header) < _FRAME_HEADER.size:
+                break
+            time, length = _FRAME_HEADER.unpack_from(bytes(self._header))
+            if len(self._times) == 0 or self._times[-1] != time:
+                self._times.append(time)
+                self._offsets.append(self._next_frame)
+            self._last_frame = self._next_frame
+            self._next_frame += _FRAME_HEADER.size + length
+            self._header = bytearray()
+            offset = self._next_frame - data_start
+
+    def get_range(self, start_time, end_time):
+        """ Get the range of the data that holds the records of a time window
+
+        :param start_time: The first time step of the window
+        :type start_time: int
+        :param end_time: The time step after the last one of the window
+        :type end_time: int
+        :return: The offset of the first byte of the window, and the offset\
+            after the last byte
+        :rtype: (int, int)
+        """
+
+        # Leave out any record that has not been completely received
+        end_of_data = self._next_frame
+        if self._received < self._next_frame:
+            end_of_data = self._last_frame
+        start = bisect.bisect_left(self._times, start_time)
+        end = bisect.bisect_left(self._times, end_time)
+        start_offset = (
+            self._offsets[start] if start < len(self._offsets)
+            else end_of_data)
+        end_offset = (
+            self._offsets[end] if end < len(self._offsets)
+            else end_of_data)
+        return start_offset, end_offset
@@ -5,18 +5,25 @@ from spinnman.utilities import utility_functions
 
 from spinn_front_end_common.utilities.database.database_connection \
     import DatabaseConnection
+from spinn_front_end_common.utilities import eieio_container
+from spinn_front_end_common.utilities import constants as \
+    spinn_front_end_constants
 
 from spinnman.messages.eieio.data_messages.eieio_16bit\
     .eieio_16bit_data_message import EIEIO16BitDataMessage
 from spinnman.messages.eieio.data_messages.eieio_32bit\
     .eieio_32bit_data_message import EIEIO32BitDataMessage
+from spinnman.messages.eieio.command_messages.eieio_command_message import \
+    EIEIOCommandMessage
 from spinnman.connections.connection_listener import ConnectionListener
 from spinnman.connections.udp_packet_connections.udp_eieio_connection \
     import UDPEIEIOConnection
 from spinnman.messages.eieio.data_messages.eieio_key_payload_data_element \
     import EIEIOKeyPayloadDataElement
+from spinnman import constants
 
 import logging
+import struct
 
 logger = logging.getLogger(__name__)
 
@@ -27,6 +34,18 @@ _MAX_FULL_KEYS_PER_PACKET = 63
 # The maximum number of 16-bit keys that will fit in a packet
 _MAX_HALF_KEYS_PER_PACKET = 127
 
+# The header of a spike frame after its command: format, time, base key,
+# first word of the bitfield and number of values
+_SPIKE_FRAME_HEADER = struct.Struct("<HIIHH")
+
+# The formats of the data of a spike frame
+_SPIKE_FRAME_BITFIELD = 0
+_SPIKE_FRAME_RUN_LENGTH = 1
+
+# The header of a set of rate counts after its command: number of counts,
+# time, base key, window and counter shift
+_RATE_COUNTS_HEADER = struct.Struct("<HIIHH")
+
 
 class LiveEventConnection(DatabaseConnection):
     """ A connection for receiving and sending live events from and to\
@@ -35,7 +54,7 @@ class LiveEventConnection(DatabaseConnection):
 
     def __init__(self, live_packet_gather_label, receive_labels=None,
                  send_labels=None, local_host=None, local_port=19999,
-                 machine_vertices=False):
+                 machine_vertices=False, container_labels=None):
         """
 
         :param live_packet_gather_label: The label of the LivePacketGather\
@@ -53,6 +72,11 @@ class LiveEventConnection(DatabaseConnection):
                     on.  Must match the port that the toolchain will send the\
                     notification on (19999 by default)
         :type local_port: int
+        :param container_labels: Labels of the vertices in send_labels that\
+                    can unpack EIEIO event containers, to which events that\
+                    fit together are sent in one message.  Events are sent\
+                    to other vertices one packet at a time.
+        :type container_labels: iterable of str
 
         """
 
@@ -65,17 +89,22 @@ class LiveEventConnection(DatabaseConnection):
         self._live_packet_gather_label = live_packet_gather_label
         self._receive_labels = receive_labels
         self._send_labels = send_labels
+        self._container_labels = set()
+        if container_labels is not None:
+            self._container_labels.update(container_labels)
         self._machine_vertices = machine_vertices
         self._sender_connection = None
         self._send_address_details = dict()
         self._atom_id_to_key = dict()
         self._key_to_atom_id_and_label = dict()
         self._live_event_callbacks = list()
+        self._live_rate_callbacks = list()
         self._start_callbacks = dict()
         self._init_callbacks = dict()
         if receive_labels is not None:
             for label in receive_labels:
                 self._live_event_callbacks.append(list())
+                self._live_rate_callbacks.append(list())
                 self._start_callbacks[label] = list()
                 self._init_callbacks[label] = list()
         if send_labels is not None:
@@ -115,6 +144,26 @@ class LiveEventConnection(DatabaseConnection):
         label_id = self._receive_labels.index(label)
         self._live_event_callbacks[label_id].append(live_event_callback)
 
+    def add_receive_rate_callback(self, label, live_rate_callback):
+        """ Add a callback for the reception of counts of live events from\
+            a vertex whose keys are aggregated by the live packet gatherer
+
+        :param label: The label of the vertex to be notified about. Must\
+                    be one of the vertices listed in the constructor
+        :type label: str
+        :param live_rate_callback: A function to be called when counts\
+                    are received.  This should take as parameters the label\
+                    of the vertex, the last simulation timestep of the\
+                    window over which events were counted, the number of\
+                    timesteps in the window, and an array-like of pairs of\
+                    the id of the first atom counted by a counter and its\
+                    non-zero count.
+        :type live_rate_callback: function(str, int, int, [(int, int)]) ->\
+                    None
+        """
+        label_id = self._receive_labels.index(label)
+        self._live_rate_callbacks[label_id].append(live_rate_callback)
+
     def add_start_callback(self, label, start_callback):
         """ Add a callback for the start of the simulation
 
@@ -236,8 +285,89 @@ class LiveEventConnection(DatabaseConnection):
                              self._local_port, self._local_ip_address))
                 callback_thread.start()
 
+    @staticmethod
+    def _decode_spike_frame(packet):
+        """ Get the events of a spike frame sent by a live packet gatherer
+
+        :param packet: The command message of the spike frame
+        :return: The timestep of the events and the keys of the events
+        :rtype: (int, list of int)
+        """
+        (frame_format, time, base_key, first_word, n_values) = \
+            _SPIKE_FRAME_HEADER.unpack_from(packet.data, packet.offset)
+        data_offset = packet.offset + _SPIKE_FRAME_HEADER.size
+        first_atom = first_word * 32
+        keys = list()
+        if frame_format == _SPIKE_FRAME_RUN_LENGTH:
+
+            # Runs alternate between atoms that did not and did fire
+            runs = struct.unpack_from(
+                "<{}H".format(n_values), packet.data, data_offset)
+            atom = first_atom
+            for i in xrange(0, n_values, 2):
+                atom += runs[i]
+                if i + 1 < n_values:
+                    keys.extend(
+                        base_key | fired_atom
+                        for fired_atom in xrange(atom, atom + runs[i + 1]))
+                    atom += runs[i + 1]
+        else:
+            words = struct.unpack_from(
+                "<{}I".format(n_values), packet.data, data_offset)
+            for (i, word) in enumerate(words):
+                word_atom = first_atom + (i * 32)
+                while word != 0:
+                    bit = (word & -word).bit_length() - 1
+                    keys.append(base_key | (word_atom + bit))
+                    word &= word - 1
+        return time, keys
+
+    def _receive_spike_frame(self, packet):
+        time, keys = self._decode_spike_frame(packet)
+        label_atom_ids = OrderedDict()
+        for key in keys:
+            if key in self._key_to_atom_id_and_label:
+                (atom_id, label_id) = self._key_to_atom_id_and_label[key]
+                if label_id not in label_atom_ids:
+                    label_atom_ids[label_id] = list()
+                label_atom_ids[label_id].append(atom_id)
+
+        for (label_id, atom_ids) in label_atom_ids.iteritems():
+            label = self._receive_labels[label_id]
+            for callback in self._live_event_callbacks[label_id]:
+                callback(label, time, atom_ids)
+
+    def _receive_rate_counts(self, packet):
+        (n_counts, time, base_key, window, counter_shift) = \
+            _RATE_COUNTS_HEADER.unpack_from(packet.data, packet.offset)
+        values = struct.unpack_from(
+            "<{}H".format(n_counts * 2), packet.data,
+            packet.offset + _RATE_COUNTS_HEADER.size)
+        label_counts = OrderedDict()
+        for i in xrange(0, len(values), 2):
+            key = base_key | (values[i] << counter_shift)
+            if key in self._key_to_atom_id_and_label:
+                (atom_id, label_id) = self._key_to_atom_id_and_label[key]
+                if label_id not in label_counts:
+                    label_counts[label_id] = list()
+                label_counts[label_id].append((atom_id, values[i + 1]))
+
+        for (label_id, counts) in label_counts.iteritems():
+            label = self._receive_labels[label_id]
+            for callback in self._live_rate_callbacks[label_id]:
+                callback(label, time, window, counts)
+
     def _receive_packet_callback(self, packet):
         try:
+            if isinstance(packet, EIEIOCommandMessage):
+                command = packet.eieio_header.command
+                if (command == spinn_front_end_constants.EIEIO_COMMAND_IDS
+                        .EVENT_SPIKE_FRAME.value):
+                    self._receive_spike_frame(packet)
+                elif (command == spinn_front_end_constants.EIEIO_COMMAND_IDS
+                        .EVENT_RATE_COUNTS.value):
+                    self._receive_rate_counts(packet)
+                return
             header = packet.eieio_header
             if header.is_time:
                 key_times_labels = OrderedDict()
@@ -294,7 +424,8 @@ class LiveEventConnection(DatabaseConnection):
         self.send_events(label, [atom_id], send_full_keys)
 
     def send_events(self, label, atom_ids, send_full_keys=False):
-        """ Send a number of events
+        """ Send a number of events; if the vertex can unpack event\
+            containers, packets that fit together are sent in one message
 
         :param label: The label of the vertex from which the events will\
                     originate
@@ -310,6 +441,7 @@ class LiveEventConnection(DatabaseConnection):
         if send_full_keys:
             max_keys = _MAX_FULL_KEYS_PER_PACKET
 
+        packets = list()
         pos = 0
         while pos < len(atom_ids):
 
@@ -326,9 +458,14 @@ class LiveEventConnection(DatabaseConnection):
                 message.add_key(key)
                 pos += 1
                 events_in_packet += 1
-            ip_address, port = self._send_address_details[label]
-            self._sender_connection.send_eieio_message_to(
-                message, ip_address, port)
+            packets.append(message.bytestring)
+
+        if label in self._container_labels:
+            packets = eieio_container.pack_eieio_packets(
+                packets, constants.UDP_MESSAGE_MAX_SIZE)
+        ip_address, port = self._send_address_details[label]
+        for data in packets:
+            self._sender_connection.send_to(data, (ip_address, port))
 
     def close(self):
         DatabaseConnection.close(self)
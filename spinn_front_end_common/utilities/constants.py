@@ -76,3 +76,38 @@ BUFFERING_OPERATIONS = Enum(
         # Host confirming data being read form SpiNNaker memory
         ("BUFFER_WRITE", 1)]
 )
+
+# EIEIO commands used by buffering which are not defined by spinnman
+# (see buffered_eieio_defs.h)
+EIEIO_COMMAND_IDS = Enum(
+    value="EIEIO_COMMAND_IDS",
+    names=[
+
+        # Host confirming data being read for several outstanding requests
+        ("HOST_DATA_READ_ACK", 10),
+
+        # Several EIEIO packets in one message, each preceded by its length
+        ("EVENT_CONTAINER", 11),
+
+        # Host publishing data already written into the buffer by memory
+        # writes
+        ("HOST_PUBLISH_WRITE_POINTER", 12),
+
+        # Unused space in a buffer, which carries its length
+        ("EVENT_SKIP", 13),
+
+        # Spinnaker requesting new buffers, with the rate at which the buffer
+        # is being emptied
+        ("SPINNAKER_REQUEST_REFILL", 14),
+
+        # Live events of a timestep from a range of keys, as a bitfield or
+        # as run lengths
+        ("EVENT_SPIKE_FRAME", 15),
+
+        # The non-zero numbers of live events from a range of keys over a
+        # window of timesteps
+        ("EVENT_RATE_COUNTS", 16)]
+)
+
+# The most read requests that a core can have outstanding at once
+MAX_READ_WINDOW = 8
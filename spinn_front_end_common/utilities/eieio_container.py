@@ -0,0 +1,51 @@
+from spinn_front_end_common.utilities import constants
+
+import struct
+
+# The header of a container, and the length in front of each packet in it
+_CONTAINER_HEADER = struct.Struct("<H")
+_PACKET_LENGTH = struct.Struct("<H")
+
+
+def pack_eieio_packets(packets, max_size):
+    """ Pack EIEIO packets into as few messages as possible, by putting\
+        packets that fit together into EIEIO container commands
+
+    :param packets: The bytestrings of the packets, in the order to be sent
+    :type packets: iterable of str
+    :param max_size: The most bytes that can be sent in one message
+    :type max_size: int
+    :return: The bytestrings of the messages to send
+    :rtype: list of str
+    """
+    messages = list()
+    contained = list()
+    size = _CONTAINER_HEADER.size
+    for packet in packets:
+        packet_size = _PACKET_LENGTH.size + len(packet)
+        if len(contained) > 0 and size + packet_size > max_size:
+            messages.append(_make_message(contained))
+            contained = list()
+            size = _CONTAINER_HEADER.size
+        contained.append(packet)
+        size += packet_size
+    if len(contained) > 0:
+        messages.append(_make_message(contained))
+    return messages
+
+
+def _make_message(packets):
+    """ Make a message of some packets, which is a container unless there\
+        is only one packet
+
+    :param packets: The bytestrings of the packets
+    :type packets: list of str
+    :rtype: str
+    """
+    if len(packets) == 1:
+        return packets[0]
+    data = _CONTAINER_HEADER.pack(
+        0x4000 | constants.EIEIO_COMMAND_IDS.EVENT_CONTAINER.value)
+    for packet in packets:
+        data += _PACKET_LENGTH.pack(len(packet)) + packet
+    return data
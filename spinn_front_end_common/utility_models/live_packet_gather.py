@@ -45,9 +45,50 @@ class LivePacketGather(
             prefix_type=None, message_type=EIEIOType.KEY_32_BIT, right_shift=0,
             payload_as_time_stamps=True, use_payload_prefix=True,
             payload_prefix=None, payload_right_shift=0,
-            number_of_packets_sent_per_time_step=0, constraints=None,
+            number_of_packets_sent_per_time_step=0, spike_frame_ranges=None,
+            compress_spike_frames=True, aggregation_ranges=None,
+            aggregation_window=1, overflow_buffer_size=0,
+            overflow_max_delay=1, incoming_events_per_time_step=256,
+            incoming_payload_events_per_time_step=256, constraints=None,
             label=None):
         """
+
+        :param spike_frame_ranges: The ranges of keys whose events are sent\
+            at the end of each timestep as a frame of the atoms that fired,\
+            rather than as a key per event; the atom of a key is the part of\
+            the key not covered by the mask
+        :type spike_frame_ranges: list of (base key, mask, number of atoms)
+        :param compress_spike_frames: True if spike frames are sent as the\
+            lengths of runs of atoms when that is smaller than the bitfield
+        :type compress_spike_frames: bool
+        :param aggregation_ranges: The ranges of keys whose events are only\
+            counted, with a counter for each block of atoms of a power of\
+            two size, and sent as the non-zero counts of each window
+        :type aggregation_ranges: list of (base key, mask, number of atoms,\
+            atoms per counter)
+        :param aggregation_window: The number of timesteps in each window\
+            over which events are counted
+        :type aggregation_window: int
+        :param overflow_buffer_size: The size in bytes of the buffer in\
+            SDRAM in which messages are held when more than the number of\
+            packets per timestep would be sent, or when there is no SDP\
+            buffer to send them with; if 0, such messages are dropped, and\
+            otherwise it must hold at least one message of\
+            OVERFLOW_SLOT_SIZE bytes
+        :type overflow_buffer_size: int
+        :param overflow_max_delay: The most timesteps for which a message is\
+            held before it is dropped.  Held messages are sent as soon as\
+            the number of packets per timestep allows, which is usually not\
+            until the next timestep, so this must be at least 1.
+        :type overflow_max_delay: int
+        :param incoming_events_per_time_step: The number of events without\
+            payloads expected in a timestep, which is the number that can\
+            be buffered before they are processed
+        :type incoming_events_per_time_step: int
+        :param incoming_payload_events_per_time_step: The number of events\
+            with payloads expected in a timestep, which is the number that\
+            can be buffered before they are processed
+        :type incoming_payload_events_per_time_step: int
         """
         if ((message_type == EIEIOType.KEY_PAYLOAD_32_BIT or
              message_type == EIEIOType.KEY_PAYLOAD_16_BIT) and
@@ -68,6 +109,53 @@ class LivePacketGather(
                 "the type of a prefix type should be of a EIEIOPrefix, "
                 "which can be located in :"
                 "SpinnMan.messages.eieio.eieio_prefix_type")
+        if spike_frame_ranges is None:
+            spike_frame_ranges = list()
+        for (base_key, mask, n_atoms) in spike_frame_ranges:
+            if (base_key & ~mask & 0xFFFFFFFF) != 0:
+                raise ConfigurationException(
+                    "The base key {} of a spike frame range has bits outside "
+                    "of the mask {}".format(hex(base_key), hex(mask)))
+            if n_atoms < 1 or n_atoms > (~mask & 0xFFFFFFFF) + 1:
+                raise ConfigurationException(
+                    "A spike frame range with mask {} can't have {} "
+                    "atoms".format(hex(mask), n_atoms))
+        if aggregation_ranges is None:
+            aggregation_ranges = list()
+        for (base_key, mask, n_atoms, atoms_per_counter) in \
+                aggregation_ranges:
+            if (base_key & ~mask & 0xFFFFFFFF) != 0:
+                raise ConfigurationException(
+                    "The base key {} of an aggregation range has bits "
+                    "outside of the mask {}".format(hex(base_key), hex(mask)))
+            if n_atoms < 1 or n_atoms > (~mask & 0xFFFFFFFF) + 1:
+                raise ConfigurationException(
+                    "An aggregation range with mask {} can't have {} "
+                    "atoms".format(hex(mask), n_atoms))
+            if (atoms_per_counter < 1 or
+                    (atoms_per_counter & (atoms_per_counter - 1)) != 0):
+                raise ConfigurationException(
+                    "The number of atoms per counter of an aggregation range "
+                    "must be a power of two, not {}".format(
+                        atoms_per_counter))
+            if n_atoms > atoms_per_counter * 0x10000:
+                raise ConfigurationException(
+                    "An aggregation range can't have more than 65536 "
+                    "counters")
+        if aggregation_window < 1 or aggregation_window > 0xFFFF:
+            raise ConfigurationException(
+                "The aggregation window must be between 1 and 65535 "
+                "timesteps")
+        if 0 < overflow_buffer_size < \
+                LivePacketGatherMachineVertex.OVERFLOW_SLOT_SIZE:
+            raise ConfigurationException(
+                "The overflow buffer must be 0 bytes, or large enough to "
+                "hold one message of {} bytes".format(
+                    LivePacketGatherMachineVertex.OVERFLOW_SLOT_SIZE))
+        if overflow_buffer_size > 0 and overflow_max_delay < 1:
+            raise ConfigurationException(
+                "Messages in the overflow buffer are held for at least one "
+                "timestep, so the maximum delay must be at least 1")
 
         if label is None:
             label = "Live Packet Gatherer"
@@ -99,6 +187,15 @@ class LivePacketGather(
         self._payload_right_shift = payload_right_shift
         self._number_of_packets_sent_per_time_step = \
             number_of_packets_sent_per_time_step
+        self._spike_frame_ranges = spike_frame_ranges
+        self._compress_spike_frames = compress_spike_frames
+        self._aggregation_ranges = aggregation_ranges
+        self._aggregation_window = aggregation_window
+        self._overflow_buffer_size = overflow_buffer_size
+        self._overflow_max_delay = overflow_max_delay
+        self._incoming_events_per_time_step = incoming_events_per_time_step
+        self._incoming_payload_events_per_time_step = \
+            incoming_payload_events_per_time_step
 
     @inject_items({"machine_time_step": "MachineTimeStep"})
     @overrides(
@@ -116,6 +213,15 @@ class LivePacketGather(
             self._number_of_packets_sent_per_time_step,
             ip_address=self._ip_address, port=self._port,
             strip_sdp=self._strip_sdp, board_address=self._board_address,
+            spike_frame_ranges=self._spike_frame_ranges,
+            compress_spike_frames=self._compress_spike_frames,
+            aggregation_ranges=self._aggregation_ranges,
+            aggregation_window=self._aggregation_window,
+            overflow_buffer_size=self._overflow_buffer_size,
+            overflow_max_delay=self._overflow_max_delay,
+            incoming_events_per_time_step=self._incoming_events_per_time_step,
+            incoming_payload_events_per_time_step=(
+                self._incoming_payload_events_per_time_step),
             constraints=constraints)
 
     @overrides(AbstractHasAssociatedBinary.get_binary_file_name)
@@ -131,8 +237,14 @@ class LivePacketGather(
     def get_resources_used_by_atoms(self, vertex_slice):
         return ResourceContainer(
             sdram=SDRAMResource(
-                LivePacketGatherMachineVertex.get_sdram_usage()),
-            dtcm=DTCMResource(LivePacketGatherMachineVertex.get_dtcm_usage()),
+                LivePacketGatherMachineVertex.get_sdram_usage(
+                    len(self._spike_frame_ranges),
+                    len(self._aggregation_ranges),
+                    self._overflow_buffer_size)),
+            dtcm=DTCMResource(LivePacketGatherMachineVertex.get_dtcm_usage(
+                self._spike_frame_ranges, self._aggregation_ranges,
+                self._incoming_events_per_time_step,
+                self._incoming_payload_events_per_time_step)),
             cpu_cycles=CPUCyclesPerTickResource(
                 LivePacketGatherMachineVertex.get_cpu_usage()),
             iptags=[IPtagResource(
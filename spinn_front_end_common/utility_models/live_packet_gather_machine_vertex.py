@@ -44,11 +44,19 @@ class LivePacketGatherMachineVertex(
         value="LIVE_DATA_GATHER_REGIONS",
         names=[('SYSTEM', 0),
                ('CONFIG', 1),
-               ('PROVENANCE', 2)])
+               ('PROVENANCE', 2),
+               ('OVERFLOW', 3)])
 
-    N_ADDITIONAL_PROVENANCE_ITEMS = 2
-    _CONFIG_SIZE = 44
-    _PROVENANCE_REGION_SIZE = 8
+    N_ADDITIONAL_PROVENANCE_ITEMS = 5
+    _CONFIG_SIZE = 76
+    _SPIKE_FRAME_RANGE_SIZE = 12
+    _AGGREGATION_RANGE_SIZE = 16
+    _PROVENANCE_REGION_SIZE = 20
+
+    # The size of each message held in the overflow buffer: the timestep it
+    # was held at, the number of events in it, and the SDP message of
+    # 24 bytes of header and 256 bytes of data (see live_packet_gather.c)
+    OVERFLOW_SLOT_SIZE = 4 + 4 + 24 + 256
 
     def __init__(
             self, label, use_prefix=False, key_prefix=None, prefix_type=None,
@@ -57,13 +65,63 @@ class LivePacketGatherMachineVertex(
             payload_prefix=None, payload_right_shift=0,
             number_of_packets_sent_per_time_step=0,
             ip_address=None, port=None, strip_sdp=None, board_address=None,
-            tag=None,
-            constraints=None):
+            tag=None, spike_frame_ranges=None, compress_spike_frames=True,
+            aggregation_ranges=None, aggregation_window=1,
+            overflow_buffer_size=0, overflow_max_delay=1,
+            incoming_events_per_time_step=256,
+            incoming_payload_events_per_time_step=256, constraints=None):
+        """
+
+        :param spike_frame_ranges: The ranges of keys whose events are sent\
+            at the end of each timestep as a frame of the atoms that fired,\
+            rather than as a key per event
+        :type spike_frame_ranges: list of (base key, mask, number of atoms)
+        :param compress_spike_frames: True if spike frames are sent as the\
+            lengths of runs of atoms when that is smaller than the bitfield
+        :type compress_spike_frames: bool
+        :param aggregation_ranges: The ranges of keys whose events are only\
+            counted, with a counter for each block of atoms of a power of\
+            two size, and sent as the non-zero counts of each window
+        :type aggregation_ranges: list of (base key, mask, number of atoms,\
+            atoms per counter)
+        :param aggregation_window: The number of timesteps in each window\
+            over which events are counted
+        :type aggregation_window: int
+        :param overflow_buffer_size: The size in bytes of the buffer in\
+            SDRAM in which messages are held when more than the number of\
+            packets per timestep would be sent, or when there is no SDP\
+            buffer to send them with; if 0, such messages are dropped, and\
+            otherwise it must hold at least one message of\
+            OVERFLOW_SLOT_SIZE bytes
+        :type overflow_buffer_size: int
+        :param overflow_max_delay: The most timesteps for which a message is\
+            held before it is dropped.  Held messages are sent as soon as\
+            the number of packets per timestep allows, which is usually not\
+            until the next timestep, so this must be at least 1.
+        :type overflow_max_delay: int
+        :param incoming_events_per_time_step: The number of events without\
+            payloads expected in a timestep, which is the number that can\
+            be buffered before they are processed
+        :type incoming_events_per_time_step: int
+        :param incoming_payload_events_per_time_step: The number of events\
+            with payloads expected in a timestep, which is the number that\
+            can be buffered before they are processed
+        :type incoming_payload_events_per_time_step: int
+        """
+        if spike_frame_ranges is None:
+            spike_frame_ranges = list()
+        if aggregation_ranges is None:
+            aggregation_ranges = list()
 
         self._resources_required = ResourceContainer(
             cpu_cycles=CPUCyclesPerTickResource(self.get_cpu_usage()),
-            dtcm=DTCMResource(self.get_dtcm_usage()),
-            sdram=SDRAMResource(self.get_sdram_usage()),
+            dtcm=DTCMResource(self.get_dtcm_usage(
+                spike_frame_ranges, aggregation_ranges,
+                incoming_events_per_time_step,
+                incoming_payload_events_per_time_step)),
+            sdram=SDRAMResource(self.get_sdram_usage(
+                len(spike_frame_ranges), len(aggregation_ranges),
+                overflow_buffer_size)),
             iptags=[IPtagResource(
                 ip_address=ip_address, port=port,
                 strip_sdp=strip_sdp, tag=tag,
@@ -91,6 +149,15 @@ class LivePacketGatherMachineVertex(
         self._payload_right_shift = payload_right_shift
         self._number_of_packets_sent_per_time_step = \
             number_of_packets_sent_per_time_step
+        self._spike_frame_ranges = spike_frame_ranges
+        self._compress_spike_frames = compress_spike_frames
+        self._aggregation_ranges = aggregation_ranges
+        self._aggregation_window = aggregation_window
+        self._overflow_buffer_size = overflow_buffer_size
+        self._overflow_max_delay = overflow_max_delay
+        self._incoming_events_per_time_step = incoming_events_per_time_step
+        self._incoming_payload_events_per_time_step = \
+            incoming_payload_events_per_time_step
 
     @property
     @overrides(MachineVertex.resources_required)
@@ -143,6 +210,24 @@ class LivePacketGatherMachineVertex(
                 "you are running in real time, try reducing the number of "
                 "vertices which are feeding this live packet gatherer".format(
                     provenance_data[1]))))
+        provenance_items.append(ProvenanceDataItem(
+            self._add_name(names, "deferred_events"),
+            provenance_data[2],
+            report=False))
+        provenance_items.append(ProvenanceDataItem(
+            self._add_name(names, "dropped_events"),
+            provenance_data[3],
+            report=provenance_data[3] > 0,
+            message=(
+                "The live packet gatherer has dropped {} events which could "
+                "not be sent within the number of packets per time step. "
+                "Try increasing the number of packets per time step, the "
+                "size of the overflow buffer or the maximum overflow "
+                "delay".format(provenance_data[3]))))
+        provenance_items.append(ProvenanceDataItem(
+            self._add_name(names, "max_deferral_time_steps"),
+            provenance_data[4],
+            report=False))
 
         return provenance_items
 
@@ -191,8 +276,17 @@ class LivePacketGatherMachineVertex(
             region=(
                 LivePacketGatherMachineVertex.
                 _LIVE_DATA_GATHER_REGIONS.CONFIG.value),
-            size=self._CONFIG_SIZE, label='config')
+            size=self.get_config_size(
+                len(self._spike_frame_ranges), len(self._aggregation_ranges)),
+            label='config')
         self.reserve_provenance_data_region(spec)
+        if self._overflow_buffer_size > 0:
+            spec.reserve_memory_region(
+                region=(
+                    LivePacketGatherMachineVertex.
+                    _LIVE_DATA_GATHER_REGIONS.OVERFLOW.value),
+                size=self._overflow_buffer_size, label='overflow',
+                empty=True)
 
     def _write_configuration_region(self, spec, iptags):
         """ writes the configuration region to the spec
@@ -262,6 +356,41 @@ class LivePacketGatherMachineVertex(
         # number of packets to send per time stamp
         spec.write_value(data=self._number_of_packets_sent_per_time_step)
 
+        # spike frame compression
+        if self._compress_spike_frames:
+            spec.write_value(data=1)
+        else:
+            spec.write_value(data=0)
+
+        # aggregation window and number of aggregation ranges
+        spec.write_value(data=self._aggregation_window)
+        spec.write_value(data=len(self._aggregation_ranges))
+
+        # overflow buffer size and the most time steps a message waits in it
+        spec.write_value(data=self._overflow_buffer_size)
+        spec.write_value(data=self._overflow_max_delay)
+
+        # sizes of the buffers of incoming events; the ring of events with
+        # payloads always has one slot empty
+        spec.write_value(data=self._incoming_events_per_time_step)
+        spec.write_value(
+            data=self._incoming_payload_events_per_time_step + 1)
+
+        # spike frame ranges
+        spec.write_value(data=len(self._spike_frame_ranges))
+        for (base_key, mask, n_atoms) in self._spike_frame_ranges:
+            spec.write_value(data=base_key)
+            spec.write_value(data=mask)
+            spec.write_value(data=n_atoms)
+
+        # aggregation ranges, with the number of atoms per counter as a shift
+        for (base_key, mask, n_atoms, atoms_per_counter) in \
+                self._aggregation_ranges:
+            spec.write_value(data=base_key)
+            spec.write_value(data=mask)
+            spec.write_value(data=n_atoms)
+            spec.write_value(data=atoms_per_counter.bit_length() - 1)
+
     def _write_setup_info(self, spec, machine_time_step, time_scale_factor):
         """ Write basic info to the system region
 
@@ -286,22 +415,67 @@ class LivePacketGatherMachineVertex(
         return 0
 
     @staticmethod
-    def get_sdram_usage():
-        """ Get the SDRAM used by this vertex
+    def get_config_size(n_spike_frame_ranges=0, n_aggregation_ranges=0):
+        """ Get the size of the configuration region
 
+        :param n_spike_frame_ranges: The number of spike frame ranges
+        :param n_aggregation_ranges: The number of aggregation ranges
         :return:
         """
         return (
-            constants.SYSTEM_BYTES_REQUIREMENT +
             LivePacketGatherMachineVertex._CONFIG_SIZE +
+            (n_spike_frame_ranges *
+             LivePacketGatherMachineVertex._SPIKE_FRAME_RANGE_SIZE) +
+            (n_aggregation_ranges *
+             LivePacketGatherMachineVertex._AGGREGATION_RANGE_SIZE))
+
+    @staticmethod
+    def get_sdram_usage(
+            n_spike_frame_ranges=0, n_aggregation_ranges=0,
+            overflow_buffer_size=0):
+        """ Get the SDRAM used by this vertex
+
+        :param n_spike_frame_ranges: The number of spike frame ranges
+        :param n_aggregation_ranges: The number of aggregation ranges
+        :param overflow_buffer_size: The size of the overflow buffer
+        :return:
+        """
+        return (
+            constants.SYSTEM_BYTES_REQUIREMENT + overflow_buffer_size +
+            LivePacketGatherMachineVertex.get_config_size(
+                n_spike_frame_ranges, n_aggregation_ranges) +
             LivePacketGatherMachineVertex.get_provenance_data_size(
                 LivePacketGatherMachineVertex
                 .N_ADDITIONAL_PROVENANCE_ITEMS))
 
     @staticmethod
-    def get_dtcm_usage():
+    def get_dtcm_usage(
+            spike_frame_ranges=None, aggregation_ranges=None,
+            incoming_events_per_time_step=256,
+            incoming_payload_events_per_time_step=256):
         """ Get the DTCM used by this vertex
 
+        :param spike_frame_ranges: The spike frame ranges, each of which has\
+            two bitfields of its atoms
+        :param aggregation_ranges: The aggregation ranges, each of which has\
+            two sets of 16-bit counters
+        :param incoming_events_per_time_step: The number of events without\
+            payloads that can be buffered
+        :param incoming_payload_events_per_time_step: The number of events\
+            with payloads that can be buffered
         :return:
         """
-        return LivePacketGatherMachineVertex._CONFIG_SIZE
+        if spike_frame_ranges is None:
+            spike_frame_ranges = list()
+        if aggregation_ranges is None:
+            aggregation_ranges = list()
+        return (
+            LivePacketGatherMachineVertex.get_config_size(
+                len(spike_frame_ranges), len(aggregation_ranges)) +
+            (incoming_events_per_time_step * 4) +
+            ((incoming_payload_events_per_time_step + 1) * 8) +
+            sum(2 * ((n_atoms + 31) // 32) * 4
+                for (_, _, n_atoms) in spike_frame_ranges) +
+            sum(2 * (((n_atoms + atoms_per_counter - 1) //
+                      atoms_per_counter) * 2)
+                for (_, _, n_atoms, atoms_per_counter) in aggregation_ranges))
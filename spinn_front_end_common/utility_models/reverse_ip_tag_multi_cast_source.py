@@ -68,6 +68,9 @@ class ReverseIpTagMultiCastSource(
             send_buffer_max_space=(
                 constants.MAX_SIZE_OF_BUFFERED_REGION_ON_CHIP),
             send_buffer_space_before_notify=640,
+            send_buffer_direct_writes=False,
+            send_buffer_refill_hysteresis=256,
+            send_buffer_n_streams=1,
 
             # Buffer parameters
             buffer_notification_ip_address=None,
@@ -75,7 +78,21 @@ class ReverseIpTagMultiCastSource(
             buffer_notification_tag=None,
 
             # Extra flag for input without a reserved port
-            reserve_reverse_ip_tag=False):
+            reserve_reverse_ip_tag=False,
+
+            # Transmit parameters
+            transmit_queue_size=256,
+            transmit_packets_per_us=0,
+
+            # Calendar parameters
+            calendar_slots=16,
+            calendar_slot_size=560,
+
+            # Pattern replay parameters
+            replay_pattern=None,
+            replay_start=0,
+            replay_n_repeats=0,
+            replay_key_offset=0):
         """
 
         :param n_keys: The number of keys to be sent via this multicast source
@@ -110,6 +127,20 @@ class ReverseIpTagMultiCastSource(
         :param send_buffer_space_before_notify: The amount of space free in\
                 the sending buffer before the machine will ask the host for\
                 more data (default setting is optimised for most cases)
+        :param send_buffer_direct_writes: True if the send buffer is to be\
+                refilled by writing blocks of data directly into its free\
+                space and then publishing them with a single command, rather\
+                than by sending each packet in a message; this is ignored if\
+                live packets can also be received
+        :param send_buffer_refill_hysteresis: The amount of data that must\
+                be added to the sending buffer after the machine asks the\
+                host for more data before it will ask again when the space\
+                free rises to send_buffer_space_before_notify
+        :param send_buffer_n_streams: The number of streams that the keys\
+                of each core are split between, each of which has its own\
+                part of the send buffer space, sequence numbers and key\
+                space, so that the keys of one stream are not held up by\
+                those of another
         :param buffer_notification_ip_address: The IP address of the host\
                 that will send new buffers (must be specified if a send buffer\
                 is specified or if recording will be used)
@@ -118,6 +149,29 @@ class ReverseIpTagMultiCastSource(
                 send buffer is specified, or if recording will be used)
         :param buffer_notification_tag: The IP tag to use to notify the\
                 host about space in the buffer (default is to use any tag)
+        :param transmit_queue_size: The number of multicast packets that can\
+                wait to be sent by each core; packets received when the\
+                queue is full are dropped
+        :param transmit_packets_per_us: The rate at which multicast packets\
+                are sent from the transmit queue, in packets per\
+                microsecond (default of 0 sends as fast as the router\
+                accepts them)
+        :param calendar_slots: The number of time steps ahead for which\
+                packets with future timestamps can be held apart from the\
+                send buffer, so that they are found at their time step\
+                whatever order they arrive in
+        :param calendar_slot_size: The number of bytes of packets that can\
+                be held for each time step of the calendar
+        :param replay_pattern: A list of lists of keys (between 0 and\
+                n_keys - 1), one list for each time step of a period, which\
+                is loaded once and then sent repeatedly on the machine\
+                (default disabled)
+        :param replay_start: The time step at which the pattern is first\
+                sent
+        :param replay_n_repeats: The number of times the pattern is sent\
+                (default of 0 repeats it until the end of the simulation)
+        :param replay_key_offset: An amount added to each key of the\
+                pattern in each repeat of the pattern after the first
         """
         ApplicationVertex.__init__(
             self, label, constraints, max_atoms_per_core)
@@ -149,6 +203,9 @@ class ReverseIpTagMultiCastSource(
         self._send_buffer_partition_id = send_buffer_partition_id
         self._send_buffer_max_space = send_buffer_max_space
         self._send_buffer_space_before_notify = send_buffer_space_before_notify
+        self._send_buffer_direct_writes = send_buffer_direct_writes
+        self._send_buffer_refill_hysteresis = send_buffer_refill_hysteresis
+        self._send_buffer_n_streams = send_buffer_n_streams
 
         # Store the buffering details
         self._buffer_notification_ip_address = buffer_notification_ip_address
@@ -156,6 +213,20 @@ class ReverseIpTagMultiCastSource(
         self._buffer_notification_tag = buffer_notification_tag
         self._reserve_reverse_ip_tag = reserve_reverse_ip_tag
 
+        # Store the pacing of sent packets
+        self._transmit_queue_size = transmit_queue_size
+        self._transmit_packets_per_us = transmit_packets_per_us
+
+        # Store the calendar details
+        self._calendar_slots = calendar_slots
+        self._calendar_slot_size = calendar_slot_size
+
+        # Store the pattern to replay
+        self._replay_pattern = replay_pattern
+        self._replay_start = replay_start
+        self._replay_n_repeats = replay_n_repeats
+        self._replay_key_offset = replay_key_offset
+
         self._iptags = None
         if send_buffer_times is not None:
             self._iptags = [IPtagResource(
@@ -172,6 +243,27 @@ class ReverseIpTagMultiCastSource(
         # Keep the vertices for resuming runs
         self._machine_vertices = list()
 
+    @property
+    def _calendar_size(self):
+
+        # The calendar is only needed if timed packets can be received
+        if (self._reverse_iptags is None and
+                self._send_buffer_times is None):
+            return 0
+        return ReverseIPTagMulticastSourceMachineVertex.get_calendar_size(
+            self._calendar_slots, self._calendar_slot_size)
+
+    def _get_replay_pattern(self, vertex_slice):
+        """ Get the part of the pattern to replay with the keys of a slice,\
+            relative to the start of the slice
+        """
+        if self._replay_pattern is None:
+            return None
+        return [
+            [key - vertex_slice.lo_atom for key in keys
+             if vertex_slice.lo_atom <= key <= vertex_slice.hi_atom]
+            for keys in self._replay_pattern]
+
     @property
     @overrides(ApplicationVertex.n_atoms)
     def n_atoms(self):
@@ -179,11 +271,16 @@ class ReverseIpTagMultiCastSource(
 
     @overrides(ApplicationVertex.get_resources_used_by_atoms)
     def get_resources_used_by_atoms(self, vertex_slice):
+        _, n_streams = ReverseIPTagMulticastSourceMachineVertex.\
+            get_stream_keys(vertex_slice.n_atoms, self._send_buffer_n_streams)
         container = ResourceContainer(
             sdram=SDRAMResource(
                 ReverseIPTagMulticastSourceMachineVertex.get_sdram_usage(
                     self._send_buffer_times, self._send_buffer_max_space,
-                    self._record_buffer_size > 0)),
+                    self._record_buffer_size > 0, self._calendar_size,
+                    n_streams,
+                    ReverseIPTagMulticastSourceMachineVertex.get_pattern_size(
+                        self._get_replay_pattern(vertex_slice)))),
             dtcm=DTCMResource(
                 ReverseIPTagMulticastSourceMachineVertex.get_dtcm_usage()),
             cpu_cycles=CPUCyclesPerTickResource(
@@ -264,11 +361,23 @@ class ReverseIpTagMultiCastSource(
             send_buffer_max_space=self._send_buffer_max_space,
             send_buffer_space_before_notify=(
                 self._send_buffer_space_before_notify),
+            send_buffer_direct_writes=self._send_buffer_direct_writes,
+            send_buffer_refill_hysteresis=(
+                self._send_buffer_refill_hysteresis),
+            send_buffer_n_streams=self._send_buffer_n_streams,
             buffer_notification_ip_address=(
                 self._buffer_notification_ip_address),
             buffer_notification_port=self._buffer_notification_port,
             buffer_notification_tag=self._buffer_notification_tag,
-            reserve_reverse_ip_tag=self._reserve_reverse_ip_tag)
+            reserve_reverse_ip_tag=self._reserve_reverse_ip_tag,
+            transmit_queue_size=self._transmit_queue_size,
+            transmit_packets_per_us=self._transmit_packets_per_us,
+            calendar_slots=self._calendar_slots,
+            calendar_slot_size=self._calendar_slot_size,
+            replay_pattern=self._get_replay_pattern(vertex_slice),
+            replay_start=self._replay_start,
+            replay_n_repeats=self._replay_n_repeats,
+            replay_key_offset=self._replay_key_offset)
         if self._record_buffer_size > 0:
             vertex.enable_recording(
                 self._record_buffer_size,
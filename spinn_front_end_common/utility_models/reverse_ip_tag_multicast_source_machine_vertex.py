@@ -37,6 +37,8 @@ from spinn_front_end_common.abstract_models\
 from spinn_front_end_common.interface.buffer_management.buffer_models\
     .abstract_receive_buffers_to_host import AbstractReceiveBuffersToHost
 from spinn_front_end_common.utilities.exceptions import ConfigurationException
+from spinn_front_end_common.utilities.utility_objs.provenance_data_item \
+    import ProvenanceDataItem
 from spinn_front_end_common.abstract_models\
     .abstract_provides_outgoing_partition_constraints \
     import AbstractProvidesOutgoingPartitionConstraints
@@ -82,13 +84,37 @@ class ReverseIPTagMulticastSourceMachineVertex(
                ('CONFIGURATION', 1),
                ('RECORDING', 2),
                ('SEND_BUFFER', 3),
-               ('PROVENANCE_REGION', 4)])
-
-    # 11 ints (1, has prefix, 2, prefix, 3, prefix type, 4, check key flag,
-    #          5, has key, 6, key, 7, mask, 8, buffer space,
-    #          9, send buffer flag before notify, 10, tag,
-    #          11. receive SDP port)
-    _CONFIGURATION_REGION_SIZE = 11 * 4
+               ('PROVENANCE_REGION', 4),
+               ('PATTERN', 5)])
+
+    # 8 ints (1. tag, 2. receive SDP port, 3. transmit queue size,
+    #         4. transmit rate, 5. calendar slots,
+    #         6. calendar slot size, 7. number of streams, 8. has pattern)
+    _CONFIGURATION_HEADER_SIZE = 8 * 4
+
+    # 12 ints for each stream (1. region, 2. has prefix, 3. prefix,
+    #                          4. prefix type, 5. check key flag, 6. has key,
+    #                          7. key, 8. mask, 9. buffer space,
+    #                          10. send buffer space before notify,
+    #                          11. refill hysteresis, 12. direct writes)
+    _STREAM_CONFIGURATION_SIZE = 12 * 4
+
+    # 5 ints before the index of the pattern (1. start time, 2. period,
+    #                                         3. number of repeats,
+    #                                         4. key offset, 5. number of keys)
+    _PATTERN_HEADER_SIZE = 5 * 4
+
+    # The most send buffer streams; each after the first has its own region
+    # after the pattern region, of which there can be at most 16
+    MAX_SEND_BUFFER_STREAMS = 11
+
+    # The number of fractional bits of the transmit rate (see
+    # reverse_iptag_multicast_source.c)
+    _TRANSMIT_RATE_FRACTION_BITS = 16
+
+    # The number of provenance items in addition to the basic ones
+    # (1. transmit queue overflows, 2. future packets dropped)
+    N_ADDITIONAL_PROVENANCE_ITEMS = 2
 
     def __init__(
             self, n_keys, label, constraints=None,
@@ -113,6 +139,9 @@ class ReverseIPTagMulticastSourceMachineVertex(
             send_buffer_max_space=(
                 constants.MAX_SIZE_OF_BUFFERED_REGION_ON_CHIP),
             send_buffer_space_before_notify=640,
+            send_buffer_direct_writes=False,
+            send_buffer_refill_hysteresis=256,
+            send_buffer_n_streams=1,
 
             # Buffer notification details
             buffer_notification_ip_address=None,
@@ -120,7 +149,21 @@ class ReverseIPTagMulticastSourceMachineVertex(
             buffer_notification_tag=None,
 
             # Extra flag for receiving packets without a port
-            reserve_reverse_ip_tag=False):
+            reserve_reverse_ip_tag=False,
+
+            # Transmit parameters
+            transmit_queue_size=256,
+            transmit_packets_per_us=0,
+
+            # Calendar parameters
+            calendar_slots=16,
+            calendar_slot_size=560,
+
+            # Pattern replay parameters
+            replay_pattern=None,
+            replay_start=0,
+            replay_n_repeats=0,
+            replay_key_offset=0):
         """
 
         :param n_keys: The number of keys to be sent via this multicast source
@@ -151,6 +194,20 @@ class ReverseIPTagMulticastSourceMachineVertex(
         :param send_buffer_space_before_notify: The amount of space free in\
                 the sending buffer before the machine will ask the host for\
                 more data (default setting is optimised for most cases)
+        :param send_buffer_direct_writes: True if the send buffer is to be\
+                refilled by writing blocks of data directly into its free\
+                space and then publishing them with a single command, rather\
+                than by sending each packet in a message; this is ignored if\
+                live packets can also be received
+        :param send_buffer_refill_hysteresis: The amount of data that must\
+                be added to the sending buffer after the machine asks the\
+                host for more data before it will ask again when the space\
+                free rises to send_buffer_space_before_notify
+        :param send_buffer_n_streams: The number of streams that the keys\
+                are split between, each of which has its own part of the\
+                send buffer space, sequence numbers and key space, so that\
+                the keys of one stream are not held up by those of another\
+                (at most MAX_SEND_BUFFER_STREAMS)
         :param buffer_notification_ip_address: The IP address of the host\
                 that will send new buffers (must be specified if a send buffer\
                 is specified)
@@ -159,10 +216,34 @@ class ReverseIPTagMulticastSourceMachineVertex(
                 send buffer is specified)
         :param buffer_notification_tag: The IP tag to use to notify the\
                 host about space in the buffer (default is to use any tag)
+        :param transmit_queue_size: The number of multicast packets that can\
+                wait to be sent; packets received when the queue is full\
+                are dropped and counted in the provenance data
+        :param transmit_packets_per_us: The rate at which multicast packets\
+                are sent from the transmit queue, in packets per\
+                microsecond (default of 0 sends as fast as the router\
+                accepts them)
+        :param calendar_slots: The number of time steps ahead for which\
+                packets with future timestamps can be held apart from the\
+                send buffer, so that they are found at their time step\
+                whatever order they arrive in
+        :param calendar_slot_size: The number of bytes of packets that can\
+                be held for each time step of the calendar
+        :param replay_pattern: A list of lists of keys (between 0 and\
+                n_keys - 1), one list for each time step of a period, which\
+                is loaded once and then sent repeatedly on the machine\
+                (default disabled)
+        :param replay_start: The time step at which the pattern is first\
+                sent
+        :param replay_n_repeats: The number of times the pattern is sent\
+                (default of 0 repeats it until the end of the simulation)
+        :param replay_key_offset: An amount added to each key of the\
+                pattern in each repeat of the pattern after the first
         """
         AbstractReceiveBuffersToHost.__init__(self)
         ProvidesProvenanceDataFromMachineImpl.__init__(
-            self, self._REGIONS.PROVENANCE_REGION.value, 0)
+            self, self._REGIONS.PROVENANCE_REGION.value,
+            self.N_ADDITIONAL_PROVENANCE_ITEMS)
         AbstractProvidesOutgoingPartitionConstraints.__init__(self)
 
         self._constraints = ConstrainedObject(constraints)
@@ -180,9 +261,26 @@ class ReverseIPTagMulticastSourceMachineVertex(
         self._receive_rate = receive_rate
         self._receive_sdp_port = receive_sdp_port
 
+        # Set up the pacing of sent packets
+        self._transmit_queue_size = transmit_queue_size
+        if transmit_packets_per_us < 0:
+            raise ConfigurationException(
+                "The transmit rate must not be negative")
+        self._transmit_packets_per_us = transmit_packets_per_us
+
+        # The calendar is only needed if timed packets can be received
+        self._calendar_slots = 0
+        if (self._reverse_iptags is not None or
+                send_buffer_times is not None):
+            self._calendar_slots = calendar_slots
+        self._calendar_slot_size = calendar_slot_size
+
         # Work out if buffers are being sent
-        self._send_buffer = None
+        self._stream_buffers = None
         self._send_buffer_partition_id = send_buffer_partition_id
+        self._keys_per_stream, self._n_streams = self.get_stream_keys(
+            n_keys, 1)
+        self._stream_buffer_space = send_buffer_max_space
         if send_buffer_times is None:
             self._send_buffer_times = None
             self._send_buffer_max_space = send_buffer_max_space
@@ -190,9 +288,21 @@ class ReverseIPTagMulticastSourceMachineVertex(
                 self, None)
         else:
             self._send_buffer_max_space = send_buffer_max_space
-            self._send_buffer = BufferedSendingRegion(send_buffer_max_space)
             self._send_buffer_times = send_buffer_times
 
+            # Split the keys and the space between the streams
+            if not 1 <= send_buffer_n_streams <= self.MAX_SEND_BUFFER_STREAMS:
+                raise ConfigurationException(
+                    "The number of send buffer streams must be between 1 "
+                    "and {}".format(self.MAX_SEND_BUFFER_STREAMS))
+            self._keys_per_stream, self._n_streams = self.get_stream_keys(
+                n_keys, send_buffer_n_streams)
+            self._stream_buffer_space = self.get_stream_buffer_space(
+                send_buffer_max_space, self._n_streams)
+            self._stream_buffers = [
+                BufferedSendingRegion(self._stream_buffer_space)
+                for _ in xrange(self._n_streams)]
+
             self._iptags = [IPtagResource(
                 ip_address=buffer_notification_ip_address,
                 port=buffer_notification_port, strip_sdp=True,
@@ -200,13 +310,33 @@ class ReverseIPTagMulticastSourceMachineVertex(
                 traffic_identifier=BufferManager.TRAFFIC_IDENTIFIER)]
             if board_address is not None:
                 self.add_constraint(PlacerBoardConstraint(board_address))
+
+            # Live packets are also written into the buffer on the machine,
+            # so the host can't know where the free space starts
             SendsBuffersFromHostPreBufferedImpl.__init__(
-                self, {self._REGIONS.SEND_BUFFER.value: self._send_buffer})
+                self, {
+                    self.get_stream_region(stream): stream_buffer
+                    for stream, stream_buffer in enumerate(
+                        self._stream_buffers)},
+                direct_writes=(
+                    send_buffer_direct_writes and
+                    self._reverse_iptags is None))
 
         # buffered out parameters
         self._send_buffer_space_before_notify = send_buffer_space_before_notify
-        if self._send_buffer_space_before_notify > send_buffer_max_space:
-            self._send_buffer_space_before_notify = send_buffer_max_space
+        self._send_buffer_refill_hysteresis = send_buffer_refill_hysteresis
+        if (self._send_buffer_space_before_notify >
+                self._stream_buffer_space):
+            self._send_buffer_space_before_notify = self._stream_buffer_space
+
+        # Store the pattern to replay
+        if replay_pattern is not None and len(replay_pattern) == 0:
+            raise ConfigurationException(
+                "The pattern to replay must be at least one time step long")
+        self._replay_pattern = replay_pattern
+        self._replay_start = replay_start
+        self._replay_n_repeats = replay_n_repeats
+        self._replay_key_offset = replay_key_offset
 
         # Set up for recording (if requested)
         self._record_buffer_size = 0
@@ -294,7 +424,8 @@ class ReverseIPTagMulticastSourceMachineVertex(
             dtcm=DTCMResource(self.get_dtcm_usage()),
             sdram=SDRAMResource(self.get_sdram_usage(
                 self._send_buffer_times, self._send_buffer_max_space,
-                self._record_buffer_size > 0)),
+                self._record_buffer_size > 0, self._calendar_size,
+                self._n_streams, self._pattern_size)),
             cpu_cycles=CPUCyclesPerTickResource(self.get_cpu_usage()),
             iptags=self._iptags,
             reverse_iptags=self._reverse_iptags)
@@ -308,25 +439,121 @@ class ReverseIPTagMulticastSourceMachineVertex(
                 [self._record_buffer_size]))
         return resources
 
+    @property
+    def _calendar_size(self):
+        return self.get_calendar_size(
+            self._calendar_slots, self._calendar_slot_size)
+
+    @property
+    def _pattern_size(self):
+        return self.get_pattern_size(self._replay_pattern)
+
+    @staticmethod
+    def get_pattern_size(replay_pattern):
+        """ Get the size of the region holding the pattern to replay
+
+        :param replay_pattern: The keys of each time step of the pattern, or\
+            None if there is no pattern
+        :rtype: int
+        """
+        if replay_pattern is None:
+            return 0
+        return (
+            ReverseIPTagMulticastSourceMachineVertex._PATTERN_HEADER_SIZE +
+            ((len(replay_pattern) + 1) * 4) +
+            (sum(len(keys) for keys in replay_pattern) * 4))
+
+    @staticmethod
+    def get_calendar_size(calendar_slots, calendar_slot_size):
+        """ Get the size of the calendar, which follows the send buffer in\
+            the send buffer region
+
+        :param calendar_slots: The number of time steps in the calendar
+        :param calendar_slot_size: The size of each time step in bytes
+        :rtype: int
+        """
+        return calendar_slots * calendar_slot_size
+
+    @staticmethod
+    def get_stream_keys(n_keys, n_streams):
+        """ Get how the keys are split between the send buffer streams.  Each\
+            stream has an aligned power-of-two block of the keys, so that it\
+            can have its own key space and mask.
+
+        :param n_keys: The number of keys
+        :param n_streams: The number of streams requested
+        :return: The number of keys of each stream, and the number of\
+            streams that have keys
+        :rtype: (int, int)
+        """
+        keys_per_stream = int(math.ceil(float(max(n_keys, 1)) / n_streams))
+        keys_per_stream = 1 << (keys_per_stream - 1).bit_length()
+        n_streams = int(math.ceil(float(max(n_keys, 1)) / keys_per_stream))
+        return keys_per_stream, n_streams
+
+    @staticmethod
+    def get_stream_buffer_space(send_buffer_max_space, n_streams):
+        """ Get the send buffer space of each stream, which is an equal\
+            share of the space, in whole words
+
+        :param send_buffer_max_space: The space of all of the streams
+        :param n_streams: The number of streams
+        :rtype: int
+        """
+        return (send_buffer_max_space // n_streams) & ~0x3
+
+    @classmethod
+    def get_stream_region(cls, stream):
+        """ Get the region holding the send buffer of a stream; the first\
+            uses the send buffer region, and the others follow the\
+            pattern region
+
+        :param stream: The index of the stream
+        :rtype: int
+        """
+        if stream == 0:
+            return cls._REGIONS.SEND_BUFFER.value
+        return cls._REGIONS.PATTERN.value + stream
+
+    @staticmethod
+    def get_configuration_region_size(n_streams):
+        """ Get the size of the configuration region
+
+        :param n_streams: The number of send buffer streams
+        :rtype: int
+        """
+        return (
+            ReverseIPTagMulticastSourceMachineVertex.
+            _CONFIGURATION_HEADER_SIZE +
+            (n_streams * ReverseIPTagMulticastSourceMachineVertex.
+                _STREAM_CONFIGURATION_SIZE))
+
     @staticmethod
     def get_sdram_usage(
-            send_buffer_times, send_buffer_max_space, recording_enabled):
+            send_buffer_times, send_buffer_max_space, recording_enabled,
+            calendar_size=0, n_streams=1, pattern_size=0):
         send_buffer_size = 0
         if send_buffer_times is not None:
             send_buffer_size = send_buffer_max_space
+        else:
+            n_streams = 1
 
         mallocs = \
             ReverseIPTagMulticastSourceMachineVertex.n_regions_to_allocate(
-                send_buffer_times is not None, recording_enabled)
+                send_buffer_times is not None or calendar_size > 0,
+                recording_enabled, n_streams, pattern_size > 0)
         allocation_size = mallocs * constants.SARK_PER_MALLOC_SDRAM_USAGE
 
         return (
             constants.SYSTEM_BYTES_REQUIREMENT +
             (ReverseIPTagMulticastSourceMachineVertex.
-                _CONFIGURATION_REGION_SIZE) +
-            send_buffer_size + allocation_size +
+                get_configuration_region_size(n_streams)) +
+            send_buffer_size + calendar_size + pattern_size +
+            allocation_size +
             (ReverseIPTagMulticastSourceMachineVertex.
-                get_provenance_data_size(0)))
+                get_provenance_data_size(
+                    ReverseIPTagMulticastSourceMachineVertex.
+                    N_ADDITIONAL_PROVENANCE_ITEMS)))
 
     @staticmethod
     def get_dtcm_usage():
@@ -337,14 +564,18 @@ class ReverseIPTagMulticastSourceMachineVertex(
         return 1
 
     @staticmethod
-    def n_regions_to_allocate(send_buffering, recording):
+    def n_regions_to_allocate(
+            send_buffering, recording, n_streams=1, pattern=False):
         """ Get the number of regions that will be allocated
         """
-        if recording and send_buffering:
-            return 5
-        elif recording or send_buffering:
-            return 4
-        return 3
+        n_regions = 3
+        if send_buffering:
+            n_regions += n_streams
+        if recording:
+            n_regions += 1
+        if pattern:
+            n_regions += 1
+        return n_regions
 
     @property
     def send_buffer_times(self):
@@ -372,14 +603,18 @@ class ReverseIPTagMulticastSourceMachineVertex(
         if self._virtual_key is None:
             key_to_send = 0
 
-        if self._send_buffer is not None:
-            self._send_buffer.clear()
+        if self._stream_buffers is not None:
+            for stream_buffer in self._stream_buffers:
+                stream_buffer.clear()
         if (self._send_buffer_times is not None and
                 len(self._send_buffer_times) != 0):
             if hasattr(self._send_buffer_times[0], "__len__"):
 
-                # Works with a list-of-lists
+                # Works with a list-of-lists; the keys of each stream are in
+                # one block, so the keys of a stream stay in time order
                 for key in range(self._n_keys):
+                    stream_buffer = self._stream_buffers[
+                        key // self._keys_per_stream]
                     for timeStamp in sorted(self._send_buffer_times[key]):
                         time_stamp_in_ticks = int(math.ceil(
                             float(int(timeStamp * 1000.0)) /
@@ -387,13 +622,17 @@ class ReverseIPTagMulticastSourceMachineVertex(
                         if self._is_in_range(
                                 time_stamp_in_ticks, first_machine_time_step,
                                 n_machine_time_steps):
-                            self._send_buffer.add_key(
+                            stream_buffer.add_key(
                                 time_stamp_in_ticks, key_to_send + key)
             else:
 
                 # Work with a single list
-                key_list = [
-                    key + key_to_send for key in range(self._n_keys)]
+                key_lists = [
+                    [key + key_to_send for key in range(
+                        stream * self._keys_per_stream,
+                        min((stream + 1) * self._keys_per_stream,
+                            self._n_keys))]
+                    for stream in xrange(self._n_streams)]
                 for timeStamp in sorted(self._send_buffer_times):
                     time_stamp_in_ticks = int(math.ceil(
                         float(int(timeStamp * 1000.0)) /
@@ -403,8 +642,10 @@ class ReverseIPTagMulticastSourceMachineVertex(
                     if self._is_in_range(
                             time_stamp_in_ticks, first_machine_time_step,
                             n_machine_time_steps):
-                        self._send_buffer.add_keys(
-                            time_stamp_in_ticks, key_list)
+                        for stream_buffer, key_list in zip(
+                                self._stream_buffers, key_lists):
+                            stream_buffer.add_keys(
+                                time_stamp_in_ticks, key_list)
 
     @staticmethod
     def _generate_prefix(virtual_key, prefix_type):
@@ -463,7 +704,8 @@ class ReverseIPTagMulticastSourceMachineVertex(
             size=constants.SYSTEM_BYTES_REQUIREMENT, label='SYSTEM')
         spec.reserve_memory_region(
             region=self._REGIONS.CONFIGURATION.value,
-            size=self._CONFIGURATION_REGION_SIZE, label='CONFIGURATION')
+            size=self.get_configuration_region_size(self._n_streams),
+            label='CONFIGURATION')
 
         # Reserve recording buffer regions if required
         spec.reserve_memory_region(
@@ -471,16 +713,34 @@ class ReverseIPTagMulticastSourceMachineVertex(
             size=recording_utilities.get_recording_header_size(1),
             label="RECORDING")
 
-        # Reserve send buffer region if required
+        # Reserve send buffer region if required, with the calendar after the
+        # send buffer
+        max_buffer_size = 0
         if self._send_buffer_times is not None:
             max_buffer_size = self.get_max_buffer_size_possible(
                 self._REGIONS.SEND_BUFFER.value)
+        if max_buffer_size + self._calendar_size > 0:
             spec.reserve_memory_region(
                 region=self._REGIONS.SEND_BUFFER.value,
-                size=max_buffer_size, label="SEND_BUFFER", empty=True)
+                size=max_buffer_size + self._calendar_size,
+                label="SEND_BUFFER", empty=True)
 
         self.reserve_provenance_data_region(spec)
 
+        # Reserve the pattern region if required
+        if self._replay_pattern is not None:
+            spec.reserve_memory_region(
+                region=self._REGIONS.PATTERN.value, size=self._pattern_size,
+                label="PATTERN")
+
+        # Reserve the send buffer regions of the other streams
+        for stream in xrange(1, self._n_streams):
+            region = self.get_stream_region(stream)
+            spec.reserve_memory_region(
+                region=region,
+                size=self.get_max_buffer_size_possible(region),
+                label="SEND_BUFFER_{}".format(stream), empty=True)
+
     def _update_virtual_key(self, routing_info, machine_graph):
         if self._virtual_key is None:
             if self._send_buffer_partition_id is not None:
@@ -506,6 +766,80 @@ class ReverseIPTagMulticastSourceMachineVertex(
     def _write_configuration(self, spec, ip_tags):
         spec.switch_write_focus(region=self._REGIONS.CONFIGURATION.value)
 
+        # Write the tag to send buffer requests to
+        if self._send_buffer_times is not None:
+
+            this_tag = None
+
+            for tag in ip_tags:
+                if tag.traffic_identifier == BufferManager.TRAFFIC_IDENTIFIER:
+                    this_tag = tag
+                    break
+            if this_tag is None:
+                raise Exception("Could not find tag for send buffering")
+            spec.write_value(data=this_tag.tag)
+        else:
+            spec.write_value(data=0)
+
+        # write SDP port to which SDP packets will be received
+        spec.write_value(data=self._receive_sdp_port)
+
+        # write the transmit queue size and pacing
+        spec.write_value(data=self._transmit_queue_size)
+        spec.write_value(data=self._get_transmit_rate())
+
+        # write the calendar details
+        spec.write_value(data=self._calendar_slots)
+        spec.write_value(data=self._calendar_slot_size)
+
+        # write the details of each stream
+        spec.write_value(data=self._n_streams)
+        spec.write_value(data=int(self._replay_pattern is not None))
+        for stream in xrange(self._n_streams):
+            self._write_stream_configuration(spec, stream)
+
+    def _get_transmit_rate(self):
+        """ Get the transmit rate as the core reads it, in packets per\
+            microsecond in fixed point, where 0 is not paced
+
+        :rtype: int
+        """
+        if self._transmit_packets_per_us == 0:
+            return 0
+
+        # A rate too small to represent is sent at the smallest rate
+        return max(1, int(round(
+            self._transmit_packets_per_us *
+            (1 << self._TRANSMIT_RATE_FRACTION_BITS))))
+
+    def _write_pattern(self, spec):
+        spec.switch_write_focus(region=self._REGIONS.PATTERN.value)
+
+        key_base = self._virtual_key
+        if self._virtual_key is None:
+            key_base = 0
+
+        spec.write_value(data=self._replay_start)
+        spec.write_value(data=len(self._replay_pattern))
+        spec.write_value(data=self._replay_n_repeats)
+        spec.write_value(data=self._replay_key_offset)
+        spec.write_value(data=sum(len(keys) for keys in self._replay_pattern))
+
+        # Write the index of the first key of each time step, and then the
+        # keys of all the time steps
+        index = [0]
+        for keys in self._replay_pattern:
+            index.append(index[-1] + len(keys))
+        spec.write_array(index)
+        pattern_keys = [
+            key_base + key for keys in self._replay_pattern for key in keys]
+        if len(pattern_keys) > 0:
+            spec.write_array(pattern_keys)
+
+    def _write_stream_configuration(self, spec, stream):
+        region = self.get_stream_region(stream)
+        spec.write_value(data=region)
+
         # Write apply_prefix and prefix and prefix_type
         if self._prefix is None:
             spec.write_value(data=0)
@@ -523,41 +857,37 @@ class ReverseIPTagMulticastSourceMachineVertex(
             spec.write_value(data=0)
 
         # Write if you have a key to transmit write it and the mask,
-        # otherwise write flags to fill in space
+        # otherwise write flags to fill in space; each stream only has its
+        # own block of the keys when there is more than one
         if self._virtual_key is None:
             spec.write_value(data=0)
             spec.write_value(data=0)
             spec.write_value(data=0)
-        else:
+        elif self._n_streams == 1:
             spec.write_value(data=1)
             spec.write_value(data=self._virtual_key)
             spec.write_value(data=self._mask)
+        else:
+            mask = self._mask | (0xFFFFFFFF - (self._keys_per_stream - 1))
+            spec.write_value(data=1)
+            spec.write_value(data=(
+                (self._virtual_key + stream * self._keys_per_stream) & mask))
+            spec.write_value(data=mask)
 
         # Write send buffer data
         if self._send_buffer_times is not None:
-
-            this_tag = None
-
-            for tag in ip_tags:
-                if tag.traffic_identifier == BufferManager.TRAFFIC_IDENTIFIER:
-                    this_tag = tag
-                    break
-            if this_tag is None:
-                raise Exception("Could not find tag for send buffering")
-
-            buffer_space = self.get_max_buffer_size_possible(
-                self._REGIONS.SEND_BUFFER.value)
-
-            spec.write_value(data=buffer_space)
+            spec.write_value(data=self.get_max_buffer_size_possible(region))
             spec.write_value(data=self._send_buffer_space_before_notify)
-            spec.write_value(data=this_tag.tag)
         else:
             spec.write_value(data=0)
             spec.write_value(data=0)
-            spec.write_value(data=0)
 
-        # write SDP port to which SDP packets will be received
-        spec.write_value(data=self._receive_sdp_port)
+        # write the refill request details
+        spec.write_value(data=self._send_buffer_refill_hysteresis)
+
+        # write whether the host writes into the buffer directly, in which
+        # case the core must not add packets to the buffer itself
+        spec.write_value(data=int(self.is_direct_write(region)))
 
     @inject_items({
         "machine_time_step": "MachineTimeStep",
@@ -604,9 +934,45 @@ class ReverseIPTagMulticastSourceMachineVertex(
         # Write the configuration information
         self._write_configuration(spec, iptags)
 
+        # Write the pattern to replay
+        if self._replay_pattern is not None:
+            self._write_pattern(spec)
+
         # End spec
         spec.end_specification()
 
+    @overrides(ProvidesProvenanceDataFromMachineImpl.
+               get_provenance_data_from_machine)
+    def get_provenance_data_from_machine(self, transceiver, placement):
+        provenance_data = self._read_provenance_data(transceiver, placement)
+        provenance_items = self._read_basic_provenance_items(
+            provenance_data, placement)
+        provenance_data = self._get_remaining_provenance_data_items(
+            provenance_data)
+        _, _, _, _, names = self._get_placement_details(placement)
+
+        provenance_items.append(ProvenanceDataItem(
+            self._add_name(names, "Times_the_transmit_queue_overflowed"),
+            provenance_data[0],
+            report=provenance_data[0] > 0,
+            message=(
+                "The reverse IP tag source dropped {} multicast packets "
+                "because its transmit queue was full. Try increasing the "
+                "transmit queue size, or reducing the rate at which events "
+                "are sent to the source".format(provenance_data[0]))))
+        provenance_items.append(ProvenanceDataItem(
+            self._add_name(names, "Future_packets_dropped"),
+            provenance_data[1],
+            report=provenance_data[1] > 0,
+            message=(
+                "The reverse IP tag source dropped {} packets with future "
+                "timestamps because they did not fit in its calendar, and "
+                "its send buffer could not hold them. Try increasing the "
+                "number of calendar slots or their size".format(
+                    provenance_data[1]))))
+
+        return provenance_items
+
     @overrides(AbstractHasAssociatedBinary.get_binary_file_name)
     def get_binary_file_name(self):
         return "reverse_iptag_multicast_source.aplx"
@@ -658,9 +1024,11 @@ class ReverseIPTagMulticastSourceMachineVertex(
             return sys.maxint
 
         # If recording and using pre-defined keys, use the maximum
-        if self._send_buffer is not None:
+        if self._stream_buffers is not None:
             return recording_utilities.get_n_timesteps_in_buffer_space(
-                buffer_space, [self._send_buffer.max_packets_in_timestamp])
+                buffer_space, [sum(
+                    stream_buffer.max_packets_in_timestamp
+                    for stream_buffer in self._stream_buffers)])
 
         # If recording and not using pre-defined keys, use the specified
         # rate to work it out - add 10% for safety
@@ -0,0 +1,70 @@
+import unittest
+
+from spinn_front_end_common.interface.buffer_management.storage_objects \
+    .direct_write_state import DirectWriteState
+
+
+class TestDirectWriteState(unittest.TestCase):
+
+    def test_spans_wrap_around_the_buffer(self):
+        state = DirectWriteState(1, 0x1000, 100)
+        self.assertEqual(state.get_spans(40), [(0x1000, 40)])
+        self.assertEqual(state.get_spans(100), [(0x1000, 100)])
+
+        state.add_pending(80, False)
+        self.assertTrue(state.update_last_received_sequence_number(0))
+        self.assertEqual(state.write_offset, 80)
+        self.assertEqual(state.get_spans(20), [(0x1000 + 80, 20)])
+        self.assertEqual(
+            state.get_spans(50), [(0x1000 + 80, 20), (0x1000, 30)])
+
+    def test_offset_only_moves_when_the_publish_is_received(self):
+        state = DirectWriteState(1, 0x1000, 100)
+        self.assertEqual(state.next_sequence_number, 0)
+        self.assertIsNone(state.pending_n_bytes)
+
+        # Nothing pending, so only the last sequence number is complete
+        self.assertTrue(state.update_last_received_sequence_number(255))
+        self.assertFalse(state.update_last_received_sequence_number(0))
+
+        state.add_pending(60, False)
+        self.assertEqual(state.pending_n_bytes, 60)
+
+        # An old sequence number leaves the data pending
+        self.assertFalse(state.update_last_received_sequence_number(255))
+        self.assertEqual(state.write_offset, 0)
+        self.assertEqual(state.next_sequence_number, 0)
+        self.assertEqual(state.pending_n_bytes, 60)
+
+        self.assertTrue(state.update_last_received_sequence_number(0))
+        self.assertEqual(state.write_offset, 60)
+        self.assertEqual(state.next_sequence_number, 1)
+        self.assertIsNone(state.pending_n_bytes)
+
+        state.add_pending(70, False)
+        self.assertTrue(state.update_last_received_sequence_number(1))
+        self.assertEqual(state.write_offset, 30)
+        self.assertEqual(state.next_sequence_number, 2)
+
+    def test_sequence_number_wraps(self):
+        state = DirectWriteState(1, 0x1000, 100)
+        for sequence in range(256):
+            state.add_pending(1, False)
+            self.assertTrue(
+                state.update_last_received_sequence_number(sequence))
+        self.assertEqual(state.next_sequence_number, 0)
+        self.assertEqual(state.write_offset, 56)
+
+    def test_stop_message(self):
+        state = DirectWriteState(1, 0x1000, 100)
+        self.assertFalse(state.sent_stop_message)
+        state.add_pending(10, False)
+        self.assertFalse(state.sent_stop_message)
+        state.add_pending(10, True)
+        self.assertTrue(state.sent_stop_message)
+        self.assertTrue(
+            DirectWriteState(1, 0x1000, 100, True).sent_stop_message)
+
+
+if __name__ == '__main__':
+    unittest.main()
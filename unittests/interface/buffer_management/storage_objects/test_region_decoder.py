@@ -0,0 +1,101 @@
+import random
+import unittest
+
+from spinn_front_end_common.interface.buffer_management \
+    import recording_utilities
+from spinn_front_end_common.interface.buffer_management.storage_objects \
+    .region_decoder import RegionDecoder
+
+
+def _varint(value):
+    data = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value != 0:
+            byte |= 0x80
+        data.append(byte)
+        if value == 0:
+            return data
+
+
+def _encode(history, level, record):
+    """ Encode a record in the way that recording.c does
+    """
+    def diff(index):
+        if index < len(history):
+            return record[index] ^ history[index]
+        return record[index]
+
+    length = len(record)
+    data = _varint(
+        (length << recording_utilities.COMPRESSION_LEVEL_BITS) | level)
+    i = 0
+    while i < length:
+        same_start = i
+        while i < length and diff(i) == 0:
+            i += 1
+        diff_start = i
+        while i < length and (
+                diff(i) != 0 or (i + 1 < length and diff(i + 1) != 0)):
+            i += 1
+        data.extend(_varint(diff_start - same_start))
+        data.extend(_varint(i - diff_start))
+        data.extend(diff(j) for j in xrange(diff_start, i))
+    return data
+
+
+class TestRegionDecoder(unittest.TestCase):
+
+    def test_round_trip(self):
+        rand = random.Random(42)
+        histories = [
+            bytearray()
+            for _ in xrange(recording_utilities.COMPRESSION_LEVELS)]
+        records = bytearray()
+        data = bytearray()
+        for _ in xrange(500):
+            level = rand.choice([0, 0, 0, 1, 2, 3])
+            history = histories[level]
+            record = bytearray(
+                history[i] if i < len(history) and rand.random() < 0.8
+                else rand.randint(0, 255)
+                for i in xrange(rand.randint(1, 400)))
+            data.extend(_encode(history, level, record))
+
+            # Space that a record did not need is left as padding
+            if rand.random() < 0.2:
+                data.extend(bytearray(rand.randint(1, 10)))
+            histories[level] = record[
+                :recording_utilities.COMPRESSION_HISTORY_SIZE]
+            records.extend(record)
+
+        # The data can arrive split anywhere
+        decoder = RegionDecoder()
+        decoded = bytearray()
+        offset = 0
+        while offset < len(data):
+            end = offset + rand.randint(1, 300)
+            decoded.extend(decoder.decode(data[offset:end]))
+            offset = end
+        self.assertEqual(decoded, records)
+
+    def test_record_the_same_as_the_last(self):
+        record = bytearray(range(1, 21))
+        data = _encode(bytearray(), 0, record)
+        data.extend(_encode(record, 0, record))
+
+        # A record with no differences is its length and one run
+        self.assertEqual(len(data), (1 + 1 + 1 + 20) + (1 + 1 + 1))
+        self.assertEqual(RegionDecoder().decode(data), record + record)
+
+    def test_incomplete_record_is_held_back(self):
+        record = bytearray(range(1, 50))
+        data = _encode(bytearray(), 0, record)
+        decoder = RegionDecoder()
+        self.assertEqual(decoder.decode(data[:-1]), bytearray())
+        self.assertEqual(decoder.decode(data[-1:]), record)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,191 @@
+import struct
+import unittest
+
+from spinn_front_end_common.interface.buffer_management \
+    import recording_utilities
+from spinn_front_end_common.interface.buffer_management.buffer_manager \
+    import BufferManager
+
+
+class _Vertex(object):
+
+    def __init__(self, recorded_region_ids):
+        self._recorded_region_ids = recorded_region_ids
+
+    def get_recorded_region_ids(self):
+        return self._recorded_region_ids
+
+    def get_recording_region_base_address(self, transceiver, placement):
+        return 0x60000000
+
+
+class _Placement(object):
+
+    def __init__(self, vertex, x=0, y=0, p=1):
+        self.vertex = vertex
+        self.x = x
+        self.y = y
+        self.p = p
+
+
+class _Transceiver(object):
+    """ A transceiver that holds the memory of a single core
+    """
+
+    def __init__(self, data):
+        self.data = data
+        self.reads = list()
+
+        self.messages = list()
+
+    def read_memory(self, x, y, base_address, length):
+        self.reads.append((base_address, length))
+        return self.data[:length]
+
+    def send_sdp_message(self, message):
+        self.messages.append(message)
+
+    def get_ack(self):
+        """ Get the last sequence number and the selective bits of the last\
+            read acknowledgement sent
+        """
+        _, last_sequence_no, _, selective = struct.unpack(
+            "<HBBI", self.messages[-1].data)
+        return last_sequence_no, selective
+
+
+class _ReadRequest(object):
+    """ A read request of one region
+    """
+
+    def __init__(self, sequence_no, start_address, length, region_id=0):
+        self.x = 0
+        self.y = 0
+        self.p = 1
+        self.sequence_no = sequence_no
+        self.n_requests = 1
+        self._start_address = start_address
+        self._length = length
+        self._region_id = region_id
+
+    def start_address(self, i):
+        return self._start_address
+
+    def space_to_be_read(self, i):
+        return self._length
+
+    def region_id(self, i):
+        return self._region_id
+
+
+def _header(
+        region_sizes, state_version=0, last_sequence_number=0, **kwargs):
+    words = recording_utilities.get_recording_header_array(
+        region_sizes, **kwargs)
+    data = bytearray(struct.pack("<{}I".format(len(words)), *words))
+    struct.pack_into(
+        "<II", data, 4 * 10, state_version, last_sequence_number)
+    return data
+
+
+def _buffer_manager(transceiver=None):
+    return BufferManager(None, None, transceiver, False, None)
+
+
+class TestBufferManager(unittest.TestCase):
+
+    def test_create_and_reset(self):
+        buffer_manager = _buffer_manager()
+        buffer_manager.reset()
+        buffer_manager.resume()
+
+    def test_recording_header_is_read_once(self):
+        transceiver = _Transceiver(_header(
+            [100, 200], read_window_size=4, framed_regions=[1]))
+        placement = _Placement(_Vertex([0, 1]))
+        buffer_manager = _buffer_manager(transceiver)
+        self.assertEqual(buffer_manager._get_read_window_size(placement), 4)
+        self.assertEqual(
+            buffer_manager._get_region_flags(placement, 1),
+            recording_utilities.REGION_FLAG_FRAMED)
+        self.assertEqual(buffer_manager._get_region_flags(placement, 0), 0)
+        self.assertEqual(transceiver.reads, [
+            (0x60000000, recording_utilities.get_recording_header_size(2))])
+
+        # A reset forgets the header, as the core may be loaded again
+        buffer_manager.reset()
+        buffer_manager._get_read_window_size(placement)
+        self.assertEqual(len(transceiver.reads), 2)
+
+    def test_more_regions_than_expected_are_read_again(self):
+        transceiver = _Transceiver(_header([100, 200, 300]))
+        placement = _Placement(_Vertex([0]))
+        header = _buffer_manager(transceiver)._read_recording_header(
+            placement)
+        self.assertEqual(header.n_regions, 3)
+        self.assertEqual(
+            [length for _, length in transceiver.reads], [
+                recording_utilities.get_recording_header_size(1),
+                recording_utilities.get_recording_header_size(3)])
+
+    def test_end_state_is_only_taken_once_complete(self):
+        placement = _Placement(_Vertex([0]))
+        transceiver = _Transceiver(_header([100]))
+        buffer_manager = _buffer_manager(transceiver)
+        with self.assertRaises(Exception):
+            buffer_manager._recover_end_buffering_state(placement, 0)
+
+        transceiver.data = _header(
+            [100], state_version=1, last_sequence_number=17)
+        buffer_manager._recover_end_buffering_state(placement, 0)
+        self.assertEqual(
+            buffer_manager._received_data.get_end_buffering_sequence_number(
+                0, 0, 1),
+            17)
+
+    def test_windowed_reads_are_acknowledged_selectively(self):
+        transceiver = _Transceiver(bytearray(100))
+        placement = _Placement(_Vertex([0]))
+        buffer_manager = _buffer_manager(transceiver)
+        received_data = buffer_manager._received_data
+
+        def request(sequence_no, length):
+            buffer_manager._retrieve_and_store_windowed_data(
+                _ReadRequest(sequence_no, 0x70000000 + length, length),
+                placement)
+
+        # A request read out of order is acknowledged by its bit, relative
+        # to the last request in order
+        request(1, 20)
+        self.assertEqual(transceiver.get_ack(), (0xFF, 0x2))
+        self.assertEqual(
+            received_data.last_sequence_no_for_core(0, 0, 1), 0xFF)
+
+        # The missing request completes both
+        request(0, 10)
+        self.assertEqual(transceiver.get_ack(), (1, 0))
+        self.assertEqual(
+            received_data.last_sequence_no_for_core(0, 0, 1), 1)
+        self.assertEqual(
+            received_data.get_read_history_space(0, 0, 1, 0, 0, 1, 8), 30)
+
+        # A repeated request is acknowledged again without being read again
+        request(1, 20)
+        self.assertEqual(transceiver.get_ack(), (1, 0))
+        self.assertEqual(len(transceiver.reads), 2)
+
+        # So is a request beyond the window
+        request(11, 5)
+        self.assertEqual(transceiver.get_ack(), (1, 0))
+        self.assertEqual(len(transceiver.reads), 2)
+
+        request(4, 5)
+        request(3, 5)
+        self.assertEqual(transceiver.get_ack(), (1, 0x6))
+        request(2, 5)
+        self.assertEqual(transceiver.get_ack(), (4, 0))
+        self.assertEqual(len(transceiver.reads), 5)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,104 @@
+from collections import namedtuple
+import struct
+import unittest
+
+from spinn_front_end_common.utilities import constants
+from spinn_front_end_common.utilities.connections.live_event_connection \
+    import LiveEventConnection
+
+# The parts of a command message that are decoded: the whole message and
+# the offset of the data after the command
+_Packet = namedtuple("_Packet", ["data", "offset"])
+
+
+def _command(command, header, values):
+    data = struct.pack("<H", 0x4000 | command.value) + header + values
+    return _Packet(data, 2)
+
+
+def _spike_frame(frame_format, time, base_key, first_word, values):
+    value_format = "<{}H" if frame_format == 1 else "<{}I"
+    return _command(
+        constants.EIEIO_COMMAND_IDS.EVENT_SPIKE_FRAME,
+        struct.pack(
+            "<HIIHH", frame_format, time, base_key, first_word, len(values)),
+        struct.pack(value_format.format(len(values)), *values))
+
+
+def _connection(labels):
+    """ Make a connection that can decode events from vertices with the\
+        given labels, without opening a socket to wait for the database
+    """
+    connection = LiveEventConnection.__new__(LiveEventConnection)
+    connection._receive_labels = labels
+    connection._key_to_atom_id_and_label = dict()
+    connection._live_event_callbacks = [list() for _ in labels]
+    connection._live_rate_callbacks = [list() for _ in labels]
+    return connection
+
+
+class TestLiveEventConnection(unittest.TestCase):
+
+    def test_decode_bitfield_spike_frame(self):
+        packet = _spike_frame(
+            0, 12, 0x10000, 1, [0x80000001, 0, 0x10])
+        time, keys = LiveEventConnection._decode_spike_frame(packet)
+        self.assertEqual(time, 12)
+        self.assertEqual(keys, [
+            0x10000 | 32, 0x10000 | 63, 0x10000 | (64 + 32 + 4)])
+
+    def test_decode_run_length_spike_frame(self):
+
+        # 3 atoms that did not fire, 2 that did, 5 that did not, 1 that did
+        packet = _spike_frame(1, 7, 0x20000, 2, [3, 2, 5, 1])
+        time, keys = LiveEventConnection._decode_spike_frame(packet)
+        self.assertEqual(time, 7)
+        self.assertEqual(
+            keys, [0x20000 | atom for atom in [67, 68, 74]])
+
+    def test_decode_run_length_spike_frame_ending_with_a_gap(self):
+        packet = _spike_frame(1, 0, 0, 0, [0, 1, 4])
+        self.assertEqual(
+            LiveEventConnection._decode_spike_frame(packet), (0, [0]))
+
+    def test_decode_empty_spike_frame(self):
+        packet = _spike_frame(0, 3, 0x100, 0, [])
+        self.assertEqual(
+            LiveEventConnection._decode_spike_frame(packet), (3, []))
+
+    def test_receive_rate_counts(self):
+        connection = _connection(["a", "b"])
+
+        # Each counter counts 4 atoms of a vertex
+        for atom in xrange(0, 16, 4):
+            connection._key_to_atom_id_and_label[0x30000 | atom] = (atom, 0)
+            connection._key_to_atom_id_and_label[0x40000 | atom] = (atom, 1)
+        received = list()
+        connection.add_receive_rate_callback(
+            "a", lambda *args: received.append(args))
+        connection.add_receive_rate_callback(
+            "b", lambda *args: received.append(args))
+
+        packet = _command(
+            constants.EIEIO_COMMAND_IDS.EVENT_RATE_COUNTS,
+            struct.pack("<HIIHH", 3, 100, 0x30000, 10, 2),
+            struct.pack("<6H", 0, 5, 2, 1, 3, 9))
+        connection._receive_rate_counts(packet)
+        self.assertEqual(
+            received, [("a", 100, 10, [(0, 5), (8, 1), (12, 9)])])
+
+    def test_receive_rate_counts_of_unknown_keys(self):
+        connection = _connection(["a"])
+        received = list()
+        connection.add_receive_rate_callback(
+            "a", lambda *args: received.append(args))
+        packet = _command(
+            constants.EIEIO_COMMAND_IDS.EVENT_RATE_COUNTS,
+            struct.pack("<HIIHH", 1, 5, 0x50000, 1, 0),
+            struct.pack("<2H", 0, 1))
+        connection._receive_rate_counts(packet)
+        self.assertEqual(received, [])
+
+
+if __name__ == "__main__":
+    unittest.main()
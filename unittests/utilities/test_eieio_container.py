@@ -0,0 +1,66 @@
+import struct
+import unittest
+
+from spinn_front_end_common.utilities import constants
+from spinn_front_end_common.utilities import eieio_container
+
+_CONTAINER_COMMAND = \
+    0x4000 | constants.EIEIO_COMMAND_IDS.EVENT_CONTAINER.value
+
+
+def _unpack(message):
+    """ Get the packets of a message, which is either a container or a\
+        single packet
+    """
+    if struct.unpack_from("<H", message)[0] != _CONTAINER_COMMAND:
+        return [message]
+    packets = list()
+    offset = 2
+    while offset < len(message):
+        length = struct.unpack_from("<H", message, offset)[0]
+        offset += 2
+        packets.append(message[offset:offset + length])
+        offset += length
+    return packets
+
+
+def _packet(index, size):
+    return struct.pack("<H", index) + chr(index & 0xFF) * (size - 2)
+
+
+class TestEIEIOContainer(unittest.TestCase):
+
+    def test_single_packet_is_not_contained(self):
+        packet = _packet(1, 10)
+        messages = eieio_container.pack_eieio_packets([packet], 100)
+        self.assertEqual(messages, [packet])
+
+    def test_round_trip(self):
+        packets = [_packet(i, 8 + (i * 7) % 60) for i in range(50)]
+        messages = eieio_container.pack_eieio_packets(packets, 256)
+        self.assertLess(len(messages), len(packets))
+        unpacked = list()
+        for message in messages:
+            self.assertLessEqual(len(message), 256)
+            unpacked.extend(_unpack(message))
+        self.assertEqual(unpacked, packets)
+
+    def test_packets_that_exactly_fill_a_message(self):
+        packets = [_packet(i, 10) for i in range(6)]
+
+        # A header of 2 bytes, and 12 bytes for each packet with its length
+        messages = eieio_container.pack_eieio_packets(packets, 2 + (3 * 12))
+        self.assertEqual(len(messages), 2)
+        for message in messages:
+            self.assertEqual(len(message), 2 + (3 * 12))
+        self.assertEqual(
+            [p for message in messages for p in _unpack(message)], packets)
+
+    def test_packet_too_big_to_share_is_sent_alone(self):
+        packets = [_packet(1, 10), _packet(2, 100), _packet(3, 10)]
+        messages = eieio_container.pack_eieio_packets(packets, 100)
+        self.assertEqual(messages, packets)
+
+
+if __name__ == "__main__":
+    unittest.main()